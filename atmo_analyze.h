@@ -0,0 +1,750 @@
+/*
+ * Copyright (C) 2009, 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ */
+
+/* ---
+ * Channel layout, image analysis and filters shared by plugin, analysis benchmark and batch analyzer.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include "atmo_hist.h"
+
+
+#define NUM_AREAS               9       /* Number of different areas (top, bottom ...) */
+#define OUTPUT_RATE             20      /* rate of output loop, filters are applied once per cycle [ms] */
+
+/* accuracy of color calculation */
+#define h_MAX   255
+#define s_MAX   255
+#define v_MAX   255
+
+/* macros */
+#define MIN(X, Y)  ((X) < (Y) ? (X) : (Y))
+#define MAX(X, Y)  ((X) > (Y) ? (X) : (Y))
+#define POS_DIV(a, b)  ( (a)/(b) + ( ((a)%(b) >= (b)/2 ) ? 1 : 0) )
+
+
+/*
+ * Channel layout with all per channel analyze, filter and output state.
+ * Threads hold a reference while they use it, so a new layout could be swapped in while playing.
+ */
+typedef struct {
+  int refs;                 /* reference counter, protected by plugin lock */
+  void *color_buf;          /* page aligned block of all color and filter buffers */
+  size_t color_buf_size;
+  int color_buf_locked;     /* color_buf is locked into memory */
+
+    /* layout */
+  int top;
+  int bottom;
+  int left;
+  int right;
+  int center;
+  int top_left;
+  int top_right;
+  int bottom_left;
+  int bottom_right;
+  int sum_channels;
+
+    /* analyze related */
+  uint8_t *weight;
+  int weight_width, weight_height, weight_edge_weighting, alloc_weight_size;
+  uint64_t *hue_hist, *sat_hist;
+  uint64_t *w_hue_hist, *w_sat_hist;
+  uint64_t *avg_bright;
+  int *most_used_hue, *last_most_used_hue, *most_used_sat, *avg_cnt;
+  rgb_color_t *analyzed_colors;
+  int64_t analyzed_vpts;    /* vpts of last analyzed frame */
+  atmo_trace_tag_t analyzed_tag;    /* latency trace tag of analyzed colors */
+
+    /* filter related */
+  rgb16_color_t *filtered_colors16;  /* filter output at 16 bit precision */
+  rgb_color_t *filtered_colors;     /* filter output rounded to 8 bit */
+  rgb_color_t *mean_filter_values;
+  rgb_color_sum_t *mean_filter_sum_values;
+  int old_mean_length;
+
+    /* output related */
+  rgb16_color_t *output_colors16;
+  rgb_color_t *output_colors, *last_output_colors;
+} atmo_channels_t;
+
+
+/*
+ * Buffers that could be locked into memory are allocated as whole pages. mlock() works on pages and is not counted,
+ * so unlocking a buffer that shares a page with another locked buffer would unlock the other one too.
+ */
+static size_t page_buffer_size(size_t size) {
+  const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  return (size + page - 1) / page * page;
+}
+
+
+static void *alloc_page_buffer(size_t size, int lock, int *locked) {
+  void *buf;
+
+  *locked = 0;
+  size = page_buffer_size(size);
+  if (posix_memalign(&buf, (size_t) sysconf(_SC_PAGESIZE), size))
+    return NULL;
+
+    /* lock buffer into memory and prefault its pages so that the output path runs without page faults */
+  if (lock) {
+    if (mlock(buf, size))
+      llprintf(LOG_1, "locking of %d bytes buffer failed: %s\n", (int)size, strerror(errno));
+    else
+      *locked = 1;
+  }
+  memset(buf, 0, size);
+  return buf;
+}
+
+
+static void free_page_buffer(void *buf, size_t size, int locked) {
+  if (buf && locked)
+    munlock(buf, page_buffer_size(size));
+  free(buf);
+}
+
+
+static inline void rgb_to_hsv(hsv_color_t *hsv, int r, int g, int b) {
+  int min, max, delta;
+  int h = 0;
+
+  min = MIN(MIN(r, g), b);
+  max = MAX(MAX(r, g), b);
+
+  delta = max - min;
+
+  hsv->v = (uint8_t) POS_DIV(max * v_MAX, 255);
+
+  if (delta == 0) {
+    h = 0;
+    hsv->s = 0;
+  } else {
+    hsv->s = (uint8_t) POS_DIV((delta * s_MAX) ,max);
+
+    int dr = (max - r) + 3 * delta;
+    int dg = (max - g) + 3 * delta;
+    int db = (max - b) + 3 * delta;
+    int divisor = 6 * delta;
+
+    if (r == max) {
+      h = POS_DIV(( (db - dg) * h_MAX ) , divisor);
+    } else if (g == max) {
+      h = POS_DIV( ((dr - db) * h_MAX) , divisor) + (h_MAX/3);
+    } else if (b == max) {
+      h = POS_DIV(( (dg - dr) * h_MAX) , divisor) + (h_MAX/3) * 2;
+    }
+
+    if (h < 0) {
+      h += h_MAX;
+    }
+    if (h > h_MAX) {
+      h -= h_MAX;
+    }
+  }
+  hsv->h = (uint8_t) h;
+}
+
+
+static void calc_hsv_image(hsv_color_t *hsv, uint8_t *rgb, int img_size) {
+  while (img_size--) {
+    rgb_to_hsv(hsv, rgb[0], rgb[1], rgb[2]);
+    ++hsv;
+    rgb += 3;
+  }
+}
+
+
+static void calc_weight(atmo_channels_t *ch, const int width, const int height, const int edge_weighting) {
+  int row, col, c;
+
+  const double w = edge_weighting > 10 ? (double)edge_weighting / 10.0: 10.0;
+
+  const int top_channels = ch->top;
+  const int bottom_channels = ch->bottom;
+  const int left_channels = ch->left;
+  const int right_channels = ch->right;
+  const int center_channel = ch->center;
+  const int top_left_channel = ch->top_left;
+  const int top_right_channel = ch->top_right;
+  const int bottom_left_channel = ch->bottom_left;
+  const int bottom_right_channel = ch->bottom_right;
+
+  const int sum_top_channels = top_channels + top_left_channel + top_right_channel;
+  const int sum_bottom_channels = bottom_channels + bottom_left_channel + bottom_right_channel;
+  const int sum_left_channels = left_channels + bottom_left_channel + top_left_channel;
+  const int sum_right_channels = right_channels + bottom_right_channel + top_right_channel;
+
+  uint8_t *weight = ch->weight;
+
+  const int center_y = height / 2;
+  const int center_x = width / 2;
+
+  const double fheight = height - 1;
+  const double fwidth = width - 1;
+
+  for (row = 0; row < height; ++row)
+  {
+    double row_norm = (double)row / fheight;
+    int top = (int)(255.0 * pow(1.0 - row_norm, w));
+    int bottom = (int)(255.0 * pow(row_norm, w));
+
+    for (col = 0; col < width; ++col)
+    {
+      double col_norm = (double)col / fwidth;
+      int left = (int)(255.0 * pow((1.0 - col_norm), w));
+      int right = (int)(255.0 * pow(col_norm, w));
+
+      for (c = top_left_channel; c < (top_channels + top_left_channel); ++c)
+        *weight++ = (col >= ((width * c) / sum_top_channels) && col < ((width * (c + 1)) / sum_top_channels) && row < center_y) ? top: 0;
+
+      for (c = bottom_left_channel; c < (bottom_channels + bottom_left_channel); ++c)
+        *weight++ = (col >= ((width * c) / sum_bottom_channels) && col < ((width * (c + 1)) / sum_bottom_channels) && row >= center_y) ? bottom: 0;
+
+      for (c = top_left_channel; c < (left_channels + top_left_channel); ++c)
+        *weight++ = (row >= ((height * c) / sum_left_channels) && row < ((height * (c + 1)) / sum_left_channels) && col < center_x) ? left: 0;
+
+      for (c = top_right_channel; c < (right_channels + top_right_channel); ++c)
+        *weight++ = (row >= ((height * c) / sum_right_channels) && row < ((height * (c + 1)) / sum_right_channels) && col >= center_x) ? right: 0;
+
+      if (center_channel)
+        *weight++ = 255;
+
+      if (top_left_channel)
+        *weight++ = (col < center_x && row < center_y) ? ((top > left) ? top: left) : 0;
+
+      if (top_right_channel)
+        *weight++ = (col >= center_x && row < center_y) ? ((top > right) ? top: right): 0;
+
+      if (bottom_left_channel)
+        *weight++ = (col < center_x && row >= center_y) ? ((bottom > left) ? bottom: left): 0;
+
+      if (bottom_right_channel)
+        *weight++ = (col >= center_x && row >= center_y) ? ((bottom > right) ? bottom: right): 0;
+    }
+  }
+}
+
+
+static void calc_hue_hist(atmo_channels_t *ch, const atmo_parameters_t *parm, hsv_color_t *hsv, int img_size) {
+  uint8_t *weight = ch->weight;
+  const int n = ch->sum_channels;
+  uint64_t * const hue_hist = ch->hue_hist;
+  const int darkness_limit = parm->darkness_limit;
+
+  memset(hue_hist, 0, (n * (h_MAX+1) * sizeof(uint64_t)));
+
+  while (img_size--) {
+    if (hsv->v >= darkness_limit) {
+      int c;
+      for (c = 0; c < n; ++c)
+        hue_hist[c * (h_MAX+1) + hsv->h] += weight[c] * hsv->v;
+    }
+    weight += n;
+    ++hsv;
+  }
+}
+
+
+static void calc_windowed_hue_hist(atmo_channels_t *ch, const atmo_parameters_t *parm) {
+  int i, c, w;
+  const int n = ch->sum_channels;
+  uint64_t * const hue_hist = ch->hue_hist;
+  uint64_t * const w_hue_hist = ch->w_hue_hist;
+  const int hue_win_size = parm->hue_win_size;
+
+  memset(w_hue_hist, 0, (n * (h_MAX+1) * sizeof(uint64_t)));
+
+  for (i = 0; i < (h_MAX+1); ++i)
+  {
+    for (w = -hue_win_size; w <= hue_win_size; w++)
+    {
+      int iw = i + w;
+
+      if (iw < 0)
+        iw = iw + h_MAX + 1;
+      if (iw > h_MAX)
+        iw = iw - h_MAX - 1;
+
+      uint64_t win_weight = (hue_win_size + 1) - abs(w);
+
+      for (c = 0; c < n; ++c)
+        w_hue_hist[c * (h_MAX+1) + i] += hue_hist[c * (h_MAX+1) + iw] * win_weight;
+    }
+  }
+}
+
+
+static void calc_most_used_hue(atmo_channels_t *ch, const atmo_parameters_t *parm) {
+  int i, c;
+
+  const int n = ch->sum_channels;
+  uint64_t * const w_hue_hist = ch->w_hue_hist;
+  int * const most_used_hue = ch->most_used_hue;
+  int * const last_most_used_hue = ch->last_most_used_hue;
+  const double hue_threshold = (double)parm->hue_threshold / 100.0;
+
+  memset(most_used_hue, 0, (n * sizeof(int)));
+
+  for (c = 0; c < n; ++c) {
+    uint64_t v = 0;
+    for (i = 0; i < (h_MAX + 1); ++i) {
+      if (w_hue_hist[c * (h_MAX+1) + i] > v) {
+        v = w_hue_hist[c * (h_MAX+1) + i];
+        most_used_hue[c] = i;
+      }
+    }
+    if (((double) w_hue_hist[c * (h_MAX+1) + last_most_used_hue[c]] / (double) v) > hue_threshold)
+      most_used_hue[c] = last_most_used_hue[c];
+    else
+      last_most_used_hue[c] = most_used_hue[c];
+  }
+}
+
+
+static void calc_sat_hist(atmo_channels_t *ch, const atmo_parameters_t *parm, hsv_color_t *hsv, int img_size) {
+  uint8_t *weight = ch->weight;
+  const int n = ch->sum_channels;
+  uint64_t * const sat_hist = ch->sat_hist;
+  int * const most_used_hue = ch->most_used_hue;
+  const int darkness_limit = parm->darkness_limit;
+  const int hue_win_size = parm->hue_win_size;
+
+  memset(sat_hist, 0, (n * (s_MAX+1) * sizeof(uint64_t)));
+
+  while (img_size--) {
+    if (hsv->v >= darkness_limit) {
+      int h = hsv->h;
+      int c;
+      for (c = 0; c < n; ++c) {
+        if (h > (most_used_hue[c] - hue_win_size) && h < (most_used_hue[c] + hue_win_size))
+          sat_hist[c * (s_MAX+1) + hsv->s] += weight[c] * hsv->v;
+      }
+    }
+    weight += n;
+    ++hsv;
+  }
+}
+
+
+static void calc_windowed_sat_hist(atmo_channels_t *ch, const atmo_parameters_t *parm) {
+  int i, c, w;
+  const int n = ch->sum_channels;
+  uint64_t * const sat_hist = ch->sat_hist;
+  uint64_t * const w_sat_hist = ch->w_sat_hist;
+  const int sat_win_size = parm->sat_win_size;
+
+  memset(w_sat_hist, 0, (n * (s_MAX+1) * sizeof(uint64_t)));
+
+  for (i = 0; i < (s_MAX+1); ++i)
+  {
+    for (w = -sat_win_size; w <= sat_win_size; w++)
+    {
+      int iw = i + w;
+
+      if (iw < 0)
+        iw = iw + s_MAX + 1;
+      if (iw > s_MAX)
+        iw = iw - s_MAX - 1;
+
+      uint64_t win_weight = (sat_win_size + 1) - abs(w);
+
+      for (c = 0; c < n; ++c)
+        w_sat_hist[c * (s_MAX+1) + i] += sat_hist[c * (s_MAX+1) + iw] * win_weight;
+    }
+  }
+}
+
+
+static void calc_most_used_sat(atmo_channels_t *ch) {
+  int i, c;
+  const int n = ch->sum_channels;
+  uint64_t * const w_sat_hist = ch->w_sat_hist;
+  int * const most_used_sat = ch->most_used_sat;
+
+  memset(most_used_sat, 0, (n * sizeof(int)));
+
+  for (c = 0; c < n; ++c) {
+    uint64_t v = 0;
+    for (i = 0; i < (s_MAX + 1); ++i) {
+      if (w_sat_hist[c * (s_MAX+1) + i] > v) {
+        v = w_sat_hist[c * (s_MAX+1) + i];
+        most_used_sat[c] = i;
+      }
+    }
+  }
+}
+
+
+static void calc_average_brightness(atmo_channels_t *ch, const atmo_parameters_t *parm, hsv_color_t *hsv, int img_size) {
+  uint8_t *weight = ch->weight;
+  int c;
+  const int n = ch->sum_channels;
+  const int darkness_limit = parm->darkness_limit;
+  const uint64_t bright = parm->brightness;
+  uint64_t * const avg_bright = ch->avg_bright;
+  int * const avg_cnt = ch->avg_cnt;
+
+  memset(avg_bright, 0, (n * sizeof(uint64_t)));
+  memset(avg_cnt, 0, (n * sizeof(int)));
+
+  while (img_size--) {
+    const int v = hsv->v;
+    if (v >= darkness_limit) {
+      for (c = 0; c < n; ++c) {
+        avg_bright[c] += v * weight[c];
+        avg_cnt[c] += weight[c];
+      }
+    }
+    weight += n;
+    ++hsv;
+  }
+
+  for (c = 0; c < n; ++c) {
+    if (avg_cnt[c]) {
+      avg_bright[c] = (avg_bright[c] * bright) / (avg_cnt[c] * ((uint64_t)100));
+      if (avg_bright[c] > v_MAX)
+        avg_bright[c] = v_MAX;
+    }
+  }
+}
+
+
+static void calc_uniform_average_brightness(atmo_channels_t *ch, const atmo_parameters_t *parm, hsv_color_t *hsv, int img_size) {
+  const int darkness_limit = parm->darkness_limit;
+  uint64_t avg = 0;
+  int cnt = 0;
+
+  while (img_size--) {
+    const int v = hsv->v;
+    if (v >= darkness_limit) {
+      avg += v;
+      ++cnt;
+    }
+    ++hsv;
+  }
+
+  if (cnt)
+    avg /= cnt;
+  else
+    avg = darkness_limit;
+
+  avg = (avg * parm->brightness) / 100;
+  if (avg > v_MAX)
+    avg = v_MAX;
+
+  uint64_t * const avg_bright = ch->avg_bright;
+  int c = ch->sum_channels;
+  while (c)
+    avg_bright[--c] = avg;
+}
+
+
+static void hsv_to_rgb(rgb_color_t *rgb, double h, double s, double v) {
+  rgb->r = rgb->g = rgb->b = 0;
+
+  h /= h_MAX;
+  s /= s_MAX;
+  v /= v_MAX;
+
+  if (s == 0.0) {
+    rgb->r = (uint8_t) (v * 255.0 + 0.5);
+    rgb->g = rgb->r;
+    rgb->b = rgb->r;
+  } else {
+    h = h * 6.0;
+    if (h == 6.0)
+      h = 0.0;
+    int i = (int) h;
+
+    double f = h - i;
+    double p = v * (1.0 - s);
+    double q = v * (1.0 - (s * f));
+    double t = v * (1.0 - (s * (1.0 - f)));
+
+    if (i == 0) {
+      rgb->r = (uint8_t) (v * 255.0 + 0.5);
+      rgb->g = (uint8_t) (t * 255.0 + 0.5);
+      rgb->b = (uint8_t) (p * 255.0 + 0.5);
+    } else if (i == 1) {
+      rgb->r = (uint8_t) (q * 255.0 + 0.5);
+      rgb->g = (uint8_t) (v * 255.0 + 0.5);
+      rgb->b = (uint8_t) (p * 255.0 + 0.5);
+    } else if (i == 2) {
+      rgb->r = (uint8_t) (p * 255.0 + 0.5);
+      rgb->g = (uint8_t) (v * 255.0 + 0.5);
+      rgb->b = (uint8_t) (t * 255.0 + 0.5);
+    } else if (i == 3) {
+      rgb->r = (uint8_t) (p * 255.0 + 0.5);
+      rgb->g = (uint8_t) (q * 255.0 + 0.5);
+      rgb->b = (uint8_t) (v * 255.0 + 0.5);
+    } else if (i == 4) {
+      rgb->r = (uint8_t) (t * 255.0 + 0.5);
+      rgb->g = (uint8_t) (p * 255.0 + 0.5);
+      rgb->b = (uint8_t) (v * 255.0 + 0.5);
+    } else {
+      rgb->r = (uint8_t) (v * 255.0 + 0.5);
+      rgb->g = (uint8_t) (p * 255.0 + 0.5);
+      rgb->b = (uint8_t) (q * 255.0 + 0.5);
+    }
+  }
+}
+
+
+static void calc_rgb_values(atmo_channels_t *ch)
+{
+  int c;
+  const int n = ch->sum_channels;
+
+  for (c = 0; c < n; ++c)
+    hsv_to_rgb(&ch->analyzed_colors[c], ch->most_used_hue[c], ch->most_used_sat[c], ch->avg_bright[c]);
+}
+
+
+static void free_channels(atmo_channels_t *ch) {
+  if (ch->sum_channels)
+  {
+    free(ch->hue_hist);
+    free(ch->w_hue_hist);
+    free(ch->most_used_hue);
+    free(ch->last_most_used_hue);
+
+    free(ch->sat_hist);
+    free(ch->w_sat_hist);
+    free(ch->most_used_sat);
+
+    free(ch->avg_bright);
+    free(ch->avg_cnt);
+
+    free_page_buffer(ch->color_buf, ch->color_buf_size, ch->color_buf_locked);
+  }
+  free(ch->weight);
+  free(ch);
+}
+
+
+static atmo_channels_t *config_channels(atmo_parameters_t *parm) {
+  atmo_channels_t *ch = (atmo_channels_t *) calloc(1, sizeof(atmo_channels_t));
+  if (!ch)
+    return NULL;
+
+  ch->refs = 1;
+  ch->top = parm->top;
+  ch->bottom = parm->bottom;
+  ch->left = parm->left;
+  ch->right = parm->right;
+  ch->center = parm->center;
+  ch->top_left = parm->top_left;
+  ch->top_right = parm->top_right;
+  ch->bottom_left = parm->bottom_left;
+  ch->bottom_right = parm->bottom_right;
+
+  int n = ch->top + ch->bottom + ch->left + ch->right + ch->center +
+          ch->top_left + ch->top_right + ch->bottom_left + ch->bottom_right;
+  ch->sum_channels = n;
+
+  if (n)
+  {
+    ch->hue_hist = (uint64_t *) calloc(n * (h_MAX + 1), sizeof(uint64_t));
+    ch->w_hue_hist = (uint64_t *) calloc(n * (h_MAX + 1), sizeof(uint64_t));
+    ch->most_used_hue = (int *) calloc(n, sizeof(int));
+    ch->last_most_used_hue = (int *) calloc(n, sizeof(int));
+
+    ch->sat_hist = (uint64_t *) calloc(n * (s_MAX + 1), sizeof(uint64_t));
+    ch->w_sat_hist = (uint64_t *) calloc(n * (s_MAX + 1), sizeof(uint64_t));
+    ch->most_used_sat = (int *) calloc(n, sizeof(int));
+
+    ch->avg_cnt = (int *) calloc(n, sizeof(int));
+    ch->avg_bright = (uint64_t *) calloc(n, sizeof(uint64_t));
+
+      /* color and filter buffers share one block, ordered by alignment */
+    ch->color_buf_size = n * (sizeof(rgb_color_sum_t) + 2 * sizeof(rgb16_color_t) + 5 * sizeof(rgb_color_t));
+    uint8_t *buf = (uint8_t *) alloc_page_buffer(ch->color_buf_size, parm->lock_memory, &ch->color_buf_locked);
+    if (!buf) {
+      free_channels(ch);
+      return NULL;
+    }
+    ch->color_buf = buf;
+    ch->mean_filter_sum_values = (rgb_color_sum_t *) buf;
+    buf += n * sizeof(rgb_color_sum_t);
+    ch->filtered_colors16 = (rgb16_color_t *) buf;
+    buf += n * sizeof(rgb16_color_t);
+    ch->output_colors16 = (rgb16_color_t *) buf;
+    buf += n * sizeof(rgb16_color_t);
+    ch->analyzed_colors = (rgb_color_t *) buf;
+    buf += n * sizeof(rgb_color_t);
+    ch->filtered_colors = (rgb_color_t *) buf;
+    buf += n * sizeof(rgb_color_t);
+    ch->output_colors = (rgb_color_t *) buf;
+    buf += n * sizeof(rgb_color_t);
+    ch->last_output_colors = (rgb_color_t *) buf;
+    buf += n * sizeof(rgb_color_t);
+    ch->mean_filter_values = (rgb_color_t *) buf;
+  }
+
+  llprintf(LOG_1, "configure channels top %d, bottom %d, left %d, right %d, center %d, topLeft %d, topRight %d, bottomLeft %d, bottomRight %d\n",
+                  ch->top, ch->bottom, ch->left, ch->right, ch->center,
+                  ch->top_left, ch->top_right, ch->bottom_left, ch->bottom_right);
+  return ch;
+}
+
+
+static int update_weight(atmo_channels_t *ch, int width, int height, int edge_weighting) {
+  if (width == ch->weight_width && height == ch->weight_height && edge_weighting == ch->weight_edge_weighting)
+    return 0;
+
+  int size = width * height * ch->sum_channels;
+  if (size > ch->alloc_weight_size) {
+    free(ch->weight);
+    ch->weight_width = ch->weight_height = ch->alloc_weight_size = 0;
+    ch->weight = (uint8_t *) malloc(size * sizeof(uint8_t));
+    if (!ch->weight)
+      return -1;
+    ch->alloc_weight_size = size;
+  }
+
+  calc_weight(ch, width, height, edge_weighting);
+  ch->weight_width = width;
+  ch->weight_height = height;
+  ch->weight_edge_weighting = edge_weighting;
+  return 0;
+}
+
+
+static void reset_filters(atmo_channels_t *ch) {
+  ch->old_mean_length = 0;
+}
+
+
+static void round_colors(rgb_color_t *out, const rgb16_color_t *in, int n) {
+  while (n--) {
+    out->r = RGB16_TO_8(in->r);
+    out->g = RGB16_TO_8(in->g);
+    out->b = RGB16_TO_8(in->b);
+    ++in;
+    ++out;
+  }
+}
+
+
+static void no_filter(atmo_channels_t *ch) {
+  rgb_color_t *act = ch->analyzed_colors;
+  rgb16_color_t *out16 = ch->filtered_colors16;
+  int n = ch->sum_channels;
+
+  memcpy(ch->filtered_colors, act, n * sizeof(rgb_color_t));
+  while (n--) {
+    out16->r = act->r << 8;
+    out16->g = act->g << 8;
+    out16->b = act->b << 8;
+    ++act;
+    ++out16;
+  }
+}
+
+
+/*
+ * The filters keep their output at 16 bit precision so that slow fades do not get stuck at 8 bit steps.
+ */
+static void percent_filter(atmo_channels_t *ch, const atmo_parameters_t *parm) {
+  rgb_color_t *act = ch->analyzed_colors;
+  rgb16_color_t *out16 = ch->filtered_colors16;
+  const int old_p = parm->filter_smoothness;
+  const int new_p = 100 - old_p;
+  int n = ch->sum_channels;
+
+  while (n--) {
+    out16->r = ((act->r << 8) * new_p + out16->r * old_p) / 100;
+    out16->g = ((act->g << 8) * new_p + out16->g * old_p) / 100;
+    out16->b = ((act->b << 8) * new_p + out16->b * old_p) / 100;
+    ++act;
+    ++out16;
+  }
+  round_colors(ch->filtered_colors, ch->filtered_colors16, ch->sum_channels);
+}
+
+
+static void mean_filter(atmo_channels_t *ch, const atmo_parameters_t *parm) {
+  rgb_color_t *act = ch->analyzed_colors;
+  rgb16_color_t *out16 = ch->filtered_colors16;
+  rgb_color_t *mean_values = ch->mean_filter_values;
+  rgb_color_sum_t *mean_sums = ch->mean_filter_sum_values;
+  const int64_t mean_threshold = (int64_t) ((double) parm->filter_threshold * 3.6);
+  const int old_p = parm->filter_smoothness;
+  const int new_p = 100 - old_p;
+  int n = ch->sum_channels;
+  const int filter_length = parm->filter_length;
+  const int64_t mean_length = (filter_length < OUTPUT_RATE) ? 1: filter_length / OUTPUT_RATE;
+  const int reinitialize = ((int)mean_length != ch->old_mean_length);
+  ch->old_mean_length = (int)mean_length;
+
+  while (n--) {
+    mean_sums->r += (act->r - mean_values->r);
+    mean_values->r = (uint8_t) (mean_sums->r / mean_length);
+
+    mean_sums->g += (act->g - mean_values->g);
+    mean_values->g = (uint8_t) (mean_sums->g / mean_length);
+
+    mean_sums->b += (act->b - mean_values->b);
+    mean_values->b = (uint8_t) (mean_sums->b / mean_length);
+
+      /*
+       * check, if there is a jump -> check if differences between actual values and filter values are too big
+       */
+    int64_t dist = (int64_t)(mean_values->r - act->r) * (int64_t)(mean_values->r - act->r) +
+                    (int64_t)(mean_values->g - act->g) * (int64_t)(mean_values->g - act->g) +
+                    (int64_t)(mean_values->b - act->b) * (int64_t)(mean_values->b - act->b);
+
+    if (dist > 0)
+      dist = (int64_t) sqrt((double) dist);
+
+      /* compare calculated distance with the filter threshold */
+    if (dist > mean_threshold || reinitialize) {
+        /* filter jump detected -> set the long filters to the result of the short filters */
+      out16->r = act->r << 8;
+      out16->g = act->g << 8;
+      out16->b = act->b << 8;
+      *mean_values = *act;
+      mean_sums->r = act->r * mean_length;
+      mean_sums->g = act->g * mean_length;
+      mean_sums->b = act->b * mean_length;
+    }
+    else
+    {
+        /* apply an additional percent filter to the mean values at full precision */
+      out16->r = (int) (((mean_sums->r << 8) / mean_length * new_p + out16->r * old_p) / 100);
+      out16->g = (int) (((mean_sums->g << 8) / mean_length * new_p + out16->g * old_p) / 100);
+      out16->b = (int) (((mean_sums->b << 8) / mean_length * new_p + out16->b * old_p) / 100);
+    }
+
+    ++act;
+    ++out16;
+    ++mean_sums;
+    ++mean_values;
+  }
+  round_colors(ch->filtered_colors, ch->filtered_colors16, ch->sum_channels);
+}
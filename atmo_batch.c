@@ -0,0 +1,866 @@
+/*
+ * Copyright (C) 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ */
+
+/* ---
+ * Offline batch analyzer: runs the image analysis and filters of the plugin on Y4M or raw RGB24 video
+ * and writes the zone colors of each frame. It does not need xine.
+ *
+ * Frames are read in chunks. The frames of a chunk are analyzed in parallel by worker threads,
+ * only the hue hysteresis between frames and the filters run sequentially in frame order.
+ * Their state is carried from chunk to chunk so the result does not depend on chunk size or thread count.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#define LOG_1           0
+#define LOG_2           0
+#define llprintf(cat, fmt, args...)  do { if (cat) fprintf(stderr, "atmo: " fmt, ##args); } while (0)
+
+#include "atmo_types.h"
+#include "atmo_analyze.h"
+#include "atmo_cache.h"
+
+
+#define BATCH_CHUNK_FRAMES      32      /* default number of frames per chunk and thread */
+#define BATCH_CHUNK_BYTES       (256 << 20)     /* memory limit of default chunk size */
+#define Y4M_MAGIC               "YUV4MPEG2 "
+#define Y4M_MAX_LINE            1024
+
+
+typedef struct {
+  const char *name;
+  size_t offset;
+  int min, max;
+} batch_param_t;
+
+#define BATCH_PARAM(name, min, max)  { #name, offsetof(atmo_parameters_t, name), min, max }
+
+  /* parameters of the plugin used by analysis and filters, same names and ranges */
+static const batch_param_t batch_params[] = {
+  BATCH_PARAM(top, 0, 25),
+  BATCH_PARAM(bottom, 0, 25),
+  BATCH_PARAM(left, 0, 25),
+  BATCH_PARAM(right, 0, 25),
+  BATCH_PARAM(center, 0, 1),
+  BATCH_PARAM(top_left, 0, 1),
+  BATCH_PARAM(top_right, 0, 1),
+  BATCH_PARAM(bottom_left, 0, 1),
+  BATCH_PARAM(bottom_right, 0, 1),
+  BATCH_PARAM(analyze_size, 0, 3),
+  BATCH_PARAM(overscan, 0, 200),
+  BATCH_PARAM(darkness_limit, 0, 100),
+  BATCH_PARAM(edge_weighting, 10, 200),
+  BATCH_PARAM(hue_win_size, 0, 5),
+  BATCH_PARAM(sat_win_size, 0, 5),
+  BATCH_PARAM(hue_threshold, 0, 100),
+  BATCH_PARAM(brightness, 50, 300),
+  BATCH_PARAM(uniform_brightness, 0, 1),
+  BATCH_PARAM(filter, 0, 2),
+  BATCH_PARAM(filter_smoothness, 1, 100),
+  BATCH_PARAM(filter_length, 300, 5000),
+  BATCH_PARAM(filter_threshold, 1, 100),
+  { NULL }
+};
+
+static const char *filter_names[] = { "off", "percentage", "combined", NULL };
+
+
+  /* YCbCr to RGB coefficients (16.16 fixed point) */
+typedef struct {
+  int y_offset, y, rv, gu, gv, bu;
+} yuv_matrix_t;
+
+static const yuv_matrix_t yuv_matrix[2][2] = {
+  { { 16, 76309, 104597, -25675, -53279, 132201 },      /* BT.601 limited range */
+    { 0, 65536, 91881, -22554, -46802, 116130 } },      /* BT.601 full range */
+  { { 16, 76309, 117489, -13975, -34925, 138438 },      /* BT.709 limited range */
+    { 0, 65536, 103206, -12276, -30679, 121609 } }      /* BT.709 full range */
+};
+
+
+typedef struct {
+  FILE *fp;
+  const char *name;
+  int y4m;
+  int width, height;
+  int chroma_shift_x, chroma_shift_y, mono;     /* Y4M chroma subsampling */
+  int chroma_width, chroma_height;
+  const yuv_matrix_t *matrix;
+  int rate_num, rate_den;
+  size_t frame_size;
+} batch_input_t;
+
+
+typedef struct batch_s batch_t;
+
+typedef struct {
+  batch_t *batch;
+  int64_t first;                /* number of first frame */
+  int nframes;
+  int eof;
+  uint8_t *src;                 /* source frames */
+  hsv_color_t *hsv;             /* hsv analyze images */
+  uint64_t *w_hue_hist;         /* windowed hue histograms */
+  int *most_used_hue;
+  rgb_color_t *colors;          /* analyzed colors */
+} batch_chunk_t;
+
+typedef struct {
+  batch_t *batch;
+  pthread_t thread;
+  atmo_channels_t *ch;
+  uint8_t *rgb;                 /* analyze image */
+} batch_worker_t;
+
+enum { STAGE_HUE, STAGE_SAT };
+
+struct batch_s {
+  batch_input_t in;
+  atmo_parameters_t parm;
+  int width, height;            /* analyze image size */
+  int *box_x, *box_y;           /* source pixel ranges of analyze image columns and rows */
+  int nchannels;
+  int chunk_frames;
+  int nthreads;
+  batch_worker_t *workers;
+  batch_chunk_t *work;          /* chunk processed by workers */
+  int stage;
+  int next_frame;               /* next frame of work chunk taken by a worker */
+  atmo_channels_t *seq;         /* state of hue hysteresis and filters */
+  int64_t next_tick;            /* time of next output loop cycle [ms] */
+  FILE *out;
+  FILE *cache;
+  atmo_cache_rec_t *cache_rec;
+  int cache_rec_size;
+};
+
+
+static int64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static int parse_params(atmo_parameters_t *parm, char *s) {
+  char *tok, *save = NULL;
+  const batch_param_t *p;
+
+  for (tok = strtok_r(s, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    char *val = strchr(tok, '=');
+    char *end;
+    long v;
+    int i;
+
+    if (!val) {
+      fprintf(stderr, "invalid parameter '%s', expected name=value\n", tok);
+      return -1;
+    }
+    *val++ = 0;
+    for (p = batch_params; p->name && strcmp(p->name, tok); ++p)
+      ;
+    if (!p->name) {
+        /* parameter strings of the plugin contain also output parameters */
+      fprintf(stderr, "ignoring parameter '%s'\n", tok);
+      continue;
+    }
+    v = strtol(val, &end, 10);
+    if (end == val || *end) {
+      v = -1;
+      for (i = 0; p->offset == offsetof(atmo_parameters_t, filter) && filter_names[i]; ++i) {
+        if (!strcmp(val, filter_names[i]))
+          v = i;
+      }
+    }
+    if (v < p->min || v > p->max) {
+      fprintf(stderr, "invalid value '%s' of parameter '%s', range is %d..%d\n", val, p->name, p->min, p->max);
+      return -1;
+    }
+    *(int *) ((char *) parm + p->offset) = (int) v;
+  }
+  return 0;
+}
+
+
+static int read_line(FILE *fp, char *buf, int size) {
+  int c, n = 0;
+
+  while ((c = getc(fp)) != EOF && c != '\n') {
+    if (n < size - 1)
+      buf[n++] = c;
+  }
+  buf[n] = 0;
+  return (c == EOF && !n) ? -1: n;
+}
+
+
+static int parse_y4m_header(batch_input_t *in) {
+  char line[Y4M_MAX_LINE];
+  char *tok, *save = NULL;
+  int full_range = 0;
+
+  if (read_line(in->fp, line, sizeof(line)) < 0 || strncmp(line, Y4M_MAGIC, strlen(Y4M_MAGIC))) {
+    fprintf(stderr, "'%s' is not a Y4M stream\n", in->name);
+    return -1;
+  }
+  in->chroma_shift_x = in->chroma_shift_y = 1;
+  in->rate_num = 25;
+  in->rate_den = 1;
+  for (tok = strtok_r(line + strlen(Y4M_MAGIC), " ", &save); tok; tok = strtok_r(NULL, " ", &save)) {
+    switch (tok[0]) {
+    case 'W':
+      in->width = atoi(tok + 1);
+      break;
+    case 'H':
+      in->height = atoi(tok + 1);
+      break;
+    case 'F':
+      if (sscanf(tok + 1, "%d:%d", &in->rate_num, &in->rate_den) != 2 || in->rate_num <= 0 || in->rate_den <= 0) {
+        fprintf(stderr, "%s: invalid frame rate '%s'\n", in->name, tok + 1);
+        return -1;
+      }
+      break;
+    case 'C':
+      if (!strncmp(tok + 1, "420", 3) && (!tok[4] || !strcmp(tok + 4, "jpeg") || !strcmp(tok + 4, "paldv") || !strcmp(tok + 4, "mpeg2")))
+        in->chroma_shift_x = in->chroma_shift_y = 1;
+      else if (!strcmp(tok + 1, "422")) {
+        in->chroma_shift_x = 1;
+        in->chroma_shift_y = 0;
+      } else if (!strcmp(tok + 1, "444"))
+        in->chroma_shift_x = in->chroma_shift_y = 0;
+      else if (!strcmp(tok + 1, "mono"))
+        in->mono = 1;
+      else {
+        fprintf(stderr, "%s: unsupported colorspace '%s', 8 bit 420, 422, 444 or mono is required\n", in->name, tok + 1);
+        return -1;
+      }
+      break;
+    case 'X':
+      if (!strcmp(tok + 1, "COLORRANGE=FULL"))
+        full_range = 1;
+      break;
+    }
+  }
+  if (in->width <= 0 || in->height <= 0) {
+    fprintf(stderr, "%s: missing frame size\n", in->name);
+    return -1;
+  }
+
+    /* HD material is assumed to be BT.709 as it is done by the video output drivers */
+  in->matrix = &yuv_matrix[in->height > 576][full_range];
+  in->chroma_width = (in->width + (1 << in->chroma_shift_x) - 1) >> in->chroma_shift_x;
+  in->chroma_height = (in->height + (1 << in->chroma_shift_y) - 1) >> in->chroma_shift_y;
+  in->frame_size = (size_t) in->width * in->height;
+  if (!in->mono)
+    in->frame_size += 2 * (size_t) in->chroma_width * in->chroma_height;
+  return 0;
+}
+
+
+static int open_input(batch_input_t *in, const char *arg, int rate) {
+  const char *path = strchr(arg, ':');
+
+    /* argument is a Y4M stream or WIDTHxHEIGHT:path of a raw RGB24 stream, path '-' is stdin */
+  memset(in, 0, sizeof(*in));
+  if (path && sscanf(arg, "%dx%d", &in->width, &in->height) == 2) {
+    if (in->width <= 0 || in->height <= 0) {
+      fprintf(stderr, "invalid input argument '%s', expected WIDTHxHEIGHT:file\n", arg);
+      return -1;
+    }
+    arg = path + 1;
+  } else
+    in->y4m = 1;
+
+  in->name = strcmp(arg, "-") ? arg: "stdin";
+  in->fp = strcmp(arg, "-") ? fopen(arg, "rb"): stdin;
+  if (!in->fp) {
+    fprintf(stderr, "can't open '%s': %s\n", arg, strerror(errno));
+    return -1;
+  }
+
+  if (in->y4m)
+    return parse_y4m_header(in);
+  in->rate_num = rate;
+  in->rate_den = 1;
+  in->frame_size = (size_t) in->width * in->height * 3;
+  return 0;
+}
+
+
+  /* returns 1 at end of stream */
+static int read_frame(batch_input_t *in, uint8_t *frame) {
+  char line[Y4M_MAX_LINE];
+  size_t n;
+
+  if (in->y4m) {
+    if (read_line(in->fp, line, sizeof(line)) < 0)
+      return 1;
+    if (strncmp(line, "FRAME", 5)) {
+      fprintf(stderr, "%s: invalid frame header\n", in->name);
+      return -1;
+    }
+  }
+  n = fread(frame, 1, in->frame_size, in->fp);
+  if (n == in->frame_size)
+    return 0;
+  if (ferror(in->fp)) {
+    fprintf(stderr, "%s: read failed: %s\n", in->name, strerror(errno));
+    return -1;
+  }
+  if (n || in->y4m) {
+    fprintf(stderr, "%s: incomplete last frame\n", in->name);
+    return -1;
+  }
+  return 1;
+}
+
+
+  /*
+   * Source ranges of the analyze image pixels. As the plugin does, the overscan border is
+   * cropped from the source frame and the remaining window is scaled down to the analyze size.
+   */
+static int init_boxes(batch_t *b) {
+  const int crop_x = b->in.width * b->parm.overscan / 1000;
+  const int crop_y = b->in.height * b->parm.overscan / 1000;
+  const int w = b->in.width - 2 * crop_x;
+  const int h = b->in.height - 2 * crop_y;
+  int i;
+
+  b->width = (b->parm.analyze_size + 1) * 64;
+  b->height = (b->width * b->in.height) / b->in.width;
+  if (b->height < 1)
+    b->height = 1;
+  b->box_x = (int *) malloc((b->width + 1) * sizeof(int));
+  b->box_y = (int *) malloc((b->height + 1) * sizeof(int));
+  if (!b->box_x || !b->box_y)
+    return -1;
+  for (i = 0; i <= b->width; ++i)
+    b->box_x[i] = crop_x + (int) (((int64_t) i * w) / b->width);
+  for (i = 0; i <= b->height; ++i)
+    b->box_y[i] = crop_y + (int) (((int64_t) i * h) / b->height);
+  return 0;
+}
+
+
+static inline uint8_t clip_rgb(int v) {
+  return (v < 0) ? 0: ((v > 255) ? 255: v);
+}
+
+
+static void scale_rgb_frame(const batch_t *b, const uint8_t *src, uint8_t *rgb) {
+  const int stride = b->in.width * 3;
+  int x, y, sx, sy;
+
+  for (y = 0; y < b->height; ++y) {
+    const int y0 = b->box_y[y];
+    const int y1 = (b->box_y[y + 1] > y0) ? b->box_y[y + 1]: y0 + 1;
+    for (x = 0; x < b->width; ++x) {
+      const int x0 = b->box_x[x];
+      const int x1 = (b->box_x[x + 1] > x0) ? b->box_x[x + 1]: x0 + 1;
+      const int cnt = (x1 - x0) * (y1 - y0);
+      uint32_t r = 0, g = 0, bl = 0;
+      for (sy = y0; sy < y1; ++sy) {
+        const uint8_t *p = src + sy * stride + x0 * 3;
+        for (sx = x0; sx < x1; ++sx) {
+          r += p[0];
+          g += p[1];
+          bl += p[2];
+          p += 3;
+        }
+      }
+      *rgb++ = (r + cnt / 2) / cnt;
+      *rgb++ = (g + cnt / 2) / cnt;
+      *rgb++ = (bl + cnt / 2) / cnt;
+    }
+  }
+}
+
+
+static void scale_yuv_frame(const batch_t *b, const uint8_t *src, uint8_t *rgb) {
+  const batch_input_t *in = &b->in;
+  const yuv_matrix_t *m = in->matrix;
+  const uint8_t *u_plane = src + (size_t) in->width * in->height;
+  const uint8_t *v_plane = u_plane + (size_t) in->chroma_width * in->chroma_height;
+  int x, y, sx, sy;
+
+  for (y = 0; y < b->height; ++y) {
+    const int y0 = b->box_y[y];
+    const int y1 = (b->box_y[y + 1] > y0) ? b->box_y[y + 1]: y0 + 1;
+    const int cy0 = y0 >> in->chroma_shift_y;
+    const int cy1 = ((y1 - 1) >> in->chroma_shift_y) + 1;
+    for (x = 0; x < b->width; ++x) {
+      const int x0 = b->box_x[x];
+      const int x1 = (b->box_x[x + 1] > x0) ? b->box_x[x + 1]: x0 + 1;
+      int cnt = (x1 - x0) * (y1 - y0);
+      uint32_t ys = 0, us = 0, vs = 0;
+      int yv, u = 0, v = 0;
+
+      for (sy = y0; sy < y1; ++sy) {
+        const uint8_t *p = src + sy * in->width + x0;
+        for (sx = x0; sx < x1; ++sx)
+          ys += *p++;
+      }
+      yv = (ys + cnt / 2) / cnt - m->y_offset;
+
+      if (!in->mono) {
+        const int cx0 = x0 >> in->chroma_shift_x;
+        const int cx1 = ((x1 - 1) >> in->chroma_shift_x) + 1;
+        cnt = (cx1 - cx0) * (cy1 - cy0);
+        for (sy = cy0; sy < cy1; ++sy) {
+          const int offset = sy * in->chroma_width;
+          for (sx = cx0; sx < cx1; ++sx) {
+            us += u_plane[offset + sx];
+            vs += v_plane[offset + sx];
+          }
+        }
+        u = (int) ((us + cnt / 2) / cnt) - 128;
+        v = (int) ((vs + cnt / 2) / cnt) - 128;
+      }
+
+      yv *= m->y;
+      *rgb++ = clip_rgb((yv + m->rv * v + 32768) >> 16);
+      *rgb++ = clip_rgb((yv + m->gu * u + m->gv * v + 32768) >> 16);
+      *rgb++ = clip_rgb((yv + m->bu * u + 32768) >> 16);
+    }
+  }
+}
+
+
+static void *batch_worker(void *arg) {
+  batch_worker_t *w = (batch_worker_t *) arg;
+  batch_t *b = w->batch;
+  batch_chunk_t *c = b->work;
+  atmo_channels_t *ch = w->ch;
+  atmo_parameters_t *parm = &b->parm;
+  const int n = b->nchannels;
+  const int img_size = b->width * b->height;
+  int f;
+
+  while ((f = __atomic_fetch_add(&b->next_frame, 1, __ATOMIC_RELAXED)) < c->nframes) {
+    hsv_color_t *hsv = c->hsv + (size_t) f * img_size;
+
+    if (b->stage == STAGE_HUE) {
+      if (b->in.y4m)
+        scale_yuv_frame(b, c->src + f * b->in.frame_size, w->rgb);
+      else
+        scale_rgb_frame(b, c->src + f * b->in.frame_size, w->rgb);
+      calc_hsv_image(hsv, w->rgb, img_size);
+      calc_hue_hist(ch, parm, hsv, img_size);
+      calc_windowed_hue_hist(ch, parm);
+      memcpy(c->w_hue_hist + (size_t) f * n * (h_MAX+1), ch->w_hue_hist, n * (h_MAX+1) * sizeof(uint64_t));
+    } else {
+      memcpy(ch->most_used_hue, c->most_used_hue + f * n, n * sizeof(int));
+      calc_sat_hist(ch, parm, hsv, img_size);
+      calc_windowed_sat_hist(ch, parm);
+      calc_most_used_sat(ch);
+      if (parm->uniform_brightness)
+        calc_uniform_average_brightness(ch, parm, hsv, img_size);
+      else
+        calc_average_brightness(ch, parm, hsv, img_size);
+      calc_rgb_values(ch);
+      memcpy(c->colors + f * n, ch->analyzed_colors, n * sizeof(rgb_color_t));
+    }
+  }
+  return NULL;
+}
+
+
+static int run_stage(batch_t *b, batch_chunk_t *c, int stage) {
+  int i, err;
+
+  b->work = c;
+  b->stage = stage;
+  b->next_frame = 0;
+  for (i = 0; i < b->nthreads; ++i) {
+    if ((err = pthread_create(&b->workers[i].thread, NULL, batch_worker, &b->workers[i]))) {
+      fprintf(stderr, "can't create worker thread: %s\n", strerror(err));
+      break;
+    }
+  }
+  if (!i)
+    return -1;
+  while (i--)
+    pthread_join(b->workers[i].thread, NULL);
+  return 0;
+}
+
+
+  /* hue hysteresis depends on the previous frame so it runs in frame order */
+static void calc_chunk_hue(batch_t *b, batch_chunk_t *c) {
+  atmo_channels_t *seq = b->seq;
+  const int n = b->nchannels;
+  int f;
+
+  for (f = 0; f < c->nframes; ++f) {
+    memcpy(seq->w_hue_hist, c->w_hue_hist + (size_t) f * n * (h_MAX+1), n * (h_MAX+1) * sizeof(uint64_t));
+    calc_most_used_hue(seq, &b->parm);
+    memcpy(c->most_used_hue + f * n, seq->most_used_hue, n * sizeof(int));
+  }
+}
+
+
+static void apply_filter(batch_t *b) {
+  atmo_channels_t *seq = b->seq;
+
+  switch (b->parm.filter) {
+  case 1:
+    percent_filter(seq, &b->parm);
+    break;
+  case 2:
+    mean_filter(seq, &b->parm);
+    break;
+  default:
+    no_filter(seq);
+  }
+}
+
+
+  /*
+   * The plugin applies the filters once per output loop cycle to the colors of the frame displayed at that time.
+   * This is replayed with the frame rate of the input, the output of a frame are the filtered colors at its display time.
+   */
+static int output_chunk(batch_t *b, batch_chunk_t *c) {
+  atmo_channels_t *seq = b->seq;
+  const int n = b->nchannels;
+  int f, i;
+
+  for (f = 0; f < c->nframes; ++f) {
+    const int64_t frame = c->first + f;
+    const int64_t pos = (frame * 1000 * b->in.rate_den) / b->in.rate_num;
+
+    while (b->next_tick < pos) {
+      apply_filter(b);
+      b->next_tick += OUTPUT_RATE;
+    }
+    memcpy(seq->analyzed_colors, c->colors + f * n, n * sizeof(rgb_color_t));
+    if (b->next_tick == pos) {
+      apply_filter(b);
+      b->next_tick += OUTPUT_RATE;
+    }
+
+    if (b->out) {
+      fprintf(b->out, "%lld %lld", (long long) frame, (long long) pos);
+      for (i = 0; i < n; ++i)
+        fprintf(b->out, " %02x%02x%02x", seq->filtered_colors[i].r, seq->filtered_colors[i].g, seq->filtered_colors[i].b);
+      fputc('\n', b->out);
+    }
+
+      /* the color cache holds the unfiltered colors */
+    if (b->cache) {
+      b->cache_rec->pos = pos;
+      memcpy(b->cache_rec->colors, c->colors + f * n, n * sizeof(rgb_color_t));
+      if (fwrite(b->cache_rec, b->cache_rec_size, 1, b->cache) != 1) {
+        fprintf(stderr, "write to color cache failed: %s\n", strerror(errno));
+        return -1;
+      }
+    }
+  }
+  if (b->out && ferror(b->out)) {
+    fprintf(stderr, "write of colors failed: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+
+static void *read_chunk(void *arg) {
+  batch_chunk_t *c = (batch_chunk_t *) arg;
+  batch_t *b = c->batch;
+  int rc = 0;
+
+  c->nframes = 0;
+  while (c->nframes < b->chunk_frames && !(rc = read_frame(&b->in, c->src + c->nframes * b->in.frame_size)))
+    ++c->nframes;
+  c->eof = rc;
+  return NULL;
+}
+
+
+static int alloc_chunk(batch_t *b, batch_chunk_t *c) {
+  const size_t frames = b->chunk_frames;
+
+  c->batch = b;
+  c->src = (uint8_t *) malloc(frames * b->in.frame_size);
+  c->hsv = (hsv_color_t *) malloc(frames * b->width * b->height * sizeof(hsv_color_t));
+  c->w_hue_hist = (uint64_t *) malloc(frames * b->nchannels * (h_MAX+1) * sizeof(uint64_t));
+  c->most_used_hue = (int *) malloc(frames * b->nchannels * sizeof(int));
+  c->colors = (rgb_color_t *) malloc(frames * b->nchannels * sizeof(rgb_color_t));
+  return (c->src && c->hsv && c->w_hue_hist && c->most_used_hue && c->colors) ? 0: -1;
+}
+
+
+  /* Memory of one frame in a chunk */
+static size_t chunk_frame_size(batch_t *b) {
+  return b->in.frame_size + (size_t) b->width * b->height * sizeof(hsv_color_t) +
+         (size_t) b->nchannels * ((h_MAX+1) * sizeof(uint64_t) + sizeof(int) + sizeof(rgb_color_t));
+}
+
+
+static void free_chunk(batch_chunk_t *c) {
+  free(c->src);
+  free(c->hsv);
+  free(c->w_hue_hist);
+  free(c->most_used_hue);
+  free(c->colors);
+}
+
+
+static int open_cache(batch_t *b, const char *path) {
+  atmo_cache_header_t hdr;
+  const int layout[NUM_AREAS] = { b->parm.top, b->parm.bottom, b->parm.left, b->parm.right, b->parm.center,
+                                  b->parm.top_left, b->parm.top_right, b->parm.bottom_left, b->parm.bottom_right };
+
+  b->cache = fopen(path, "wb");
+  if (!b->cache) {
+    fprintf(stderr, "can't open '%s': %s\n", path, strerror(errno));
+    return -1;
+  }
+  b->cache_rec_size = ATMO_CACHE_REC_SIZE(b->nchannels);
+  b->cache_rec = (atmo_cache_rec_t *) calloc(1, b->cache_rec_size);
+  if (!b->cache_rec)
+    return -1;
+  atmo_cache_init_header(&hdr, &b->parm, layout);
+  if (fwrite(&hdr, sizeof(hdr), 1, b->cache) != 1) {
+    fprintf(stderr, "write to '%s' failed: %s\n", path, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+
+static void usage(void) {
+  fprintf(stderr, "usage: atmo_batch [-p parameters] [-j threads] [-n frames] [-r rate] [-o file] [-c file] input\n"
+                  "  -p  plugin parameters name=value,... of layout, analysis and filters\n"
+                  "      (default top=1,bottom=1,left=1,right=1 and the defaults of the plugin)\n"
+                  "  -j  number of analysis threads (default number of cpus)\n"
+                  "  -n  frames per chunk (default %d per thread, at most %d MB per chunk)\n"
+                  "  -r  frame rate of raw input (default 25)\n"
+                  "  -o  write filtered colors into file, '-' is stdout (default if no color cache file is given)\n"
+                  "  -c  write analyzed colors into color cache file\n"
+                  "  input is a Y4M stream or a raw RGB24 stream given as WIDTHxHEIGHT:file, file '-' is stdin\n",
+                  BATCH_CHUNK_FRAMES, BATCH_CHUNK_BYTES >> 20);
+  exit(1);
+}
+
+
+int main(int argc, char **argv) {
+  batch_t b;
+  batch_chunk_t chunk[2], *cur, *next;
+  pthread_t reader;
+  const char *out_path = NULL, *cache_path = NULL;
+  int rate = 25;
+  int opt, i, err, rc = 0;
+  int64_t frames = 0, t0;
+
+  memset(&b, 0, sizeof(b));
+  memset(chunk, 0, sizeof(chunk));
+
+    /* default parameters of plugin */
+  b.parm.top = b.parm.bottom = b.parm.left = b.parm.right = 1;
+  b.parm.overscan = 30;
+  b.parm.analyze_size = 1;
+  b.parm.brightness = 100;
+  b.parm.darkness_limit = 1;
+  b.parm.edge_weighting = 60;
+  b.parm.filter = 2;
+  b.parm.filter_length = 500;
+  b.parm.filter_smoothness = 50;
+  b.parm.filter_threshold = 40;
+  b.parm.hue_win_size = 3;
+  b.parm.sat_win_size = 3;
+  b.parm.hue_threshold = 93;
+
+  b.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((opt = getopt(argc, argv, "p:j:n:r:o:c:")) != -1) {
+    switch (opt) {
+    case 'p':
+      if (parse_params(&b.parm, optarg))
+        return 1;
+      break;
+    case 'j':
+      b.nthreads = atoi(optarg);
+      if (b.nthreads < 1)
+        usage();
+      break;
+    case 'n':
+      b.chunk_frames = atoi(optarg);
+      if (b.chunk_frames < 1)
+        usage();
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      if (rate < 1)
+        usage();
+      break;
+    case 'o':
+      out_path = optarg;
+      break;
+    case 'c':
+      cache_path = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc - 1)
+    usage();
+  if (b.nthreads < 1)
+    b.nthreads = 1;
+
+  if (open_input(&b.in, argv[optind], rate))
+    return 1;
+
+  b.seq = config_channels(&b.parm);
+  if (!b.seq)
+    goto nomem;
+  b.nchannels = b.seq->sum_channels;
+  if (!b.nchannels) {
+    fprintf(stderr, "no channels configured\n");
+    return 1;
+  }
+  reset_filters(b.seq);
+
+  if (init_boxes(&b))
+    goto nomem;
+
+    /* default chunk size is bounded by memory, large source frames would need several GB on many cpus */
+  if (!b.chunk_frames) {
+    const size_t max_frames = BATCH_CHUNK_BYTES / chunk_frame_size(&b);
+    b.chunk_frames = BATCH_CHUNK_FRAMES * b.nthreads;
+    if ((size_t) b.chunk_frames > max_frames)
+      b.chunk_frames = max_frames ? max_frames: 1;
+  }
+  if (alloc_chunk(&b, &chunk[0]) || alloc_chunk(&b, &chunk[1]))
+    goto nomem;
+  b.workers = (batch_worker_t *) calloc(b.nthreads, sizeof(batch_worker_t));
+  if (!b.workers)
+    goto nomem;
+  for (i = 0; i < b.nthreads; ++i) {
+    batch_worker_t *w = &b.workers[i];
+    w->batch = &b;
+    w->ch = config_channels(&b.parm);
+    w->rgb = (uint8_t *) malloc(b.width * b.height * 3);
+    if (!w->ch || !w->rgb || update_weight(w->ch, b.width, b.height, b.parm.edge_weighting))
+      goto nomem;
+  }
+
+    /* colors are written to stdout if no other output is given */
+  if (out_path && strcmp(out_path, "-")) {
+    b.out = fopen(out_path, "w");
+    if (!b.out) {
+      fprintf(stderr, "can't open '%s': %s\n", out_path, strerror(errno));
+      return 1;
+    }
+  } else if (out_path || !cache_path)
+    b.out = stdout;
+  if (cache_path && open_cache(&b, cache_path))
+    return 1;
+
+  if (b.out) {
+    fprintf(b.out, "# %s %dx%d %d/%d fps, analyze size %dx%d, %d channels (top %d, bottom %d, left %d, right %d, center %d, "
+                   "top_left %d, top_right %d, bottom_left %d, bottom_right %d)\n",
+                   b.in.name, b.in.width, b.in.height, b.in.rate_num, b.in.rate_den, b.width, b.height, b.nchannels,
+                   b.parm.top, b.parm.bottom, b.parm.left, b.parm.right, b.parm.center,
+                   b.parm.top_left, b.parm.top_right, b.parm.bottom_left, b.parm.bottom_right);
+    fprintf(b.out, "# frame position[ms] RRGGBB...\n");
+  }
+
+  t0 = monotonic_ns();
+
+    /* the next chunk is read while the current one is analyzed */
+  cur = &chunk[0];
+  next = &chunk[1];
+  read_chunk(cur);
+  while (cur->nframes) {
+    next->first = cur->first + cur->nframes;
+    next->nframes = 0;
+    next->eof = cur->eof;
+    err = cur->eof ? 0: pthread_create(&reader, NULL, read_chunk, next);
+    if (err) {
+      fprintf(stderr, "can't create reader thread: %s\n", strerror(err));
+      rc = 1;
+      break;
+    }
+
+    if (run_stage(&b, cur, STAGE_HUE) == 0) {
+      calc_chunk_hue(&b, cur);
+      if (run_stage(&b, cur, STAGE_SAT) == 0 && output_chunk(&b, cur) == 0)
+        frames += cur->nframes;
+      else
+        rc = 1;
+    } else
+      rc = 1;
+
+    if (!cur->eof)
+      pthread_join(reader, NULL);
+    if (rc)
+      break;
+    cur = next;
+    next = (cur == &chunk[0]) ? &chunk[1]: &chunk[0];
+  }
+  if (cur->eof < 0)
+    rc = 1;
+
+  t0 = monotonic_ns() - t0;
+  fprintf(stderr, "%lld frames analyzed in %.2f s (%.1f fps, %d threads)\n", (long long) frames, (double) t0 / 1e9,
+          t0 ? (double) frames * 1e9 / t0: 0.0, b.nthreads);
+
+  if (b.out && b.out != stdout && fclose(b.out)) {
+    fprintf(stderr, "write of colors failed: %s\n", strerror(errno));
+    rc = 1;
+  }
+  if (b.cache && fclose(b.cache)) {
+    fprintf(stderr, "write to color cache failed: %s\n", strerror(errno));
+    rc = 1;
+  }
+  if (b.out == stdout && fflush(stdout))
+    rc = 1;
+
+  for (i = 0; i < b.nthreads; ++i) {
+    free_channels(b.workers[i].ch);
+    free(b.workers[i].rgb);
+  }
+  free(b.workers);
+  free_chunk(&chunk[0]);
+  free_chunk(&chunk[1]);
+  free(b.box_x);
+  free(b.box_y);
+  free(b.cache_rec);
+  free_channels(b.seq);
+  if (b.in.fp != stdin)
+    fclose(b.in.fp);
+  return rc;
+
+nomem:
+  fprintf(stderr, "out of memory\n");
+  return 1;
+}
@@ -0,0 +1,450 @@
+/*
+ * Copyright (C) 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ *
+ * Benchmark of the image analysis stages of the plugin without xine.
+ * Runs on synthetic frames, capture files or raw RGB24 frames and reports the
+ * time per frame and per pixel of each stage.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#define LOG_1           0
+#define LOG_2           0
+#define llprintf(cat, fmt, args...)  do { if (cat) fprintf(stderr, "atmo: " fmt, ##args); } while (0)
+
+#include "atmo_types.h"
+#include "atmo_analyze.h"
+#include "atmo_capture.h"
+
+
+#define BENCH_FRAMES            16      /* number of different synthetic frames of a pattern */
+#define BENCH_MAX_FILE_FRAMES   1000    /* max. number of frames loaded from a recorded file */
+
+
+enum { ST_WEIGHT, ST_HSV, ST_HUE_HIST, ST_HUE_WIN, ST_HUE_PEAK, ST_SAT_HIST, ST_SAT_WIN, ST_SAT_PEAK, ST_BRIGHT, ST_RGB, ST_FILTER, NUM_STAGES };
+static const char *stage_names[NUM_STAGES] = {
+  "weight", "hsv", "hue_hist", "hue_window", "hue_peak", "sat_hist", "sat_window", "sat_peak", "brightness", "rgb", "filter" };
+
+
+typedef struct {
+  const char *name;
+  int layout[NUM_AREAS];        /* top, bottom, left, right, center, top_left, top_right, bottom_left, bottom_right */
+} bench_layout_t;
+
+static const bench_layout_t bench_layouts[] = {
+  { "classic",  { 1, 1, 1, 1, 1, 0, 0, 0, 0 } },
+  { "df10ch",   { 3, 0, 2, 2, 0, 0, 0, 1, 1 } },
+  { "ledstrip", { 25, 25, 15, 15, 0, 1, 1, 1, 1 } },
+  { NULL }
+};
+
+
+typedef struct {
+  const char *name;
+  int width, height;
+  int nframes;
+  uint8_t *frames;              /* nframes RGB24 images */
+} bench_source_t;
+
+enum { PAT_GRADIENT, PAT_NOISE, PAT_LETTERBOX, PAT_BLACK, NUM_PATTERNS };
+static const char *pattern_names[NUM_PATTERNS] = { "gradient", "noise", "letterbox", "black" };
+
+
+static int64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static uint32_t bench_rand(uint32_t *seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return (*seed >> 16) & 0x7fff;
+}
+
+
+static void gen_pattern(int pattern, int width, int height, int frame, uint32_t *seed, uint8_t *rgb) {
+  int row, col;
+  const int bar = height / 8;
+
+  for (row = 0; row < height; ++row) {
+    for (col = 0; col < width; ++col) {
+      switch (pattern) {
+      case PAT_GRADIENT:
+          /* diagonal color gradient moving with frame number */
+        rgb[0] = (uint8_t) ((col * 255) / width + frame * 4);
+        rgb[1] = (uint8_t) ((row * 255) / height + frame * 2);
+        rgb[2] = (uint8_t) (((width - col) * 255) / width);
+        break;
+      case PAT_NOISE:
+        rgb[0] = (uint8_t) bench_rand(seed);
+        rgb[1] = (uint8_t) bench_rand(seed);
+        rgb[2] = (uint8_t) bench_rand(seed);
+        break;
+      case PAT_LETTERBOX:
+          /* black bars at top and bottom, noisy colored picture between */
+        if (row < bar || row >= (height - bar)) {
+          rgb[0] = rgb[1] = rgb[2] = 0;
+        } else {
+          rgb[0] = (uint8_t) ((col * 255) / width);
+          rgb[1] = (uint8_t) (bench_rand(seed) & 0x3f) + 64;
+          rgb[2] = (uint8_t) (frame * 16);
+        }
+        break;
+      default:
+        rgb[0] = rgb[1] = rgb[2] = 0;
+        break;
+      }
+      rgb += 3;
+    }
+  }
+}
+
+
+static int make_pattern_source(bench_source_t *src, int pattern, int analyze_size) {
+  uint32_t seed = 4711;
+  int f;
+
+  src->name = pattern_names[pattern];
+  src->width = (analyze_size + 1) * 64;
+  src->height = (src->width * 9) / 16;
+  src->nframes = BENCH_FRAMES;
+  src->frames = (uint8_t *) malloc(src->nframes * src->width * src->height * 3);
+  if (!src->frames)
+    return -1;
+  for (f = 0; f < src->nframes; ++f)
+    gen_pattern(pattern, src->width, src->height, f, &seed, src->frames + f * src->width * src->height * 3);
+  return 0;
+}
+
+
+static void load_capture_source(bench_source_t *src, const char *path, FILE *fp) {
+  atmo_cap_frame_t f;
+  int skipped = 0;
+
+    /* all frames must have the size of the first frame */
+  src->name = path;
+  src->nframes = 0;
+  src->frames = NULL;
+  while (src->nframes < BENCH_MAX_FILE_FRAMES && fread(&f, sizeof(f), 1, fp) == 1 && f.size >= sizeof(f)) {
+    const size_t frame_size = f.width * f.height * 3;
+    if (!src->nframes) {
+      src->width = f.width;
+      src->height = f.height;
+    }
+    if (f.width == src->width && f.height == src->height && frame_size) {
+      uint8_t *frames = (uint8_t *) realloc(src->frames, (src->nframes + 1) * frame_size);
+      if (!frames)
+        break;
+      src->frames = frames;
+      if (fread(src->frames + src->nframes * frame_size, frame_size, 1, fp) != 1)
+        break;
+      ++src->nframes;
+      if (fseek(fp, f.size - sizeof(f) - frame_size, SEEK_CUR))
+        break;
+    } else {
+      ++skipped;
+      if (fseek(fp, f.size - sizeof(f), SEEK_CUR))
+        break;
+    }
+  }
+  if (skipped)
+    fprintf(stderr, "%s: skipped %d frames with size other than %dx%d\n", path, skipped, src->width, src->height);
+}
+
+
+static int load_file_source(bench_source_t *src, const char *arg) {
+  const char *path = strchr(arg, ':');
+  atmo_cap_header_t hdr;
+  FILE *fp;
+  size_t frame_size;
+
+    /* argument is a capture file of the plugin or WIDTHxHEIGHT:path of a raw RGB24 file */
+  if (!path || sscanf(arg, "%dx%d", &src->width, &src->height) != 2) {
+    fp = fopen(arg, "rb");
+    if (!fp) {
+      fprintf(stderr, "can't open '%s': %s\n", arg, strerror(errno));
+      return -1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, ATMO_CAP_MAGIC, sizeof(ATMO_CAP_MAGIC)) || hdr.version != ATMO_CAP_VERSION) {
+      fprintf(stderr, "'%s' is not a capture file, expected capture file or WIDTHxHEIGHT:file\n", arg);
+      fclose(fp);
+      return -1;
+    }
+    load_capture_source(src, arg, fp);
+    fclose(fp);
+    if (!src->nframes) {
+      fprintf(stderr, "no frame in '%s'\n", arg);
+      free(src->frames);
+      return -1;
+    }
+    return 0;
+  }
+  if (src->width <= 0 || src->height <= 0) {
+    fprintf(stderr, "invalid recording argument '%s', expected WIDTHxHEIGHT:file\n", arg);
+    return -1;
+  }
+  ++path;
+
+  fp = fopen(path, "rb");
+  if (!fp) {
+    fprintf(stderr, "can't open '%s': %s\n", path, strerror(errno));
+    return -1;
+  }
+  frame_size = src->width * src->height * 3;
+  src->name = path;
+  src->nframes = 0;
+  src->frames = NULL;
+  while (src->nframes < BENCH_MAX_FILE_FRAMES) {
+    uint8_t *frames = (uint8_t *) realloc(src->frames, (src->nframes + 1) * frame_size);
+    if (!frames)
+      break;
+    src->frames = frames;
+    if (fread(src->frames + src->nframes * frame_size, frame_size, 1, fp) != 1)
+      break;
+    ++src->nframes;
+  }
+  fclose(fp);
+  if (!src->nframes) {
+    fprintf(stderr, "no complete %dx%d frame in '%s'\n", src->width, src->height, path);
+    free(src->frames);
+    return -1;
+  }
+  return 0;
+}
+
+
+static int run_bench(bench_source_t *src, const bench_layout_t *layout, atmo_parameters_t *parm, int iterations) {
+  atmo_channels_t *ch;
+  hsv_color_t *hsv_img;
+  int64_t t[NUM_STAGES], t0, t1;
+  const int img_size = src->width * src->height;
+  int i, s;
+
+  parm->top = layout->layout[0];
+  parm->bottom = layout->layout[1];
+  parm->left = layout->layout[2];
+  parm->right = layout->layout[3];
+  parm->center = layout->layout[4];
+  parm->top_left = layout->layout[5];
+  parm->top_right = layout->layout[6];
+  parm->bottom_left = layout->layout[7];
+  parm->bottom_right = layout->layout[8];
+
+  ch = config_channels(parm);
+  hsv_img = (hsv_color_t *) malloc(img_size * sizeof(hsv_color_t));
+  if (!ch || !hsv_img) {
+    fprintf(stderr, "out of memory\n");
+    return -1;
+  }
+  memset(t, 0, sizeof(t));
+
+  t0 = monotonic_ns();
+  if (update_weight(ch, src->width, src->height, parm->edge_weighting)) {
+    fprintf(stderr, "out of memory\n");
+    return -1;
+  }
+  t[ST_WEIGHT] = monotonic_ns() - t0;
+  reset_filters(ch);
+
+  for (i = 0; i < iterations; ++i) {
+    uint8_t *img = src->frames + (i % src->nframes) * img_size * 3;
+
+    t0 = monotonic_ns();
+    calc_hsv_image(hsv_img, img, img_size);
+    t1 = monotonic_ns(); t[ST_HSV] += t1 - t0; t0 = t1;
+    calc_hue_hist(ch, parm, hsv_img, img_size);
+    t1 = monotonic_ns(); t[ST_HUE_HIST] += t1 - t0; t0 = t1;
+    calc_windowed_hue_hist(ch, parm);
+    t1 = monotonic_ns(); t[ST_HUE_WIN] += t1 - t0; t0 = t1;
+    calc_most_used_hue(ch, parm);
+    t1 = monotonic_ns(); t[ST_HUE_PEAK] += t1 - t0; t0 = t1;
+    calc_sat_hist(ch, parm, hsv_img, img_size);
+    t1 = monotonic_ns(); t[ST_SAT_HIST] += t1 - t0; t0 = t1;
+    calc_windowed_sat_hist(ch, parm);
+    t1 = monotonic_ns(); t[ST_SAT_WIN] += t1 - t0; t0 = t1;
+    calc_most_used_sat(ch);
+    t1 = monotonic_ns(); t[ST_SAT_PEAK] += t1 - t0; t0 = t1;
+    if (parm->uniform_brightness)
+      calc_uniform_average_brightness(ch, parm, hsv_img, img_size);
+    else
+      calc_average_brightness(ch, parm, hsv_img, img_size);
+    t1 = monotonic_ns(); t[ST_BRIGHT] += t1 - t0; t0 = t1;
+    calc_rgb_values(ch);
+    t1 = monotonic_ns(); t[ST_RGB] += t1 - t0; t0 = t1;
+    switch (parm->filter) {
+    case 1:
+      percent_filter(ch, parm);
+      break;
+    case 2:
+      mean_filter(ch, parm);
+      break;
+    default:
+      no_filter(ch);
+    }
+    t1 = monotonic_ns(); t[ST_FILTER] += t1 - t0;
+  }
+
+  printf("\n%s %dx%d, layout %s (%d channels), %d frames\n", src->name, src->width, src->height, layout->name, ch->sum_channels, iterations);
+  printf("  %-12s %12s %10s\n", "stage", "ns/frame", "ns/pixel");
+  int64_t total = 0;
+  for (s = 0; s < NUM_STAGES; ++s) {
+      /* weight map is calculated only once per layout and analyze size */
+    double per_frame = (s == ST_WEIGHT) ? (double) t[s] : (double) t[s] / iterations;
+    printf("  %-12s %12.0f %10.2f%s\n", stage_names[s], per_frame, per_frame / img_size, (s == ST_WEIGHT) ? "  (once)": "");
+    if (s != ST_WEIGHT)
+      total += t[s];
+  }
+  printf("  %-12s %12.0f %10.2f\n", "total", (double) total / iterations, (double) total / iterations / img_size);
+
+  free(hsv_img);
+  free_channels(ch);
+  return 0;
+}
+
+
+static void usage(void) {
+  fprintf(stderr, "usage: atmo_bench [-n frames] [-s analyze_size] [-l layout] [-p pattern] [-u] [recording ...]\n"
+                  "  -n  number of analyzed frames per run (default 200)\n"
+                  "  -s  analyze size 0..3 (default all)\n"
+                  "  -l  layout classic, df10ch, ledstrip or t,b,l,r,c,tl,tr,bl,br (default all)\n"
+                  "  -p  synthetic pattern gradient, noise, letterbox or black (default all)\n"
+                  "  -u  calculate uniform brightness\n"
+                  "  recordings are capture files of the plugin or raw RGB24 files given as WIDTHxHEIGHT:file,\n"
+                  "  synthetic patterns are skipped if given\n");
+  exit(1);
+}
+
+
+int main(int argc, char **argv) {
+  atmo_parameters_t parm;
+  bench_layout_t custom_layout;
+  const bench_layout_t *layout_sel = NULL;
+  int iterations = 200, size_sel = -1, pattern_sel = -1;
+  int opt, i, size, pattern, rc = 0;
+
+    /* default analyze parameters of plugin */
+  memset(&parm, 0, sizeof(parm));
+  parm.darkness_limit = 1;
+  parm.edge_weighting = 60;
+  parm.hue_win_size = 3;
+  parm.sat_win_size = 3;
+  parm.hue_threshold = 93;
+  parm.brightness = 100;
+  parm.filter = 2;
+  parm.filter_length = 500;
+  parm.filter_smoothness = 50;
+  parm.filter_threshold = 40;
+
+  while ((opt = getopt(argc, argv, "n:s:l:p:u")) != -1) {
+    switch (opt) {
+    case 'n':
+      iterations = atoi(optarg);
+      if (iterations < 1)
+        usage();
+      break;
+    case 's':
+      size_sel = atoi(optarg);
+      if (size_sel < 0 || size_sel > 3)
+        usage();
+      break;
+    case 'l':
+      for (i = 0; bench_layouts[i].name; ++i) {
+        if (!strcmp(optarg, bench_layouts[i].name))
+          layout_sel = &bench_layouts[i];
+      }
+      if (!layout_sel) {
+        int *l = custom_layout.layout;
+        int n = 0;
+        if (sscanf(optarg, "%d,%d,%d,%d,%d,%d,%d,%d,%d", &l[0], &l[1], &l[2], &l[3], &l[4], &l[5], &l[6], &l[7], &l[8]) != NUM_AREAS)
+          usage();
+        for (i = 0; i < NUM_AREAS; ++i) {
+          if (l[i] < 0 || l[i] > ((i < 4) ? 25: 1))
+            usage();
+          n += l[i];
+        }
+        if (!n)
+          usage();
+        custom_layout.name = optarg;
+        layout_sel = &custom_layout;
+      }
+      break;
+    case 'p':
+      for (i = 0; i < NUM_PATTERNS; ++i) {
+        if (!strcmp(optarg, pattern_names[i]))
+          pattern_sel = i;
+      }
+      if (pattern_sel < 0)
+        usage();
+      break;
+    case 'u':
+      parm.uniform_brightness = 1;
+      break;
+    default:
+      usage();
+    }
+  }
+
+  const bench_layout_t *layouts = layout_sel ? layout_sel: bench_layouts;
+  const int nlayouts = layout_sel ? 1: (int) (sizeof(bench_layouts) / sizeof(bench_layouts[0])) - 1;
+
+  if (optind < argc) {
+    for (i = optind; i < argc && !rc; ++i) {
+      bench_source_t src;
+      int l;
+      if (load_file_source(&src, argv[i]))
+        return 1;
+      for (l = 0; l < nlayouts && !rc; ++l)
+        rc = run_bench(&src, &layouts[l], &parm, iterations);
+      free(src.frames);
+    }
+    return rc ? 1: 0;
+  }
+
+  for (pattern = 0; pattern < NUM_PATTERNS && !rc; ++pattern) {
+    if (pattern_sel >= 0 && pattern != pattern_sel)
+      continue;
+    for (size = 0; size <= 3 && !rc; ++size) {
+      bench_source_t src;
+      int l;
+      if (size_sel >= 0 && size != size_sel)
+        continue;
+      if (make_pattern_source(&src, pattern, size)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+      }
+      for (l = 0; l < nlayouts && !rc; ++l)
+        rc = run_bench(&src, &layouts[l], &parm, iterations);
+      free(src.frames);
+    }
+  }
+  return rc ? 1: 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ */
+
+/* ---
+ * Color cache file format written by the plugin parameter 'color_cache'.
+ *
+ * The cache is a sidecar file next to the played media file (media path + ATMO_CACHE_SUFFIX).
+ * It starts with a header followed by an append only sequence of color records. Each record holds the
+ * analyzed (unfiltered) colors of one analyzed frame keyed by its playback position. Records are not
+ * sorted when seeks happened. The header identifies the channel layout and analysis parameters,
+ * a cache with different ones is kept but not used. Only a cache with invalid magic or an old version
+ * is overwritten. Integers are in host byte order.
+ */
+
+#define ATMO_CACHE_MAGIC        "ATMOCOL"
+#define ATMO_CACHE_VERSION      1
+#define ATMO_CACHE_SUFFIX       ".atmo"
+
+typedef struct {
+  char magic[8];                // ATMO_CACHE_MAGIC
+  uint32_t version;
+  uint32_t param_hash;          // hash of analysis parameters
+  uint16_t layout[9];           // top, bottom, left, right, center, top left, top right, bottom left, bottom right
+  uint16_t nchannels;           // number of colors per record
+  uint32_t reserved;
+} atmo_cache_header_t;
+
+typedef struct {
+  int64_t pos;                  // playback position of analyzed frame [ms]
+  uint8_t colors[];             // nchannels RGB colors in output driver channel order
+} atmo_cache_rec_t;
+
+#define ATMO_CACHE_REC_SIZE(n)  ((sizeof(atmo_cache_rec_t) + (n) * 3 + 7) & ~7)
+
+
+/* header of a cache for a channel layout (area counts top ... bottom_right) and analysis parameters */
+static void atmo_cache_init_header(atmo_cache_header_t *hdr, const atmo_parameters_t *parm, const int *layout) {
+  const int analyze_parm[] = { parm->analyze_size, parm->overscan, parm->darkness_limit, parm->edge_weighting,
+                               parm->hue_win_size, parm->sat_win_size, parm->hue_threshold,
+                               parm->uniform_brightness, parm->brightness };
+  const uint8_t *p = (const uint8_t *) analyze_parm;
+  uint32_t hash = 2166136261U;
+  size_t i;
+
+    /* FNV-1a hash of parameters affecting the analyzed colors */
+  for (i = 0; i < sizeof(analyze_parm); ++i)
+    hash = (hash ^ p[i]) * 16777619U;
+
+  memset(hdr, 0, sizeof(*hdr));
+  memcpy(hdr->magic, ATMO_CACHE_MAGIC, sizeof(ATMO_CACHE_MAGIC));
+  hdr->version = ATMO_CACHE_VERSION;
+  hdr->param_hash = hash;
+  for (i = 0; i < 9; ++i) {
+    hdr->layout[i] = layout[i];
+    hdr->nchannels += layout[i];
+  }
+}
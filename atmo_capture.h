@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ */
+
+/* ---
+ * Capture file format of the analyze images written by the plugin parameter 'capture_file'.
+ *
+ * The file starts with a header followed by an append only sequence of frame records.
+ * Each frame record holds the RGB24 analyze image as it was grabbed for analysis
+ * together with the grab geometry. Records are padded to a multiple of 8 bytes,
+ * integers are in host byte order.
+ */
+
+#define ATMO_CAP_MAGIC          "ATMOCAP"
+#define ATMO_CAP_VERSION        1
+
+typedef struct {
+  char magic[8];                // ATMO_CAP_MAGIC
+  uint32_t version;
+  uint32_t reserved;
+} atmo_cap_header_t;
+
+typedef struct {
+  uint32_t size;                // size of record including this header and padding
+  uint16_t width, height;       // size of analyze image
+  uint16_t grab_width, grab_height;     // size of grabbed video window without crop border
+  uint16_t crop_left, crop_right, crop_top, crop_bottom;
+  uint32_t reserved;
+  int64_t vpts;                 // xine vpts of grabbed video frame
+  int64_t timestamp;            // CLOCK_MONOTONIC time of grab [us]
+  uint8_t img[];                // width * height RGB24 pixels
+} atmo_cap_frame_t;
+
+#define ATMO_CAP_FRAME_SIZE(w, h)       ((sizeof(atmo_cap_frame_t) + (w) * (h) * 3 + 7) & ~7)
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2009, 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ */
+
+/* ---
+ * Output driver interface shared by plugin, tools and output driver modules.
+ */
+
+#include "atmo_hist.h"
+
+
+/*
+ * transfer statistics of output drivers that transmit in the background
+ */
+typedef struct {
+  unsigned int transfers;       /* completed transfers */
+  unsigned int errors;          /* failed transfers */
+  unsigned int replaced;        /* data replaced by newer data before it was transmitted */
+  int queued;                   /* data waiting for transmission */
+} output_driver_stats_t;
+
+
+/*
+ * abstraction for output drivers
+ */
+typedef struct output_driver_s output_driver_t;
+struct output_driver_s {
+    /* open device and configure for number of channels */
+  int (*open)(output_driver_t *this, atmo_parameters_t *param);
+
+    /* configure device for number of channels */
+  int (*configure)(output_driver_t *this, atmo_parameters_t *param);
+
+    /* close device */
+  int (*close)(output_driver_t *this);
+
+    /*
+     * send RGB color values to device
+     * last_colors is NULL when first initial color packet is send
+     * order for 'colors' is: top 1,2,3..., bottom 1,2,3..., left 1,2,3..., right 1,2,3..., center, top left, top right, bottom left, bottom right
+     */
+  void (*output_colors)(output_driver_t *this, rgb_color_t *new_colors, rgb_color_t *last_colors);
+
+    /*
+     * send RGB color values with 16 bit precision, optional
+     * called every cycle of the high rate output mode, also with unchanged colors, so that the driver could
+     * dither them into its native resolution
+     */
+  void (*output_colors16)(output_driver_t *this, rgb16_color_t *colors);
+
+    /* get transfer statistics, optional */
+  void (*get_stats)(output_driver_t *this, output_driver_stats_t *stats);
+
+    /* copy write_hist and trace under driver lock, required if they are maintained in the background */
+  void (*get_hist)(output_driver_t *this, atmo_hist_t *write_hist, atmo_trace_t *trace);
+
+    /* vpts of last analyzed video frame, set before output_colors is called */
+  int64_t vpts;
+
+    /* time for transmitting data to the device, maintained by drivers that transmit in the background */
+  atmo_hist_t write_hist;
+
+    /* latency trace tag of colors, set before output_colors is called */
+  atmo_trace_tag_t trace_tag;
+
+    /*
+     * latency trace since open
+     * drivers that transmit in the background set trace_async and complete the tag when the data reached the device,
+     * otherwise the tag is completed when output_colors returns
+     */
+  atmo_trace_t trace;
+  int trace_async;
+
+    /* provide detailed error message here if open of device fails */
+  char errmsg[128];
+};
+
+
+/*
+ * copy transmit times and latency trace of driver
+ */
+static inline void get_output_driver_hist(output_driver_t *driver, atmo_hist_t *write_hist, atmo_trace_t *trace) {
+  if (driver->get_hist)
+    driver->get_hist(driver, write_hist, trace);
+  else {
+    *write_hist = driver->write_hist;
+    *trace = driver->trace;
+  }
+}
+
+
+/*
+ * lookup option 'name' or 'name=value' within ';' separated driver parameter
+ * returns 1 if option is present
+ */
+static int get_driver_option(const char *driver_param, const char *name, char *value, size_t size) {
+  const size_t nlen = strlen(name);
+  const char *p = driver_param;
+  while (p && *p) {
+    const char *e = strchr(p, ';');
+    size_t len = e ? (size_t)(e - p): strlen(p);
+    if (len >= nlen && !strncmp(p, name, nlen) && (len == nlen || p[nlen] == '=')) {
+      if (value && size) {
+        size_t vlen = (len > nlen) ? len - nlen - 1: 0;
+        if (vlen >= size)
+          vlen = size - 1;
+        if (vlen)
+          memcpy(value, p + nlen + 1, vlen);
+        value[vlen] = 0;
+      }
+      return 1;
+    }
+    p = e ? e + 1: NULL;
+  }
+  return 0;
+}
+
+
+static int get_driver_int_option(const char *driver_param, const char *name, int def) {
+  char value[32];
+  if (get_driver_option(driver_param, name, value, sizeof(value)) && value[0])
+    return atoi(value);
+  return def;
+}
+
+
+/*
+ * Output drivers that depend on additional libraries are built as modules. A module is loaded when one of its
+ * drivers is selected so that these libraries are no load time dependency of the plugin and the tools.
+ * The module exports OUTPUT_DRIVER_MODULE_SYMBOL. Its init function initializes a zeroed driver instance
+ * of up to OUTPUT_DRIVER_MODULE_MAX_SIZE bytes in storage provided by the caller.
+ */
+#define OUTPUT_DRIVER_MODULE_VERSION    1
+#define OUTPUT_DRIVER_MODULE_SYMBOL     "atmo_output_driver_module"
+#define OUTPUT_DRIVER_MODULE_MAX_SIZE   16384
+
+typedef struct {
+  int version;                  /* OUTPUT_DRIVER_MODULE_VERSION */
+  int api_size;                 /* sizeof(output_driver_t) */
+  int size;                     /* size of driver instance */
+  void (*init)(output_driver_t *this, const char *name);
+} output_driver_module_t;
@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ *
+ * Throughput and latency benchmark of the output drivers.
+ * Serial drivers are opened on a pseudo terminal. The other end of the pseudo
+ * terminal decodes the received messages. The file driver writes a binary
+ * recording to tmpfs that is followed with inotify and decoded as it is written.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <math.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+
+#define LOG_1           0
+#define LOG_2           0
+#define llprintf(cat, fmt, args...)  do { if (cat) fprintf(stderr, "atmo: " fmt, ##args); } while (0)
+
+#include "atmo_types.h"
+#include "output_driver.h"
+
+
+#define BENCH_MAX_SEQ           65536   /* frame sequence number is send as 16 bit value */
+#define BENCH_DRAIN_TIME        200     /* time for receiving outstanding messages after a run [ms] */
+
+
+/*
+ * Driver under test. Serial protocols are described by their message framing
+ * so that the receiver can decode them: header, RGB payload and trailer byte.
+ */
+enum { BENCH_SERIAL, BENCH_FILE };
+
+typedef struct {
+  const char *name;
+  int type;
+  const char *options;          /* additional driver parameter options */
+  int layout[9];                /* top, bottom, left, right, center, top_left, top_right, bottom_left, bottom_right */
+  int header_len;
+  uint8_t header[6];            /* expected message header, ignored if header_len is 0 */
+  int payload_len;              /* number of payload bytes (RGB triples) */
+  int msg_len;
+} bench_driver_t;
+
+static bench_driver_t bench_drivers[] = {
+  { "classic",  BENCH_SERIAL, "",
+    { 1, 1, 1, 1, 1, 0, 0, 0, 0 }, 4, { 0xFF, 0, 0, 15 }, 15, 19 },
+  { "df4ch",    BENCH_SERIAL, "",
+    { 1, 1, 1, 1, 0, 0, 0, 0, 0 }, 3, { 0xFF, 0, 12 }, 12, 15 },
+  { "adalight", BENCH_SERIAL, ";leds_top=30;leds_bottom=30;leds_left=17;leds_right=17",
+    { 8, 8, 5, 5, 0, 0, 0, 0, 0 }, 6, { 'A', 'd', 'a', 0, 93, 0 ^ 93 ^ 0x55 }, 94 * 3, 6 + 94 * 3 },
+  { "tpm2",     BENCH_SERIAL, ";leds_top=30;leds_bottom=30;leds_left=17;leds_right=17",
+    { 8, 8, 5, 5, 0, 0, 0, 0, 0 }, 4, { 0xC9, 0xDA, (94 * 3) >> 8, (94 * 3) & 0xFF }, 94 * 3, 4 + 94 * 3 + 1 },
+  { "file",     BENCH_FILE, ";binary",
+    { 3, 3, 2, 2, 0, 1, 1, 1, 1 }, 0, { 0 }, 14 * 3, 0 },
+  { NULL }
+};
+
+
+typedef struct {
+  const bench_driver_t *drv;
+  int fd;                               /* master side of pseudo terminal or recording file */
+  int notify_fd;                        /* inotify watching recording file */
+  int running;
+  pthread_mutex_t lock;
+  int64_t send_ns[BENCH_MAX_SEQ];       /* send time of frame */
+  int64_t *delivery_us;                 /* delivery latency of each received frame */
+  int max_frames;
+  int received, garbled;
+} bench_receiver_t;
+
+
+static int64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+  /* All colors of a frame carry its sequence number and a check byte */
+static void bench_frame_colors(rgb_color_t *colors, int n, int seq) {
+  int c;
+
+  for (c = 0; c < n; ++c) {
+    colors[c].r = seq & 0xFF;
+    colors[c].g = seq >> 8;
+    colors[c].b = (seq & 0xFF) ^ (seq >> 8) ^ 0xA5;
+  }
+}
+
+
+  /* Returns sequence number of payload or -1 if payload is garbled */
+static int bench_decode_payload(const uint8_t *p, int len) {
+  int i;
+
+  if (len < 3 || p[2] != (p[0] ^ p[1] ^ 0xA5))
+    return -1;
+  for (i = 3; i < len; i += 3) {
+    if (p[i] != p[0] || p[i + 1] != p[1] || p[i + 2] != p[2])
+      return -1;
+  }
+  return p[0] | (p[1] << 8);
+}
+
+
+static void bench_received(bench_receiver_t *rcv, int seq, int64_t now) {
+  if (seq < 0) {
+    ++rcv->garbled;
+    return;
+  }
+  pthread_mutex_lock(&rcv->lock);
+  if (rcv->received < rcv->max_frames)
+    rcv->delivery_us[rcv->received++] = (now - rcv->send_ns[seq]) / 1000;
+  pthread_mutex_unlock(&rcv->lock);
+}
+
+
+static void *bench_receiver_loop(void *arg) {
+  bench_receiver_t *rcv = (bench_receiver_t *) arg;
+  const bench_driver_t *drv = rcv->drv;
+  uint8_t buf[2 * SERIAL_MAX_MSG_SIZE];
+  struct pollfd pfd;
+  int len = 0;
+
+  pfd.fd = rcv->fd;
+  pfd.events = POLLIN;
+  for (;;) {
+    pthread_mutex_lock(&rcv->lock);
+    int running = rcv->running;
+    pthread_mutex_unlock(&rcv->lock);
+    if (!running)
+      break;
+    if (poll(&pfd, 1, 50) <= 0)
+      continue;
+    int n = read(rcv->fd, buf + len, sizeof(buf) - len);
+    if (n <= 0) {
+        /* EIO when slave side is closed */
+      if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        continue;
+      usleep(10000);
+      continue;
+    }
+    len += n;
+    int64_t now = monotonic_ns();
+
+      /* decode complete messages, resync on header mismatch */
+    int pos = 0;
+    while (len - pos >= drv->msg_len) {
+      const uint8_t *m = buf + pos;
+      if (memcmp(m, drv->header, drv->header_len) || (drv->msg_len > drv->header_len + drv->payload_len && m[drv->msg_len - 1] != 0x36)) {
+        ++rcv->garbled;
+        ++pos;
+        while (pos < len && buf[pos] != drv->header[0])
+          ++pos;
+        continue;
+      }
+      bench_received(rcv, bench_decode_payload(m + drv->header_len, drv->payload_len), now);
+      pos += drv->msg_len;
+    }
+    memmove(buf, buf + pos, len - pos);
+    len -= pos;
+  }
+  return NULL;
+}
+
+
+  /* Decode binary recording of file driver while it is written, delivery is the time a write completed */
+static void *bench_file_receiver_loop(void *arg) {
+  bench_receiver_t *rcv = (bench_receiver_t *) arg;
+  uint64_t buf[65536 / sizeof(uint64_t)];
+  uint8_t *p = (uint8_t *) buf;
+  char events[4096];
+  struct pollfd pfd;
+  int len = 0, header_read = 0;
+
+  pfd.fd = rcv->notify_fd;
+  pfd.events = POLLIN;
+  for (;;) {
+    pthread_mutex_lock(&rcv->lock);
+    int running = rcv->running;
+    pthread_mutex_unlock(&rcv->lock);
+    if (running && poll(&pfd, 1, 50) <= 0)
+      continue;
+    while (read(rcv->notify_fd, events, sizeof(events)) > 0)
+      ;
+    int n = read(rcv->fd, p + len, sizeof(buf) - len);
+    if (n <= 0) {
+        /* rest of recording is read after the run */
+      if (!running && (n == 0 || errno != EINTR))
+        break;
+      continue;
+    }
+    len += n;
+    int64_t now = monotonic_ns();
+
+      /* records are padded to 8 bytes so they stay aligned in the buffer */
+    int pos = 0;
+    if (!header_read) {
+      if (len < (int) sizeof(atmo_rec_header_t))
+        continue;
+      if (strcmp(((const atmo_rec_header_t *) p)->magic, ATMO_REC_MAGIC))
+        break;
+      pos = sizeof(atmo_rec_header_t);
+      header_read = 1;
+    }
+    while (len - pos >= (int) sizeof(atmo_rec_record_t)) {
+      const atmo_rec_record_t *rec = (const atmo_rec_record_t *) (p + pos);
+      if (rec->size < sizeof(*rec)) {
+        ++rcv->garbled;
+        pos = len;
+        break;
+      }
+      if (rec->size > len - pos)
+        break;
+      if (rec->type == ATMO_REC_FRAME)
+        bench_received(rcv, bench_decode_payload(((const atmo_rec_frame_t *) rec)->colors, rcv->drv->payload_len), now);
+      pos += rec->size;
+    }
+    memmove(p, p + pos, len - pos);
+    len -= pos;
+  }
+  return NULL;
+}
+
+
+static int cmp_int64(const void *a, const void *b) {
+  const int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+  return (x > y) - (x < y);
+}
+
+
+static int64_t percentile(int64_t *v, int n, int p) {
+  if (!n)
+    return 0;
+  return v[((int64_t) (n - 1) * p) / 100];
+}
+
+
+static int run_bench(const bench_driver_t *drv, int rate, int duration, int baud, const char *tmpdir) {
+  output_drivers_t output_drivers;
+  output_driver_t *output_driver = NULL;
+  atmo_parameters_t param;
+  bench_receiver_t *rcv;
+  pthread_t rcv_thread;
+  rgb_color_t colors[4 * 25 + 5];
+  char filename[256];
+  int i, n = 0, sent = 0, rc = -1;
+
+  int frames = rate * duration;
+  if (frames >= BENCH_MAX_SEQ)
+    frames = BENCH_MAX_SEQ - 1;
+
+  rcv = (bench_receiver_t *) calloc(1, sizeof(bench_receiver_t));
+  int64_t *call_us = (int64_t *) calloc(frames, sizeof(int64_t));
+  if (!rcv || !call_us || !(rcv->delivery_us = (int64_t *) calloc(frames, sizeof(int64_t)))) {
+    fprintf(stderr, "out of memory\n");
+    goto out;
+  }
+  rcv->drv = drv;
+  rcv->fd = -1;
+  rcv->notify_fd = -1;
+  rcv->max_frames = frames;
+  pthread_mutex_init(&rcv->lock, NULL);
+
+  memset(&param, 0, sizeof(param));
+  param.top = drv->layout[0];
+  param.bottom = drv->layout[1];
+  param.left = drv->layout[2];
+  param.right = drv->layout[3];
+  param.center = drv->layout[4];
+  param.top_left = drv->layout[5];
+  param.top_right = drv->layout[6];
+  param.bottom_left = drv->layout[7];
+  param.bottom_right = drv->layout[8];
+  for (i = 0; i < 9; ++i)
+    n += drv->layout[i];
+
+  if (drv->type == BENCH_SERIAL) {
+    rcv->fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (rcv->fd < 0 || grantpt(rcv->fd) || unlockpt(rcv->fd)) {
+      fprintf(stderr, "can't create pseudo terminal: %s\n", strerror(errno));
+      goto out;
+    }
+    snprintf(param.driver_param, sizeof(param.driver_param), "%s;baud=%d%s", ptsname(rcv->fd), baud, drv->options);
+  } else {
+    snprintf(filename, sizeof(filename), "%s/atmo_drvbench.%d.rec", tmpdir, (int) getpid());
+    unlink(filename);
+    snprintf(param.driver_param, sizeof(param.driver_param), "%s%s", filename, drv->options);
+  }
+
+  for (i = 1; i <= NUM_DRIVERS; ++i) {
+    if (!strcmp(driver_enum[i], drv->name))
+      output_driver = get_output_driver(&output_drivers, i);
+  }
+  if (!output_driver) {
+    fprintf(stderr, "unknown driver '%s'\n", drv->name);
+    goto out;
+  }
+  if (output_driver->open(output_driver, &param)) {
+    fprintf(stderr, "can't open driver '%s': %s\n", drv->name, output_driver->errmsg);
+    goto out;
+  }
+
+  if (drv->type == BENCH_FILE) {
+    rcv->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    rcv->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (rcv->fd < 0 || rcv->notify_fd < 0 || inotify_add_watch(rcv->notify_fd, filename, IN_MODIFY) < 0) {
+      fprintf(stderr, "can't watch recording '%s': %s\n", filename, strerror(errno));
+      output_driver->close(output_driver);
+      unlink(filename);
+      goto out;
+    }
+  }
+
+  rcv->running = 1;
+  if (pthread_create(&rcv_thread, NULL, (drv->type == BENCH_SERIAL) ? bench_receiver_loop: bench_file_receiver_loop, rcv)) {
+    fprintf(stderr, "can't create receiver thread\n");
+    output_driver->close(output_driver);
+    goto out;
+  }
+
+    /* send frames with constant rate */
+  const int64_t period = 1000000000 / rate;
+  int64_t next = monotonic_ns();
+  for (sent = 0; sent < frames; ++sent) {
+    struct timespec ts;
+    const int seq = sent + 1;
+    next += period;
+    ts.tv_sec = next / 1000000000;
+    ts.tv_nsec = next % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      ;
+    bench_frame_colors(colors, n, seq);
+    int64_t t0 = monotonic_ns();
+    pthread_mutex_lock(&rcv->lock);
+    rcv->send_ns[seq] = t0;
+    pthread_mutex_unlock(&rcv->lock);
+    output_driver->output_colors(output_driver, colors, NULL);
+    call_us[sent] = (monotonic_ns() - t0) / 1000;
+  }
+
+  usleep(BENCH_DRAIN_TIME * 1000);
+  if (output_driver->close(output_driver))
+    fprintf(stderr, "%s: %s\n", drv->name, output_driver->errmsg);
+
+  pthread_mutex_lock(&rcv->lock);
+  rcv->running = 0;
+  pthread_mutex_unlock(&rcv->lock);
+  pthread_join(rcv_thread, NULL);
+  if (drv->type == BENCH_FILE)
+    unlink(filename);
+
+    /* report */
+  qsort(call_us, sent, sizeof(int64_t), cmp_int64);
+  qsort(rcv->delivery_us, rcv->received, sizeof(int64_t), cmp_int64);
+    /* a pseudo terminal does not limit the data rate, wire rate is the maximum at the given baud rate */
+  char wire_fps[16] = "-";
+  if (drv->type == BENCH_SERIAL)
+    snprintf(wire_fps, sizeof(wire_fps), "%.1f", (double) baud / 10.0 / drv->msg_len);
+  printf("%-9s %5d %6d %6d %6d %5d %7.1f %7s   %5lld %5lld %6lld   %6lld %6lld %6lld %6lld\n",
+         drv->name, rate, sent, rcv->received, sent - rcv->received, rcv->garbled,
+         (double) rcv->received / duration, wire_fps,
+         (long long) percentile(call_us, sent, 50), (long long) percentile(call_us, sent, 99), (long long) percentile(call_us, sent, 100),
+         (long long) percentile(rcv->delivery_us, rcv->received, 50), (long long) percentile(rcv->delivery_us, rcv->received, 90),
+         (long long) percentile(rcv->delivery_us, rcv->received, 99), (long long) percentile(rcv->delivery_us, rcv->received, 100));
+  rc = 0;
+
+out:
+  if (rcv) {
+    if (rcv->fd >= 0)
+      close(rcv->fd);
+    if (rcv->notify_fd >= 0)
+      close(rcv->notify_fd);
+    pthread_mutex_destroy(&rcv->lock);
+    free(rcv->delivery_us);
+    free(rcv);
+  }
+  free(call_us);
+  return rc;
+}
+
+
+static void usage(void) {
+  fprintf(stderr, "usage: atmo_drvbench [-t seconds] [-r rate,rate,...] [-b baud] [driver ...]\n"
+                  "  -t  duration of each run (default 2)\n"
+                  "  -r  frame rates [fps] (default 25,50,100,200,500,1000)\n"
+                  "  -b  baud rate of serial drivers (default 115200)\n"
+                  "  drivers: classic, df4ch, adalight, tpm2, file (default all)\n");
+  exit(1);
+}
+
+
+int main(int argc, char **argv) {
+  int rates[16] = { 25, 50, 100, 200, 500, 1000 };
+  int nrates = 6, duration = 2, baud = 115200;
+  const char *tmpdir = "/dev/shm";
+  int opt, i, d;
+
+  while ((opt = getopt(argc, argv, "t:r:b:")) != -1) {
+    switch (opt) {
+    case 't':
+      duration = atoi(optarg);
+      if (duration < 1)
+        usage();
+      break;
+    case 'r': {
+      char *s = optarg;
+      for (nrates = 0; nrates < 16 && *s; ++nrates) {
+        rates[nrates] = strtol(s, &s, 10);
+        if (rates[nrates] < 1)
+          usage();
+        if (*s == ',')
+          ++s;
+      }
+      break;
+    }
+    case 'b':
+      baud = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+
+  if (access(tmpdir, W_OK))
+    tmpdir = getenv("TMPDIR") ? getenv("TMPDIR"): "/tmp";
+
+  printf("                                                  ------ call [us] -----   ------- delivery [us] -------\n");
+  printf("%-9s %5s %6s %6s %6s %5s %7s %7s   %5s %5s %6s   %6s %6s %6s %6s\n",
+         "driver", "rate", "sent", "recv", "drop", "garb", "fps", "wire", "p50", "p99", "max", "p50", "p90", "p99", "max");
+
+  for (i = optind; i < argc; ++i) {
+    for (d = 0; bench_drivers[d].name && strcmp(argv[i], bench_drivers[d].name); ++d)
+      ;
+    if (!bench_drivers[d].name)
+      usage();
+  }
+
+  for (d = 0; bench_drivers[d].name; ++d) {
+    if (optind < argc) {
+      for (i = optind; i < argc && strcmp(argv[i], bench_drivers[d].name); ++i)
+        ;
+      if (i == argc)
+        continue;
+    }
+    for (i = 0; i < nrates; ++i) {
+      if (run_bench(&bench_drivers[d], rates[i], duration, baud, tmpdir))
+        return 1;
+    }
+  }
+  return 0;
+}
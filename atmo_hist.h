@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ */
+
+/* ---
+ * Low overhead log scale time histogram for run time statistics.
+ * Bucket n counts times of 2^n ... 2^(n+1)-1 us, bucket 0 also counts 0 us.
+ */
+
+#ifndef _ATMO_HIST_H
+#define _ATMO_HIST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define ATMO_HIST_BUCKETS       24      /* last bucket counts all times >= 2^23 us */
+
+typedef struct {
+  uint32_t cnt;
+  uint32_t max;                 /* [us] */
+  uint64_t sum;                 /* [us] */
+  uint32_t bucket[ATMO_HIST_BUCKETS];
+} atmo_hist_t;
+
+
+  /* CLOCK_MONOTONIC time [us] */
+static inline int64_t atmo_hist_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static inline void atmo_hist_add(atmo_hist_t *h, int64_t us) {
+  int b = 0;
+
+  if (us < 0)
+    us = 0;
+  if (us > 0xFFFFFFFF)
+    us = 0xFFFFFFFF;
+  if (us > 1)
+    b = 63 - __builtin_clzll(us);
+  if (b >= ATMO_HIST_BUCKETS)
+    b = ATMO_HIST_BUCKETS - 1;
+  ++h->bucket[b];
+  ++h->cnt;
+  h->sum += us;
+  if (us > h->max)
+    h->max = us;
+}
+
+
+  /* Add time since *t and set *t to now, for timing of consecutive stages */
+static inline void atmo_hist_add_since(atmo_hist_t *h, int64_t *t) {
+  const int64_t now = atmo_hist_now();
+  atmo_hist_add(h, now - *t);
+  *t = now;
+}
+
+
+  /* Upper bound of bucket that holds the p percentile [us] */
+static inline uint32_t atmo_hist_percentile(const atmo_hist_t *h, int p) {
+  uint64_t cnt = 0;
+  const uint64_t limit = ((uint64_t) h->cnt * p + 99) / 100;
+  int b;
+
+  for (b = 0; b < ATMO_HIST_BUCKETS - 1; ++b) {
+    cnt += h->bucket[b];
+    if (cnt >= limit)
+      break;
+  }
+  const uint32_t bound = (2U << b) - 1;
+  return (bound < h->max) ? bound: h->max;
+}
+
+
+static inline void atmo_hist_format(const atmo_hist_t *h, const char *name, char *buf, size_t size) {
+  snprintf(buf, size, "%s: %u times, avg %u, p50 %u, p90 %u, p99 %u, max %u [us]", name, h->cnt,
+           h->cnt ? (uint32_t) (h->sum / h->cnt): 0, atmo_hist_percentile(h, 50), atmo_hist_percentile(h, 90),
+           atmo_hist_percentile(h, 99), h->max);
+}
+
+
+/* ---
+ * Glass to LED latency trace.
+ * Each analysis result carries a tag with the time stamps of its way through the plugin. The output driver completes
+ * the tag when the colors reached the device and adds the time of each hop to the trace histograms.
+ */
+
+enum { ATMO_TRACE_DISPLAY, ATMO_TRACE_ANALYSIS, ATMO_TRACE_PICKUP, ATMO_TRACE_DELAY, ATMO_TRACE_TRANSMIT, ATMO_TRACE_HOPS };
+
+static const char * const atmo_trace_hop_names[ATMO_TRACE_HOPS] = { "display to grab", "analysis", "output pickup", "delay line", "transmit" };
+
+typedef struct {
+  int64_t display;              /* frame appeared on screen (estimated from vpts), 0 if unknown [us] */
+  int64_t grab;                 /* grab of frame returned [us] */
+  int64_t analyzed;             /* analysis result published, 0 if tag is not set [us] */
+  int64_t filtered;             /* filtered colors entered delay line [us] */
+  int64_t submit;               /* colors passed to output driver [us] */
+} atmo_trace_tag_t;
+
+typedef struct {
+  atmo_hist_t hop[ATMO_TRACE_HOPS];
+  atmo_hist_t total;
+  int64_t last_analyzed;        /* only first completion of an analysis result is counted */
+} atmo_trace_t;
+
+
+  /* Add latencies of a tag whose colors reached the device at time 'now' */
+static inline void atmo_trace_complete(atmo_trace_t *t, const atmo_trace_tag_t *tag, int64_t now) {
+  if (!tag->analyzed || tag->analyzed == t->last_analyzed)
+    return;
+  t->last_analyzed = tag->analyzed;
+
+  if (tag->display)
+    atmo_hist_add(&t->hop[ATMO_TRACE_DISPLAY], tag->grab - tag->display);
+  atmo_hist_add(&t->hop[ATMO_TRACE_ANALYSIS], tag->analyzed - tag->grab);
+  atmo_hist_add(&t->hop[ATMO_TRACE_PICKUP], tag->filtered - tag->analyzed);
+  atmo_hist_add(&t->hop[ATMO_TRACE_DELAY], tag->submit - tag->filtered);
+  atmo_hist_add(&t->hop[ATMO_TRACE_TRANSMIT], now - tag->submit);
+  atmo_hist_add(&t->total, now - (tag->display ? tag->display: tag->grab));
+}
+
+#endif
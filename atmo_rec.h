@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ */
+
+/* ---
+ * Binary recording format written by the "file" output driver with option "binary".
+ *
+ * The file starts with a header followed by an append only sequence of records.
+ * Each record starts with type and size. A layout record precedes the first frame
+ * and every layout change. A frame record holds the RGB values of all sections of
+ * the actual layout in output driver channel order.
+ * Records are padded to a multiple of 8 bytes, integers are in host byte order.
+ */
+
+#define ATMO_REC_MAGIC          "ATMOREC"
+#define ATMO_REC_VERSION        1
+
+typedef struct {
+  char magic[8];                // ATMO_REC_MAGIC
+  uint32_t version;
+  uint32_t reserved;
+} atmo_rec_header_t;
+
+enum { ATMO_REC_LAYOUT = 1, ATMO_REC_FRAME = 2 };
+
+typedef struct {
+  uint16_t type;
+  uint16_t size;                // size of record including this header
+} atmo_rec_record_t;
+
+typedef struct {
+  atmo_rec_record_t rec;
+  uint8_t layout[9];            // top, bottom, left, right, center, top left, top right, bottom left, bottom right
+  uint8_t reserved[3];
+} atmo_rec_layout_t;
+
+typedef struct {
+  atmo_rec_record_t rec;
+  uint32_t reserved;
+  int64_t timestamp;            // CLOCK_MONOTONIC time of output [us]
+  int64_t vpts;                 // xine vpts of last analyzed video frame
+  uint8_t colors[];             // RGB values of all sections of actual layout
+} atmo_rec_frame_t;
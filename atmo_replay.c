@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ *
+ * Replay a binary recording of the file output driver into any output driver
+ * with the original timing.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+
+#define LOG_1           1
+#define LOG_2           0
+#define llprintf(cat, fmt, args...)  do { if (cat) fprintf(stderr, "atmo: " fmt, ##args); } while (0)
+
+#include "atmo_types.h"
+#include "output_driver.h"
+
+
+static volatile sig_atomic_t stop_replay;
+
+static void stop_handler(int sig) {
+  stop_replay = 1;
+}
+
+
+static int64_t monotonic_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void usage(void) {
+  fprintf(stderr, "usage: atmo_replay [-f] [-l] recording driver [driver_param]\n"
+                  "  -f  replay as fast as possible\n"
+                  "  -l  replay in endless loop\n");
+  exit(1);
+}
+
+
+int main(int argc, char **argv) {
+  output_drivers_t output_drivers;
+  output_driver_t *output_driver;
+  atmo_parameters_t param;
+  atmo_rec_header_t hdr;
+  atmo_rec_record_t rec;
+  uint8_t buf[65536];
+  rgb_color_t last_colors[sizeof(buf) / sizeof(rgb_color_t)];
+  int fast = 0, loop = 0, opened = 0, last_valid = 0, n = 0, d, c;
+  int64_t rec_start = 0, replay_start = 0, frames = 0, late = 0;
+
+  while ((c = getopt(argc, argv, "fl")) != -1) {
+    switch (c) {
+    case 'f':
+      fast = 1;
+      break;
+    case 'l':
+      loop = 1;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind < 2)
+    usage();
+
+  FILE *fd = fopen(argv[optind], "r");
+  if (!fd) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (fread(&hdr, sizeof(hdr), 1, fd) != 1 || strcmp(hdr.magic, ATMO_REC_MAGIC) || hdr.version != ATMO_REC_VERSION) {
+    fprintf(stderr, "%s: not a recording of this version\n", argv[optind]);
+    return 1;
+  }
+
+  for (d = 1; d <= NUM_DRIVERS; ++d) {
+    if (!strcmp(argv[optind + 1], driver_enum[d]))
+      break;
+  }
+  if (d > NUM_DRIVERS || !(output_driver = get_output_driver(&output_drivers, d))) {
+    fprintf(stderr, "%s: unknown output driver\n", argv[optind + 1]);
+    return 1;
+  }
+
+  memset(&param, 0, sizeof(param));
+  param.enabled = 1;
+  param.driver = d;
+  if (argc - optind > 2)
+    snprintf(param.driver_param, sizeof(param.driver_param), "%s", argv[optind + 2]);
+
+  signal(SIGINT, stop_handler);
+  signal(SIGTERM, stop_handler);
+
+  while (!stop_replay) {
+    if (fread(&rec, sizeof(rec), 1, fd) != 1) {
+      if (!loop || fseek(fd, sizeof(hdr), SEEK_SET))
+        break;
+      rec_start = 0;
+      continue;
+    }
+    if (rec.size < sizeof(rec) || fread(buf + sizeof(rec), rec.size - sizeof(rec), 1, fd) != 1) {
+      fprintf(stderr, "truncated record\n");
+      break;
+    }
+
+    if (rec.type == ATMO_REC_LAYOUT) {
+      atmo_rec_layout_t *l = (atmo_rec_layout_t *) buf;
+      param.top = l->layout[0];
+      param.bottom = l->layout[1];
+      param.left = l->layout[2];
+      param.right = l->layout[3];
+      param.center = l->layout[4];
+      param.top_left = l->layout[5];
+      param.top_right = l->layout[6];
+      param.bottom_left = l->layout[7];
+      param.bottom_right = l->layout[8];
+      n = param.top + param.bottom + param.left + param.right + param.center + param.top_left + param.top_right + param.bottom_left + param.bottom_right;
+      if (!opened) {
+        if (output_driver->open(output_driver, &param)) {
+          fprintf(stderr, "can't open output driver: %s\n", output_driver->errmsg);
+          return 1;
+        }
+        opened = 1;
+      } else if (output_driver->configure(output_driver, &param)) {
+        fprintf(stderr, "can't configure output driver: %s\n", output_driver->errmsg);
+        break;
+      }
+      last_valid = 0;
+    } else if (rec.type == ATMO_REC_FRAME && opened) {
+      atmo_rec_frame_t *f = (atmo_rec_frame_t *) buf;
+      if (sizeof(*f) + n * sizeof(rgb_color_t) > rec.size) {
+        fprintf(stderr, "frame does not match layout\n");
+        break;
+      }
+
+        /* wait until original time of frame */
+      if (!rec_start) {
+        rec_start = f->timestamp;
+        replay_start = monotonic_us();
+      } else if (!fast) {
+        int64_t due = replay_start + (f->timestamp - rec_start);
+        int64_t now = monotonic_us();
+        if (due > now) {
+          struct timespec ts;
+          ts.tv_sec = due / 1000000;
+          ts.tv_nsec = (due % 1000000) * 1000;
+          while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !stop_replay)
+            ;
+        } else if (now - due > 1000)
+          ++late;
+      }
+
+      output_driver->vpts = f->vpts;
+      output_driver->output_colors(output_driver, (rgb_color_t *) f->colors, (last_valid) ? last_colors: NULL);
+      memcpy(last_colors, f->colors, n * sizeof(rgb_color_t));
+      last_valid = 1;
+      ++frames;
+    }
+  }
+  fclose(fd);
+
+  if (opened) {
+      /* turn lights off */
+    memset(buf, 0, n * sizeof(rgb_color_t));
+    if (last_valid && memcmp(buf, last_colors, n * sizeof(rgb_color_t)))
+      output_driver->output_colors(output_driver, (rgb_color_t *) buf, last_colors);
+    if (output_driver->close(output_driver))
+      fprintf(stderr, "output driver: %s\n", output_driver->errmsg);
+  }
+
+  printf("%lld frames replayed, %lld frames more than 1ms late\n", (long long) frames, (long long) late);
+  return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ */
+
+/* ---
+ * Layout of the shared memory segment written by the "shm" output driver.
+ *
+ * The segment holds a ring of frame slots. The writer never waits for readers:
+ *
+ * Writer: slot = write_count % nslots
+ *         slot.seq += 1 (odd: slot is written), write frame, slot.seq += 1 (even)
+ *         write_count += 1, futex += 1, FUTEX_WAKE on futex
+ *
+ * Reader: wait with FUTEX_WAIT on futex while write_count is unchanged.
+ *         Latest frame is in slot (write_count - 1) % nslots.
+ *         Copy the slot and accept it only if slot.seq was even and unchanged
+ *         before and after the copy, otherwise the writer has overtaken the reader.
+ *
+ * All counters are updated with atomic operations, integers are in host byte order.
+ */
+
+#define ATMO_SHM_MAGIC          0x4F4D5441    // "ATMO"
+#define ATMO_SHM_VERSION        1
+#define ATMO_SHM_DEFAULT_NAME   "/xine_atmo"
+#define ATMO_SHM_MAX_CHANNELS   128
+
+  // Frame slot
+typedef struct {
+  uint32_t seq;                 // odd while slot is written
+  uint16_t nchannels;           // number of valid colors
+  uint8_t layout[9];            // top, bottom, left, right, center, top left, top right, bottom left, bottom right
+  uint8_t reserved;
+  uint64_t frame;               // frame number
+  int64_t timestamp;            // CLOCK_MONOTONIC time of output [us]
+  int64_t vpts;                 // xine vpts of last analyzed video frame
+  uint8_t colors[ATMO_SHM_MAX_CHANNELS * 3];  // RGB values in output driver channel order
+} atmo_shm_frame_t;
+
+  // Segment header followed by 'nslots' frame slots
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nslots;
+  uint32_t slot_size;           // sizeof(atmo_shm_frame_t)
+  uint32_t writer_active;       // zero when output driver is closed
+  int32_t futex;                // incremented and woken up for each frame
+  uint64_t write_count;         // number of frames written
+  atmo_shm_frame_t slots[];
+} atmo_shm_header_t;
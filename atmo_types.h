@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ */
+
+/* ---
+ * Types shared by plugin, output drivers and tools.
+ */
+
+typedef struct { uint8_t h, s, v; } hsv_color_t;
+typedef struct { uint8_t r, g, b; } rgb_color_t;
+typedef struct { uint64_t r, g, b; } rgb_color_sum_t;
+typedef struct { uint16_t r, g, b; } rgb16_color_t;     /* 8.8 fixed point, 255 is 0xff00 */
+
+#define RGB16_TO_8(v)   ((uint8_t) (((v) + 0x80) >> 8))
+
+
+/*
+ * Plugin parameters
+ */
+typedef struct {
+  int enabled;
+  int driver;
+  char driver_param[256];
+  char sinks[512];
+  int top;
+  int bottom;
+  int left;
+  int right;
+  int center;
+  int top_left;
+  int top_right;
+  int bottom_left;
+  int bottom_right;
+  int analyze_rate;
+  int analyze_size;
+  int overscan;
+  int darkness_limit;
+  int edge_weighting;
+  int hue_win_size;
+  int sat_win_size;
+  int hue_threshold;
+  int uniform_brightness;
+  int brightness;
+  int filter;
+  int filter_smoothness;
+  int filter_length;
+  int filter_threshold;
+  int filter_delay;
+  int output_rate;
+  int wc_red;
+  int wc_green;
+  int wc_blue;
+  int gamma;
+  int start_delay;
+  int output_sched;
+  int output_priority;
+  int grab_cpus;
+  int output_cpus;
+  int lock_memory;
+  char capture_file[256];
+  int stats_interval;
+  int stats_report;
+  char stats_socket[256];
+  int color_cache;
+} atmo_parameters_t;
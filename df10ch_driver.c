@@ -0,0 +1,1662 @@
+/*
+ * Copyright (C) 2009, 2010 Andreas Auras
+ *
+ * This file is part of the atmo post plugin, a plugin for the free xine video player.
+ *
+ * atmo post plugin is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * atmo post plugin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110, USA
+ *
+ */
+
+/* ---
+ * DF10CH output driver module, loaded by plugin and tools when driver 'df10ch' is selected.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#define LOG_1           1
+#define LOG_2           0
+#define llprintf(cat, fmt, args...)  do { if (cat) fprintf(stderr, "atmo: " fmt, ##args); } while (0)
+
+#include "atmo_types.h"
+#include "atmo_driver.h"
+
+
+/***************************************************************************************************
+ *    DF10CH output driver for my own designed "next generation" 10ch RGB Controller
+ ***************************************************************************************************/
+
+#include <libusb.h>
+#include "df10ch_usb_proto.h"
+
+#define DF10CH_USB_CFG_VENDOR_ID     0x16c0
+#define DF10CH_USB_CFG_PRODUCT_ID    0x05dc
+#define DF10CH_USB_CFG_VENDOR_NAME   "yak54@gmx.net"
+#define DF10CH_USB_CFG_PRODUCT       "DF10CH"
+#define DF10CH_USB_CFG_SERIAL        "AP"
+#define DF10CH_USB_DEFAULT_TIMEOUT   100
+#define DF10CH_RESCAN_INTERVAL       1000    // Rescan interval for detached controllers if hotplug is not supported [ms]
+
+#define DF10CH_MAX_CHANNELS     30
+#define DF10CH_SIZE_CONFIG      (17 + DF10CH_MAX_CHANNELS * 6)
+#define DF10CH_CONFIG_VALID_ID  0xA0A1
+
+enum { DF10CH_AREA_TOP, DF10CH_AREA_BOTTOM, DF10CH_AREA_LEFT, DF10CH_AREA_RIGHT, DF10CH_AREA_CENTER, DF10CH_AREA_TOP_LEFT, DF10CH_AREA_TOP_RIGHT, DF10CH_AREA_BOTTOM_LEFT, DF10CH_AREA_BOTTOM_RIGHT };
+
+typedef struct df10ch_gamma_tab_s {
+  struct df10ch_gamma_tab_s *next;
+  uint8_t gamma;
+  uint16_t white_cal;
+  uint16_t pwm_res;
+  uint16_t tab[256];
+  uint32_t tab16[257];          // PWM values of 8 bit colors in 1/256 steps for interpolation of 16 bit colors
+} df10ch_gamma_tab_t;
+
+typedef struct {
+  int req_channel;          // Channel number in request
+  int area;                 // Source area
+  int area_num;             // Source area number
+  int color;                // Source color
+  df10ch_gamma_tab_t *gamma_tab;  // Corresponding gamma table
+} df10ch_channel_config_t;
+
+  // Configuration of a controller cached by its USB port path. Only rebuild if eeprom configuration data changes.
+typedef struct df10ch_config_s {
+  struct df10ch_config_s *next;
+  char port_path[32];           // USB bus and port path of controller
+  uint16_t pwm_res;             // PWM resolution
+  int num_req_channels;         // Number of channels in request
+  df10ch_channel_config_t *channel_config;      // List of channel configurations
+  uint8_t eedata[DF10CH_SIZE_CONFIG];           // Raw eeprom configuration data
+} df10ch_config_t;
+
+static pthread_mutex_t df10ch_config_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static df10ch_config_t *df10ch_config_cache;      // List of cached controller configurations
+static df10ch_gamma_tab_t *df10ch_gamma_tabs;     // List of calculated gamma tables
+
+typedef struct df10ch_output_driver_s df10ch_output_driver_t;
+typedef struct df10ch_ctrl_s df10ch_ctrl_t;
+typedef struct df10ch_emu_dev_s df10ch_emu_dev_t;
+
+  // Transport of control transfers to the controllers (USB or emulated)
+typedef struct {
+  const char *name;
+  int (*init)(df10ch_output_driver_t *this);
+  void (*exit)(df10ch_output_driver_t *this);
+    // Open all available controllers and add them to controller list
+  int (*scan)(df10ch_output_driver_t *this);
+    // Reopen detached controllers
+  void (*rescan)(df10ch_output_driver_t *this);
+  void (*close)(df10ch_ctrl_t *ctrl);
+  int (*get_serial)(df10ch_ctrl_t *ctrl, uint8_t *buf, int size);
+    // Synchronous control in transfer, returns number of read bytes or libusb error code
+  int (*control_in)(df10ch_ctrl_t *ctrl, uint8_t req, uint16_t val, uint16_t index, unsigned int timeout, uint8_t *buf, uint16_t len);
+    // Asynchronous submit and cancel of prepared transfer. Driver lock is held.
+  int (*submit)(df10ch_ctrl_t *ctrl);
+  void (*cancel)(df10ch_ctrl_t *ctrl);
+    // Handle completion of transfers. Called by event thread.
+  int (*handle_events)(df10ch_output_driver_t *this, struct timeval *timeout);
+} df10ch_transport_t;
+
+struct df10ch_ctrl_s {
+  struct df10ch_ctrl_s *next;
+  df10ch_output_driver_t *driver;
+  int opened;                   // Is true if device is opened
+  libusb_device_handle *dev;
+  libusb_device *usb_dev;
+  df10ch_emu_dev_t *emu;        // Emulated device
+  int detached;                 // Is true if controller has been unplugged or does not respond any more
+  int idx_serial_number;        // USB string index of serial number
+  char port_path[32];           // USB bus and port path of controller
+  uint16_t config_version;      // Version number of configuration data
+  uint16_t pwm_res;             // PWM resolution
+  int num_req_channels;         // Number of channels in request
+  df10ch_channel_config_t *channel_config;      // Own copy of channel configurations
+  uint8_t eedata[DF10CH_SIZE_CONFIG];           // Raw eeprom configuration data
+  char id[32];                  // ID of Controller
+  struct libusb_transfer *transfer; // Prepared set brightness request for asynchrony submitting
+  uint8_t *transfer_data;       // Data of set brightness request
+  uint8_t *payload;             // Latest brightness values not yet submitted
+  uint8_t *sent_payload;        // Brightness values known to the controller
+  uint8_t *dither_err;          // Error diffusion residue of each channel in 1/256 PWM steps
+  int sent_valid;               // Is false if state of controller is unknown (e.g. after transfer error)
+  int payload_pending;          // Is true if payload is newer than submitted transfer data
+  int pending_submit;           // Is true if a asynchrony transfer is pending
+  int transfer_error;           // Is true if error status of controller should be read by event thread
+  struct timeval tvsubmit;      // Submit time of pending transfer
+  atmo_trace_tag_t payload_tag; // Trace tag of latest payload
+  atmo_trace_tag_t submit_tag;  // Trace tag of pending transfer
+};
+
+struct df10ch_output_driver_s {
+  output_driver_t output_driver;
+  const df10ch_transport_t *transport;
+  libusb_context *ctx;
+  atmo_parameters_t param;          // Global channel layout
+  df10ch_ctrl_t *ctrls;             // List of found controllers
+  uint16_t config_version;          // (Maximum) Version number of configuration data
+  int transfer_err_cnt;             // Number of transfer errors
+  int replaced_cnt;                 // Number of payloads replaced by a newer one before being submitted
+  int sync_mode;                    // Submit payloads to all controllers together with synced request
+  pthread_mutex_t lock;             // Protects transfer state of controllers
+  pthread_cond_t transfer_done;     // Signaled when a transfer completes
+  pthread_t event_thread;           // Handles USB events, error diagnostics and reattaching of controllers
+  int event_thread_running;
+  int has_hotplug;
+  libusb_hotplug_callback_handle hotplug_handle;
+  int rescan;                       // Is true if a device has been plugged in
+  struct timeval tvrescan;          // Time of last rescan
+  int emu_devices;                  // Emulator: number of controllers
+  int emu_latency;                  // Emulator: transfer latency [us]
+  int emu_jitter;                   // Emulator: maximum additional random transfer latency [us]
+  int emu_errors;                   // Emulator: failing transfers per 1000 transfers
+  unsigned int emu_seed;
+  pthread_cond_t emu_cond;          // Emulator: signaled when a transfer is submitted or cancelled
+};
+
+
+static const char *df10ch_usb_errmsg(int rc) {
+  switch (rc) {
+  case LIBUSB_SUCCESS:
+    return ("Success (no error)");
+  case LIBUSB_ERROR_IO:
+    return ("Input/output error");
+  case LIBUSB_ERROR_INVALID_PARAM:
+    return ("Invalid parameter");
+  case LIBUSB_ERROR_ACCESS:
+    return ("Access denied (insufficient permissions)");
+  case LIBUSB_ERROR_NO_DEVICE:
+    return ("No such device (it may have been disconnected)");
+  case LIBUSB_ERROR_NOT_FOUND:
+    return ("Entity not found");
+  case LIBUSB_ERROR_BUSY:
+    return ("Resource busy");
+  case LIBUSB_ERROR_TIMEOUT:
+    return ("Operation timed out");
+  case LIBUSB_ERROR_OVERFLOW:
+    return ("Overflow");
+  case LIBUSB_ERROR_PIPE:
+    return ("Pipe error");
+  case LIBUSB_ERROR_INTERRUPTED:
+    return ("System call interrupted (perhaps due to signal)");
+  case LIBUSB_ERROR_NO_MEM:
+    return ("Insufficient memory");
+  case LIBUSB_ERROR_NOT_SUPPORTED:
+    return ("Operation not supported or unimplemented on this platform");
+  case LIBUSB_ERROR_OTHER:
+    return ("Other error");
+  }
+  return ("?");
+}
+
+
+static const char * df10ch_usb_transfer_errmsg(int s) {
+  switch (s) {
+  case LIBUSB_TRANSFER_COMPLETED:
+    return ("Transfer completed without error");
+  case LIBUSB_TRANSFER_ERROR:
+    return ("Transfer failed");
+  case LIBUSB_TRANSFER_TIMED_OUT:
+    return ("Transfer timed out");
+  case LIBUSB_TRANSFER_CANCELLED:
+    return ("Transfer was cancelled");
+  case LIBUSB_TRANSFER_STALL:
+    return ("Control request stalled");
+  case LIBUSB_TRANSFER_NO_DEVICE:
+    return ("Device was disconnected");
+  case LIBUSB_TRANSFER_OVERFLOW:
+    return ("Device sent more data than requested");
+  }
+  return ("?");
+}
+
+
+static void df10ch_comm_errmsg(int stat, char *rc) {
+  if (stat == 0)
+    strcpy(rc, "OK");
+  else
+    *rc = 0;
+  if (stat & (1<<COMM_ERR_OVERRUN))
+      strcat(rc, " OVERRUN");
+  if (stat & (1<<COMM_ERR_FRAME))
+      strcat(rc, " FRAME");
+  if (stat & (1<<COMM_ERR_TIMEOUT))
+      strcat(rc, " TIMEOUT");
+  if (stat & (1<<COMM_ERR_START))
+      strcat(rc, " START");
+  if (stat & (1<<COMM_ERR_OVERFLOW))
+      strcat(rc, " OVERFLOW");
+  if (stat & (1<<COMM_ERR_CRC))
+      strcat(rc, " CRC");
+  if (stat & (1<<COMM_ERR_DUPLICATE))
+      strcat(rc, " DUPLICATE");
+  if (stat & (1<<COMM_ERR_DEBUG))
+      strcat(rc, " DEBUG");
+}
+
+
+static int df10ch_control_in_transfer(df10ch_ctrl_t *ctrl, uint8_t req, uint16_t val, uint16_t index, unsigned int timeout, uint8_t *buf, uint16_t buflen)
+{
+      // Use a return buffer always so that the controller is able to send a USB reply status
+      // This is special for VUSB at controller side
+    unsigned char rcbuf[1];
+    int len = buflen;
+    if (!len)
+    {
+        buf = rcbuf;
+        len = 1;
+    }
+
+      // Because VUSB at controller sends ACK reply before CRC check of received data we have to retry sending request our self if data is corrupted
+    int n = 0, retrys = 0;
+    while (retrys < 3)
+    {
+        n = ctrl->driver->transport->control_in(ctrl, req, val, index, timeout, buf, len);
+        if (n != LIBUSB_ERROR_INTERRUPTED)
+        {
+            if (n < 0)
+              ++ctrl->driver->transfer_err_cnt;
+            if (n >= 0 || n != LIBUSB_ERROR_PIPE)
+                break;
+            ++retrys;
+            llprintf(LOG_1, "%s: sending USB control transfer message %d failed (pipe error): retry %d\n", ctrl->id, req, retrys);
+        }
+    }
+
+    if (n < 0)
+    {
+        llprintf(LOG_1, "%s: sending USB control transfer message %d failed: %s\n", ctrl->id, req, df10ch_usb_errmsg(n));
+        return -1;
+    }
+
+    if (n != buflen)
+    {
+        llprintf(LOG_1, "%s: sending USB control transfer message %d failed: read %d bytes but expected %d bytes\n", ctrl->id, req, n, buflen);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void df10ch_dispose(df10ch_output_driver_t *this) {
+  df10ch_ctrl_t *ctrl = this->ctrls;
+  while (ctrl) {
+    libusb_free_transfer(ctrl->transfer);
+    if (ctrl->opened)
+      this->transport->close(ctrl);
+
+    df10ch_ctrl_t *next = ctrl->next;
+    free(ctrl->transfer_data);
+    free(ctrl->payload);
+    free(ctrl->sent_payload);
+    free(ctrl->dither_err);
+    free(ctrl->channel_config);
+    free(ctrl);
+    ctrl = next;
+  }
+
+  if (this->transport)
+    this->transport->exit(this);
+
+  this->ctrls = NULL;
+  this->ctx = NULL;
+
+  pthread_cond_destroy(&this->transfer_done);
+  pthread_mutex_destroy(&this->lock);
+}
+
+
+  // Lookup gamma table for gamma, white calibration and pwm resolution value. Cache lock must be held.
+static df10ch_gamma_tab_t *df10ch_get_gamma_tab(uint8_t gamma, uint16_t white_cal, uint16_t pwm_res) {
+  df10ch_gamma_tab_t *gt = df10ch_gamma_tabs;
+  while (gt && (gamma != gt->gamma || white_cal != gt->white_cal || pwm_res != gt->pwm_res))
+    gt = gt->next;
+  if (!gt) {
+      // Calculate new gamma table
+    gt = (df10ch_gamma_tab_t *) calloc(1, sizeof(df10ch_gamma_tab_t));
+    if (!gt)
+      return NULL;
+    gt->gamma = gamma;
+    gt->white_cal = white_cal;
+    gt->pwm_res = pwm_res;
+    const double dgamma = gamma / 10.0;
+    const double dwhite_cal = white_cal;
+    int v;
+    for (v = 0; v < 256; ++v) {
+      gt->tab[v] = (uint16_t) (lround(pow(((double)v / 255.0), dgamma) * dwhite_cal));
+      if (gt->tab[v] > pwm_res)
+        gt->tab[v] = pwm_res;
+      gt->tab16[v] = (uint32_t) (lround(pow(((double)v / 255.0), dgamma) * dwhite_cal * 256.0));
+      if (gt->tab16[v] > (uint32_t)pwm_res << 8)
+        gt->tab16[v] = (uint32_t)pwm_res << 8;
+    }
+    gt->tab16[256] = gt->tab16[255];
+    gt->next = df10ch_gamma_tabs;
+    df10ch_gamma_tabs = gt;
+  }
+  return gt;
+}
+
+
+  // Build channel configuration list from eeprom configuration data of cache entry. Cache lock must be held.
+static int df10ch_build_config(df10ch_ctrl_t *ctrl, df10ch_config_t *cfg) {
+  df10ch_output_driver_t *this = ctrl->driver;
+  uint8_t data[2];
+
+  cfg->num_req_channels = cfg->eedata[13];
+  if (cfg->num_req_channels > DF10CH_MAX_CHANNELS)
+    cfg->num_req_channels = DF10CH_MAX_CHANNELS;
+
+    // Read PWM resolution
+  if (df10ch_control_in_transfer(ctrl, PWM_REQ_GET_MAX_PWM, 0, 0, DF10CH_USB_DEFAULT_TIMEOUT, data, 2)) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: reading PWM resolution data fails!", ctrl->id);
+    return -1;
+  }
+  cfg->pwm_res = data[0] + (data[1] << 8);
+
+    // Build channel configuration list
+  int nch = cfg->num_req_channels;
+  free(cfg->channel_config);
+  df10ch_channel_config_t *ccfg = (df10ch_channel_config_t *) calloc(nch ? nch: 1, sizeof(df10ch_channel_config_t));
+  cfg->channel_config = ccfg;
+  if (!ccfg) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: out of memory!", ctrl->id);
+    return -1;
+  }
+  int eei = 14;
+  while (nch) {
+    ccfg->req_channel = cfg->eedata[eei];
+    ccfg->area = cfg->eedata[eei + 1] >> 2;
+    ccfg->color = cfg->eedata[eei + 1] & 0x03;
+    ccfg->area_num = cfg->eedata[eei + 2];
+    uint8_t gamma = cfg->eedata[eei + 3];
+    if (gamma < 10)
+      gamma = 10;
+    uint16_t white_cal = cfg->eedata[eei + 4] + (cfg->eedata[eei + 5] << 8);
+    ccfg->gamma_tab = df10ch_get_gamma_tab(gamma, white_cal, cfg->pwm_res);
+    if (!ccfg->gamma_tab) {
+      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: out of memory!", ctrl->id);
+      return -1;
+    }
+
+    ++ccfg;
+    eei += 6;
+    --nch;
+  }
+  return 0;
+}
+
+
+  // Read eeprom configuration of controller and get channel configuration from cache
+  // or build it if configuration data has been changed. Cache lock must be held.
+static df10ch_config_t *df10ch_get_config(df10ch_ctrl_t *ctrl) {
+  df10ch_output_driver_t *this = ctrl->driver;
+  uint8_t eedata[DF10CH_SIZE_CONFIG];
+
+  if (df10ch_control_in_transfer(ctrl, REQ_READ_EE_DATA, 0, 1, DF10CH_USB_DEFAULT_TIMEOUT, eedata, sizeof(eedata))) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: reading eeprom config data fails!", ctrl->id);
+    return NULL;
+  }
+
+    // check that configuration data is valid
+  int cfg_valid_id = eedata[0] + (eedata[1] << 8);
+  if (cfg_valid_id != DF10CH_CONFIG_VALID_ID) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: controller is not configured! Please run setup program first", ctrl->id);
+    return NULL;
+  }
+
+  df10ch_config_t *cfg = df10ch_config_cache;
+  while (cfg && strcmp(cfg->port_path, ctrl->port_path))
+    cfg = cfg->next;
+
+  if (cfg && cfg->channel_config && !memcmp(cfg->eedata, eedata, sizeof(eedata))) {
+    llprintf(LOG_1, "%s: using cached configuration\n", ctrl->id);
+    return cfg;
+  }
+
+  if (!cfg) {
+    cfg = (df10ch_config_t *) calloc(1, sizeof(df10ch_config_t));
+    if (!cfg) {
+      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: out of memory!", ctrl->id);
+      return NULL;
+    }
+    strcpy(cfg->port_path, ctrl->port_path);
+    cfg->next = df10ch_config_cache;
+    df10ch_config_cache = cfg;
+  }
+
+  memcpy(cfg->eedata, eedata, sizeof(eedata));
+  if (df10ch_build_config(ctrl, cfg)) {
+    free(cfg->channel_config);
+    cfg->channel_config = NULL;
+    return NULL;
+  }
+  llprintf(LOG_1, "%s: read configuration\n", ctrl->id);
+  return cfg;
+}
+
+
+static int df10ch_check_firmware(df10ch_ctrl_t *ctrl) {
+  df10ch_output_driver_t *this = ctrl->driver;
+  uint8_t data[256];
+
+    // Check that USB controller is running application firmware and not bootloader
+  int rc = this->transport->get_serial(ctrl, data, sizeof(data) - 1);
+  if (rc < 0) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: getting USB serial number string failed: %.52s", ctrl->id, df10ch_usb_errmsg(rc));
+    return -1;
+  }
+  if (rc != sizeof(DF10CH_USB_CFG_SERIAL) - 1 || memcmp(data, DF10CH_USB_CFG_SERIAL, rc)) {
+    data[rc] = 0;
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: application firmware of USB controller is not running! Current mode is: %.16s", ctrl->id, data);
+    return -1;
+  }
+
+    // check that PWM controller is running application firmware and not bootloader
+  if (df10ch_control_in_transfer(ctrl, PWM_REQ_GET_VERSION, 0, 0, DF10CH_USB_DEFAULT_TIMEOUT, data, 2)) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: reading PWM controller version fails!", ctrl->id);
+    return -1;
+  }
+  if (data[0] != PWM_VERS_APPL) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: application firmware of PWM controller is not running! Current mode is: %d", ctrl->id, data[0]);
+    return -1;
+  }
+  return 0;
+}
+
+
+  // Submit changed channel range of latest payload of controller. Driver lock must be held.
+static void df10ch_submit_payload(df10ch_ctrl_t *ctrl) {
+  const uint16_t *payload = (const uint16_t *) ctrl->payload;
+  const uint16_t *sent = (const uint16_t *) ctrl->sent_payload;
+  int first = 0, last = ctrl->num_req_channels - 1;
+
+    // latest payload is send when controller is reattached
+  if (ctrl->detached)
+    return;
+
+  ctrl->payload_pending = 0;
+  if (ctrl->sent_valid) {
+    while (first <= last && payload[first] == sent[first])
+      ++first;
+    if (first > last)
+      return;
+    while (payload[last] == sent[last])
+      --last;
+  }
+
+  int len = (last - first + 1) * 2;
+  memcpy(ctrl->transfer_data + LIBUSB_CONTROL_SETUP_SIZE, ctrl->payload + first * 2, len);
+  memcpy(ctrl->sent_payload + first * 2, ctrl->payload + first * 2, len);
+  ctrl->sent_valid = 1;
+  libusb_fill_control_setup(ctrl->transfer_data, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+                            ctrl->driver->sync_mode ? PWM_REQ_SET_BRIGHTNESS_SYNCED: PWM_REQ_SET_BRIGHTNESS, 0, first, len);
+  ctrl->transfer->length = LIBUSB_CONTROL_SETUP_SIZE + len;
+
+  gettimeofday(&ctrl->tvsubmit, NULL);
+  ctrl->submit_tag = ctrl->payload_tag;
+  int rc = ctrl->driver->transport->submit(ctrl);
+  if (rc) {
+    ctrl->sent_valid = 0;
+    if (rc == LIBUSB_ERROR_NO_DEVICE)
+      ctrl->detached = 1;
+    ++ctrl->driver->transfer_err_cnt;
+    llprintf(LOG_1, "%s: submitting USB control transfer message failed: %s\n", ctrl->id, df10ch_usb_errmsg(rc));
+  } else
+    ctrl->pending_submit = 1;
+}
+
+
+  // Submit pending payloads of all controllers together when no controller has a pending transfer. Driver lock must be held.
+static void df10ch_submit_synced(df10ch_output_driver_t *this) {
+  df10ch_ctrl_t *ctrl = this->ctrls;
+  while (ctrl) {
+    if (ctrl->pending_submit)
+      return;
+    ctrl = ctrl->next;
+  }
+
+  ctrl = this->ctrls;
+  while (ctrl) {
+    if (ctrl->payload_pending)
+      df10ch_submit_payload(ctrl);
+    ctrl = ctrl->next;
+  }
+}
+
+
+  // Called by event thread when a transfer completes
+static void df10ch_reply_cb(struct libusb_transfer *transfer) {
+  df10ch_ctrl_t *ctrl = (df10ch_ctrl_t *) transfer->user_data;
+  df10ch_output_driver_t *this = ctrl->driver;
+
+  pthread_mutex_lock(&this->lock);
+  ctrl->pending_submit = 0;
+  if (transfer->status != LIBUSB_TRANSFER_COMPLETED)
+    ctrl->sent_valid = 0;
+  if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+    ++this->transfer_err_cnt;
+    if (!ctrl->detached)
+      llprintf(LOG_1, "%s: device disconnected\n", ctrl->id);
+    ctrl->detached = 1;
+  } else if (transfer->status != LIBUSB_TRANSFER_COMPLETED && transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+    ++this->transfer_err_cnt;
+    ctrl->transfer_error = 1;
+    llprintf(LOG_1, "%s: submitting USB control transfer message failed: %s\n", ctrl->id, df10ch_usb_transfer_errmsg(transfer->status));
+  }
+
+  if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+    struct timeval tvnow, tvdiff;
+    gettimeofday(&tvnow, NULL);
+    timersub(&tvnow, &ctrl->tvsubmit, &tvdiff);
+    atmo_hist_add(&this->output_driver.write_hist, (int64_t) tvdiff.tv_sec * 1000000 + tvdiff.tv_usec);
+    atmo_trace_complete(&this->output_driver.trace, &ctrl->submit_tag, atmo_hist_now());
+  }
+
+    // send payload that has been published while transfer was pending
+  if (this->event_thread_running) {
+    if (this->sync_mode)
+      df10ch_submit_synced(this);
+    else if (ctrl->payload_pending)
+      df10ch_submit_payload(ctrl);
+  }
+
+  pthread_cond_broadcast(&this->transfer_done);
+  pthread_mutex_unlock(&this->lock);
+}
+
+
+static void df10ch_read_error_status(df10ch_ctrl_t *ctrl) {
+  char reply_errmsg[128], request_errmsg[128];
+  uint8_t data[1];
+  if (df10ch_control_in_transfer(ctrl, REQ_GET_REPLY_ERR_STATUS, 0, 0, DF10CH_USB_DEFAULT_TIMEOUT, data, 1))
+    strcpy(reply_errmsg, "N/A");
+  else
+    df10ch_comm_errmsg(data[0], reply_errmsg);
+  if (df10ch_control_in_transfer(ctrl, PWM_REQ_GET_REQUEST_ERR_STATUS, 0, 0, DF10CH_USB_DEFAULT_TIMEOUT, data, 1))
+    strcpy(request_errmsg, "N/A");
+  else
+    df10ch_comm_errmsg(data[0], request_errmsg);
+  llprintf(LOG_1, "%s: comm error USB: %s, PWM: %s\n", ctrl->id, reply_errmsg, request_errmsg);
+}
+
+
+/*
+ * USB transport
+ */
+
+static void df10ch_usb_port_path(libusb_device *d, char *port_path, size_t size) {
+  uint8_t ports[7];
+  int np = libusb_get_port_numbers(d, ports, sizeof(ports)), p, l;
+  l = snprintf(port_path, size, "%d", libusb_get_bus_number(d));
+  for (p = 0; p < np && l < (int)size; ++p)
+    l += snprintf(port_path + l, size - l, "%c%d", p ? '.': '-', ports[p]);
+}
+
+
+  // Open and claim USB device if it is a DF10CH controller
+  // Note: Because controller uses obdev's free USB product/vendor ID's we have to do special lookup for finding
+  // the controllers. See file "USB-IDs-for-free.txt" of VUSB distribution.
+static libusb_device_handle *df10ch_usb_open_device(libusb_device *d, char *id, char *port_path, int *idx_serial_number) {
+  struct libusb_device_descriptor desc;
+
+  int busnum = libusb_get_bus_number(d);
+  int devnum = libusb_get_device_address(d);
+
+  int rc = libusb_get_device_descriptor(d, &desc);
+  if (rc < 0)
+    llprintf(LOG_1, "USB[%d,%d]: getting USB device descriptor failed: %s\n", busnum, devnum, df10ch_usb_errmsg(rc));
+  else if (desc.idVendor == DF10CH_USB_CFG_VENDOR_ID && desc.idProduct == DF10CH_USB_CFG_PRODUCT_ID) {
+    libusb_device_handle *hdl = NULL;
+    rc = libusb_open(d, &hdl);
+    if (rc < 0)
+      llprintf(LOG_1, "USB[%d,%d]: open of USB device failed: %s\n", busnum, devnum, df10ch_usb_errmsg(rc));
+    else {
+      unsigned char buf[256];
+      rc = libusb_get_string_descriptor_ascii(hdl, desc.iManufacturer, buf, sizeof(buf));
+      if (rc < 0)
+        llprintf(LOG_1, "USB[%d,%d]: getting USB manufacturer string failed: %s\n", busnum, devnum, df10ch_usb_errmsg(rc));
+      else if (rc == sizeof(DF10CH_USB_CFG_VENDOR_NAME) - 1 && !memcmp(buf, DF10CH_USB_CFG_VENDOR_NAME, rc)) {
+        rc = libusb_get_string_descriptor_ascii(hdl, desc.iProduct, buf, sizeof(buf));
+        if (rc < 0)
+          llprintf(LOG_1, "USB[%d,%d]: getting USB product string failed: %s\n", busnum, devnum, df10ch_usb_errmsg(rc));
+        else if (rc == sizeof(DF10CH_USB_CFG_PRODUCT) - 1 && !memcmp(buf, DF10CH_USB_CFG_PRODUCT, rc)) {
+          snprintf(id, 32, "DF10CH[%d,%d]", busnum, devnum);
+          df10ch_usb_port_path(d, port_path, 32);
+          rc = libusb_set_configuration(hdl, 1);
+          if (rc < 0)
+            llprintf(LOG_1, "%s: setting USB configuration failed: %s\n", id, df10ch_usb_errmsg(rc));
+          else {
+            rc = libusb_claim_interface(hdl, 0);
+            if (rc < 0)
+              llprintf(LOG_1, "%s: claiming USB interface failed: %s\n", id, df10ch_usb_errmsg(rc));
+            else {
+              *idx_serial_number = desc.iSerialNumber;
+              llprintf(LOG_1, "%s: device opened at USB port %s\n", id, port_path);
+              return hdl;
+            }
+          }
+        }
+      }
+      libusb_close(hdl);
+    }
+  }
+  return NULL;
+}
+
+
+static int df10ch_usb_hotplug_cb(libusb_context *ctx, libusb_device *d, libusb_hotplug_event event, void *user_data) {
+  df10ch_output_driver_t *this = (df10ch_output_driver_t *) user_data;
+
+  pthread_mutex_lock(&this->lock);
+  if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT) {
+    df10ch_ctrl_t *ctrl = this->ctrls;
+    while (ctrl) {
+      if (ctrl->usb_dev == d && !ctrl->detached) {
+        ctrl->detached = 1;
+        llprintf(LOG_1, "%s: device unplugged\n", ctrl->id);
+      }
+      ctrl = ctrl->next;
+    }
+  } else
+    this->rescan = 1;
+  pthread_mutex_unlock(&this->lock);
+  return 0;
+}
+
+
+  // Reopen detached controller. Only controllers with unchanged configuration are accepted.
+static void df10ch_usb_reattach(df10ch_ctrl_t *ctrl, libusb_device *d) {
+  df10ch_output_driver_t *this = ctrl->driver;
+  char id[32], port_path[32];
+  int idx_serial_number;
+  uint8_t eedata[DF10CH_SIZE_CONFIG];
+
+  libusb_device_handle *hdl = df10ch_usb_open_device(d, id, port_path, &idx_serial_number);
+  if (!hdl)
+    return;
+
+    // controller is still marked as detached so output path does not use it
+  ctrl->dev = hdl;
+  ctrl->idx_serial_number = idx_serial_number;
+  int rc = df10ch_check_firmware(ctrl);
+  if (rc)
+    llprintf(LOG_1, "%s\n", this->output_driver.errmsg);
+  else if ((rc = df10ch_control_in_transfer(ctrl, REQ_READ_EE_DATA, 0, 1, DF10CH_USB_DEFAULT_TIMEOUT, eedata, sizeof(eedata))))
+    llprintf(LOG_1, "%s: reading eeprom config data fails!\n", id);
+  else if (memcmp(eedata, ctrl->eedata, sizeof(eedata))) {
+    llprintf(LOG_1, "%s: configuration has been changed! Stream restart required\n", id);
+    rc = -1;
+  }
+  if (rc) {
+    libusb_release_interface(hdl, 0);
+    libusb_close(hdl);
+    ctrl->dev = NULL;
+    return;
+  }
+
+  pthread_mutex_lock(&this->lock);
+  strcpy(ctrl->id, id);
+  ctrl->usb_dev = d;
+  ctrl->opened = 1;
+  libusb_fill_control_transfer(ctrl->transfer, hdl, ctrl->transfer_data, df10ch_reply_cb, ctrl, DF10CH_USB_DEFAULT_TIMEOUT);
+  ctrl->detached = 0;
+  ctrl->transfer_error = 0;
+  ctrl->sent_valid = 0;
+  ctrl->payload_pending = 1;
+  if (this->sync_mode)
+    df10ch_submit_synced(this);
+  else
+    df10ch_submit_payload(ctrl);
+  pthread_mutex_unlock(&this->lock);
+
+  llprintf(LOG_1, "%s: device reattached\n", id);
+}
+
+
+static void df10ch_usb_rescan(df10ch_output_driver_t *this) {
+  libusb_device **list = NULL;
+  ssize_t cnt = libusb_get_device_list(this->ctx, &list);
+  if (cnt < 0) {
+    llprintf(LOG_1, "getting list of USB devices failed: %s\n", df10ch_usb_errmsg(cnt));
+    return;
+  }
+
+  ssize_t i;
+  for (i = 0; i < cnt; i++) {
+    char port_path[32];
+    df10ch_usb_port_path(list[i], port_path, sizeof(port_path));
+
+      // controllers are identified by their USB port
+    pthread_mutex_lock(&this->lock);
+    df10ch_ctrl_t *ctrl = this->ctrls;
+    while (ctrl && (ctrl->opened || strcmp(ctrl->port_path, port_path)))
+      ctrl = ctrl->next;
+    pthread_mutex_unlock(&this->lock);
+
+    if (ctrl)
+      df10ch_usb_reattach(ctrl, list[i]);
+  }
+
+  libusb_free_device_list(list, 1);
+}
+
+
+static int df10ch_usb_init(df10ch_output_driver_t *this) {
+  if (libusb_init(&this->ctx) < 0) {
+    strcpy(this->output_driver.errmsg, "can't initialize USB library");
+    return -1;
+  }
+
+    // Get notified about unplugged and returning controllers. Without hotplug support detached controllers are polled.
+  this->has_hotplug = 0;
+  if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+    int rc = libusb_hotplug_register_callback(this->ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, LIBUSB_HOTPLUG_NO_FLAGS,
+                                          DF10CH_USB_CFG_VENDOR_ID, DF10CH_USB_CFG_PRODUCT_ID, LIBUSB_HOTPLUG_MATCH_ANY, df10ch_usb_hotplug_cb, this, &this->hotplug_handle);
+    if (rc)
+      llprintf(LOG_1, "registering USB hotplug callback failed: %s\n", df10ch_usb_errmsg(rc));
+    else
+      this->has_hotplug = 1;
+  }
+  return 0;
+}
+
+
+static void df10ch_usb_exit(df10ch_output_driver_t *this) {
+  if (this->has_hotplug) {
+    libusb_hotplug_deregister_callback(this->ctx, this->hotplug_handle);
+    this->has_hotplug = 0;
+  }
+  if (this->ctx)
+    libusb_exit(this->ctx);
+}
+
+
+static int df10ch_usb_scan(df10ch_output_driver_t *this) {
+  libusb_device **list = NULL;
+  ssize_t cnt = libusb_get_device_list(this->ctx, &list);
+  if (cnt < 0) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "getting list of USB devices failed: %s", df10ch_usb_errmsg(cnt));
+    return -1;
+  }
+
+  ssize_t i;
+  for (i = 0; i < cnt; i++) {
+    char id[32], port_path[32];
+    int idx_serial_number;
+    libusb_device_handle *hdl = df10ch_usb_open_device(list[i], id, port_path, &idx_serial_number);
+    if (hdl) {
+      df10ch_ctrl_t *ctrl = (df10ch_ctrl_t *) calloc(1, sizeof(df10ch_ctrl_t));
+      ctrl->next = this->ctrls;
+      this->ctrls = ctrl;
+      ctrl->driver = this;
+      ctrl->opened = 1;
+      ctrl->dev = hdl;
+      ctrl->usb_dev = list[i];
+      ctrl->idx_serial_number = idx_serial_number;
+      strcpy(ctrl->id, id);
+      strcpy(ctrl->port_path, port_path);
+    }
+  }
+
+  libusb_free_device_list(list, 1);
+  return 0;
+}
+
+
+static void df10ch_usb_close(df10ch_ctrl_t *ctrl) {
+  libusb_release_interface(ctrl->dev, 0);
+  libusb_close(ctrl->dev);
+  ctrl->dev = NULL;
+  ctrl->usb_dev = NULL;
+  ctrl->opened = 0;
+}
+
+
+static int df10ch_usb_get_serial(df10ch_ctrl_t *ctrl, uint8_t *buf, int size) {
+  return libusb_get_string_descriptor_ascii(ctrl->dev, ctrl->idx_serial_number, buf, size);
+}
+
+
+static int df10ch_usb_control_in(df10ch_ctrl_t *ctrl, uint8_t req, uint16_t val, uint16_t index, unsigned int timeout, uint8_t *buf, uint16_t len) {
+  return libusb_control_transfer(ctrl->dev, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE, req, val, index, buf, len, timeout);
+}
+
+
+static int df10ch_usb_submit(df10ch_ctrl_t *ctrl) {
+  return libusb_submit_transfer(ctrl->transfer);
+}
+
+
+static void df10ch_usb_cancel(df10ch_ctrl_t *ctrl) {
+  libusb_cancel_transfer(ctrl->transfer);
+}
+
+
+static int df10ch_usb_handle_events(df10ch_output_driver_t *this, struct timeval *timeout) {
+  return libusb_handle_events_timeout_completed(this->ctx, timeout, NULL);
+}
+
+
+static const df10ch_transport_t df10ch_usb_transport = {
+  "usb",
+  df10ch_usb_init,
+  df10ch_usb_exit,
+  df10ch_usb_scan,
+  df10ch_usb_rescan,
+  df10ch_usb_close,
+  df10ch_usb_get_serial,
+  df10ch_usb_control_in,
+  df10ch_usb_submit,
+  df10ch_usb_cancel,
+  df10ch_usb_handle_events
+};
+
+
+/*
+ * Emulated controllers for testing and benchmarking without hardware
+ */
+
+#define DF10CH_EMU_PWM_RES      1000
+
+struct df10ch_emu_dev_s {
+  uint8_t eeprom[DF10CH_SIZE_CONFIG];     // Configuration data starting at eeprom address 1
+  uint8_t brightness[DF10CH_MAX_CHANNELS * 2];
+  int busy;                               // Is true if a transfer is in progress
+  struct timeval tvdue;                   // Completion time of transfer
+  enum libusb_transfer_status status;     // Completion status of transfer
+  int received;                           // Number of received brightness requests
+};
+
+
+  // Returns emulated transfer latency. Driver lock must be held.
+static int df10ch_emu_latency(df10ch_output_driver_t *this) {
+  int latency = this->emu_latency;
+  if (this->emu_jitter > 0)
+    latency += rand_r(&this->emu_seed) % this->emu_jitter;
+  return latency;
+}
+
+
+static int df10ch_emu_init(df10ch_output_driver_t *this) {
+  pthread_cond_init(&this->emu_cond, NULL);
+  this->emu_seed = (unsigned int) time(NULL);
+  return 0;
+}
+
+
+static void df10ch_emu_exit(df10ch_output_driver_t *this) {
+  pthread_cond_destroy(&this->emu_cond);
+}
+
+
+  // Each emulated controller drives 3 top, 3 bottom, 2 left and 2 right sections of its own
+static int df10ch_emu_scan(df10ch_output_driver_t *this) {
+  const int n = this->emu_devices;
+  int k;
+  for (k = n - 1; k >= 0; --k) {
+    df10ch_ctrl_t *ctrl = (df10ch_ctrl_t *) calloc(1, sizeof(df10ch_ctrl_t));
+    df10ch_emu_dev_t *emu = (df10ch_emu_dev_t *) calloc(1, sizeof(df10ch_emu_dev_t));
+    if (!ctrl || !emu) {
+      free(ctrl);
+      free(emu);
+      strcpy(this->output_driver.errmsg, "out of memory!");
+      return -1;
+    }
+
+    uint8_t *ee = emu->eeprom;
+    ee[0] = DF10CH_CONFIG_VALID_ID & 0xff;
+    ee[1] = DF10CH_CONFIG_VALID_ID >> 8;
+    ee[2] = 1;  // Version 1: overscan, analyze size and edge weighting are taken from plugin parameters
+    ee[3] = 0;
+    ee[4 + DF10CH_AREA_TOP] = 3 * n;
+    ee[4 + DF10CH_AREA_BOTTOM] = 3 * n;
+    ee[4 + DF10CH_AREA_LEFT] = 2 * n;
+    ee[4 + DF10CH_AREA_RIGHT] = 2 * n;
+    ee[13] = DF10CH_MAX_CHANNELS;
+    int c, eei = 14;
+    for (c = 0; c < DF10CH_MAX_CHANNELS; ++c) {
+      int section = c / 3, area, area_num;
+      if (section < 3) {
+        area = DF10CH_AREA_TOP;
+        area_num = 3 * k + section;
+      } else if (section < 6) {
+        area = DF10CH_AREA_BOTTOM;
+        area_num = 3 * k + section - 3;
+      } else if (section < 8) {
+        area = DF10CH_AREA_LEFT;
+        area_num = 2 * k + section - 6;
+      } else {
+        area = DF10CH_AREA_RIGHT;
+        area_num = 2 * k + section - 8;
+      }
+      ee[eei] = c;
+      ee[eei + 1] = (area << 2) | (c % 3);
+      ee[eei + 2] = area_num;
+      ee[eei + 3] = 22;
+      ee[eei + 4] = DF10CH_EMU_PWM_RES & 0xff;
+      ee[eei + 5] = DF10CH_EMU_PWM_RES >> 8;
+      eei += 6;
+    }
+
+    ctrl->next = this->ctrls;
+    this->ctrls = ctrl;
+    ctrl->driver = this;
+    ctrl->opened = 1;
+    ctrl->emu = emu;
+    snprintf(ctrl->id, sizeof(ctrl->id), "DF10CH-EMU[%d]", k);
+    snprintf(ctrl->port_path, sizeof(ctrl->port_path), "emu-%d", k);
+    llprintf(LOG_1, "%s: device opened\n", ctrl->id);
+  }
+  return 0;
+}
+
+
+  // Emulated controllers are never unplugged
+static void df10ch_emu_rescan(df10ch_output_driver_t *this) {
+}
+
+
+static void df10ch_emu_close(df10ch_ctrl_t *ctrl) {
+  llprintf(LOG_1, "%s: %d brightness requests received\n", ctrl->id, ctrl->emu->received);
+  free(ctrl->emu);
+  ctrl->emu = NULL;
+  ctrl->opened = 0;
+}
+
+
+static int df10ch_emu_get_serial(df10ch_ctrl_t *ctrl, uint8_t *buf, int size) {
+  int n = sizeof(DF10CH_USB_CFG_SERIAL) - 1;
+  if (n > size)
+    n = size;
+  memcpy(buf, DF10CH_USB_CFG_SERIAL, n);
+  return n;
+}
+
+
+static int df10ch_emu_control_in(df10ch_ctrl_t *ctrl, uint8_t req, uint16_t val, uint16_t index, unsigned int timeout, uint8_t *buf, uint16_t len) {
+  df10ch_output_driver_t *this = ctrl->driver;
+  df10ch_emu_dev_t *emu = ctrl->emu;
+
+  pthread_mutex_lock(&this->lock);
+  int latency = df10ch_emu_latency(this);
+  pthread_mutex_unlock(&this->lock);
+  usleep(latency);
+
+  switch (req) {
+  case REQ_READ_EE_DATA:
+    if (index < 1 || index - 1 + len > sizeof(emu->eeprom))
+      return LIBUSB_ERROR_PIPE;
+    memcpy(buf, emu->eeprom + index - 1, len);
+    return len;
+  case PWM_REQ_GET_VERSION:
+    if (len < 2)
+      return LIBUSB_ERROR_OVERFLOW;
+    buf[0] = PWM_VERS_APPL;
+    buf[1] = 0;
+    return 2;
+  case PWM_REQ_GET_MAX_PWM:
+    if (len < 2)
+      return LIBUSB_ERROR_OVERFLOW;
+    buf[0] = DF10CH_EMU_PWM_RES & 0xff;
+    buf[1] = DF10CH_EMU_PWM_RES >> 8;
+    return 2;
+  case REQ_GET_REPLY_ERR_STATUS:
+  case PWM_REQ_GET_REQUEST_ERR_STATUS:
+    if (len < 1)
+      return LIBUSB_ERROR_OVERFLOW;
+    buf[0] = 0;
+    return 1;
+  }
+  return LIBUSB_ERROR_PIPE;
+}
+
+
+static int df10ch_emu_submit(df10ch_ctrl_t *ctrl) {
+  df10ch_output_driver_t *this = ctrl->driver;
+  df10ch_emu_dev_t *emu = ctrl->emu;
+  const uint8_t *setup = ctrl->transfer->buffer;
+  const int req = setup[1];
+  const int index = setup[4] | (setup[5] << 8);
+  const int len = setup[6] | (setup[7] << 8);
+  struct timeval tvnow, tvdiff;
+
+  if (emu->busy)
+    return LIBUSB_ERROR_BUSY;
+
+  if ((req != PWM_REQ_SET_BRIGHTNESS && req != PWM_REQ_SET_BRIGHTNESS_SYNCED) || index * 2 + len > (int)sizeof(emu->brightness))
+    emu->status = LIBUSB_TRANSFER_STALL;
+  else if (this->emu_errors > 0 && (rand_r(&this->emu_seed) % 1000) < this->emu_errors)
+    emu->status = LIBUSB_TRANSFER_TIMED_OUT;
+  else {
+    memcpy(emu->brightness + index * 2, setup + LIBUSB_CONTROL_SETUP_SIZE, len);
+    ++emu->received;
+    emu->status = LIBUSB_TRANSFER_COMPLETED;
+  }
+
+  int latency = df10ch_emu_latency(this);
+  if (emu->status == LIBUSB_TRANSFER_TIMED_OUT)
+    latency = ctrl->transfer->timeout * 1000;
+  gettimeofday(&tvnow, NULL);
+  tvdiff.tv_sec = latency / 1000000;
+  tvdiff.tv_usec = latency % 1000000;
+  timeradd(&tvnow, &tvdiff, &emu->tvdue);
+  emu->busy = 1;
+  pthread_cond_signal(&this->emu_cond);
+  return 0;
+}
+
+
+static void df10ch_emu_cancel(df10ch_ctrl_t *ctrl) {
+  df10ch_emu_dev_t *emu = ctrl->emu;
+  if (emu->busy) {
+    emu->status = LIBUSB_TRANSFER_CANCELLED;
+    gettimeofday(&emu->tvdue, NULL);
+    pthread_cond_signal(&ctrl->driver->emu_cond);
+  }
+}
+
+
+  // Complete emulated transfers that are due within timeout
+static int df10ch_emu_handle_events(df10ch_output_driver_t *this, struct timeval *timeout) {
+  struct timeval tvnow, tvend;
+  struct timespec ts;
+
+  gettimeofday(&tvnow, NULL);
+  timeradd(&tvnow, timeout, &tvend);
+
+  pthread_mutex_lock(&this->lock);
+  for (;;) {
+    df10ch_ctrl_t *ctrl = this->ctrls, *done = NULL;
+    struct timeval tvwait = tvend;
+    while (ctrl) {
+      if (ctrl->emu && ctrl->emu->busy && timercmp(&ctrl->emu->tvdue, &tvwait, <)) {
+        tvwait = ctrl->emu->tvdue;
+        done = ctrl;
+      }
+      ctrl = ctrl->next;
+    }
+
+    gettimeofday(&tvnow, NULL);
+    if (done && !timercmp(&tvnow, &tvwait, <)) {
+      struct libusb_transfer *transfer = done->transfer;
+      done->emu->busy = 0;
+      transfer->status = done->emu->status;
+      transfer->actual_length = (transfer->status == LIBUSB_TRANSFER_COMPLETED) ? transfer->length - LIBUSB_CONTROL_SETUP_SIZE: 0;
+      pthread_mutex_unlock(&this->lock);
+      transfer->callback(transfer);
+      return 0;
+    }
+    if (!timercmp(&tvnow, &tvend, <))
+      break;
+
+    ts.tv_sec = tvwait.tv_sec;
+    ts.tv_nsec = tvwait.tv_usec * 1000;
+    pthread_cond_timedwait(&this->emu_cond, &this->lock, &ts);
+  }
+  pthread_mutex_unlock(&this->lock);
+  return 0;
+}
+
+
+static const df10ch_transport_t df10ch_emu_transport = {
+  "emulator",
+  df10ch_emu_init,
+  df10ch_emu_exit,
+  df10ch_emu_scan,
+  df10ch_emu_rescan,
+  df10ch_emu_close,
+  df10ch_emu_get_serial,
+  df10ch_emu_control_in,
+  df10ch_emu_submit,
+  df10ch_emu_cancel,
+  df10ch_emu_handle_events
+};
+
+
+static void *df10ch_event_loop(void *this_gen) {
+  df10ch_output_driver_t *this = (df10ch_output_driver_t *) this_gen;
+  struct timeval tvnow, tvdiff;
+
+  llprintf(LOG_1, "DF10CH event thread running\n");
+
+  pthread_mutex_lock(&this->lock);
+  while (this->event_thread_running) {
+    pthread_mutex_unlock(&this->lock);
+
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = (DF10CH_USB_DEFAULT_TIMEOUT + 50) * 1000;
+    int rc = this->transport->handle_events(this, &timeout);
+    if (rc && rc != LIBUSB_ERROR_INTERRUPTED) {
+      llprintf(LOG_1, "handling USB events failed: %s\n", df10ch_usb_errmsg(rc));
+      usleep(DF10CH_USB_DEFAULT_TIMEOUT * 1000);
+    }
+
+    int missing = 0;
+    pthread_mutex_lock(&this->lock);
+    df10ch_ctrl_t *ctrl = this->ctrls;
+    while (ctrl && this->event_thread_running) {
+      if (ctrl->detached) {
+          // close device of detached controller after end of pending transfer
+        if (ctrl->opened && !ctrl->pending_submit) {
+          pthread_mutex_unlock(&this->lock);
+          this->transport->close(ctrl);
+          llprintf(LOG_1, "%s: device detached\n", ctrl->id);
+          pthread_mutex_lock(&this->lock);
+        }
+        if (!ctrl->opened)
+          ++missing;
+      } else if (ctrl->transfer_error) {
+          // read error status of failed controllers outside of output path
+        ctrl->transfer_error = 0;
+        pthread_mutex_unlock(&this->lock);
+        df10ch_read_error_status(ctrl);
+        pthread_mutex_lock(&this->lock);
+      }
+      ctrl = ctrl->next;
+    }
+
+      // look for returning controllers
+    if (missing && this->event_thread_running) {
+      gettimeofday(&tvnow, NULL);
+      timersub(&tvnow, &this->tvrescan, &tvdiff);
+      if (this->rescan || (!this->has_hotplug && (tvdiff.tv_sec * 1000 + tvdiff.tv_usec / 1000) >= DF10CH_RESCAN_INTERVAL)) {
+        this->rescan = 0;
+        this->tvrescan = tvnow;
+        pthread_mutex_unlock(&this->lock);
+        this->transport->rescan(this);
+        pthread_mutex_lock(&this->lock);
+      }
+    }
+  }
+  pthread_mutex_unlock(&this->lock);
+
+  llprintf(LOG_1, "DF10CH event thread terminated\n");
+  return NULL;
+}
+
+
+static void df10ch_stop_event_thread(df10ch_output_driver_t *this) {
+  struct timeval tvnow, tvdiff, tvtimeout;
+  struct timespec ts;
+
+  pthread_mutex_lock(&this->lock);
+  if (!this->event_thread_running) {
+    pthread_mutex_unlock(&this->lock);
+    return;
+  }
+  this->event_thread_running = 0;
+
+    // Cancel all pending requests and wait for their completion
+  df10ch_ctrl_t *ctrl = this->ctrls;
+  while (ctrl) {
+    ctrl->payload_pending = 0;
+    if (ctrl->pending_submit)
+      this->transport->cancel(ctrl);
+    ctrl = ctrl->next;
+  }
+
+  tvdiff.tv_sec = 0;
+  tvdiff.tv_usec = (DF10CH_USB_DEFAULT_TIMEOUT + 50) * 1000;
+  gettimeofday(&tvnow, NULL);
+  timeradd(&tvnow, &tvdiff, &tvtimeout);
+  ts.tv_sec = tvtimeout.tv_sec;
+  ts.tv_nsec = tvtimeout.tv_usec * 1000;
+  ctrl = this->ctrls;
+  while (ctrl) {
+    if (ctrl->pending_submit) {
+      if (pthread_cond_timedwait(&this->transfer_done, &this->lock, &ts) == ETIMEDOUT) {
+        llprintf(LOG_1, "%s: timeout while waiting for cancelled transfer\n", ctrl->id);
+        break;
+      }
+    }
+    else
+      ctrl = ctrl->next;
+  }
+  pthread_mutex_unlock(&this->lock);
+
+  pthread_join(this->event_thread, NULL);
+}
+
+
+static int df10ch_driver_open(output_driver_t *this_gen, atmo_parameters_t *param) {
+  df10ch_output_driver_t *this = (df10ch_output_driver_t *) this_gen;
+
+  this->config_version = 0;
+  memset(&this->output_driver.write_hist, 0, sizeof(this->output_driver.write_hist));
+  memset(&this->output_driver.trace, 0, sizeof(this->output_driver.trace));
+  this->transfer_err_cnt = 0;
+  this->replaced_cnt = 0;
+  this->event_thread_running = 0;
+  this->sync_mode = get_driver_option(param->driver_param, "sync", NULL, 0);
+  pthread_mutex_init(&this->lock, NULL);
+  pthread_cond_init(&this->transfer_done, NULL);
+
+    // Select emulated controllers instead of USB devices
+  const df10ch_transport_t *transport = &df10ch_usb_transport;
+  if (get_driver_option(param->driver_param, "emu", NULL, 0)) {
+    transport = &df10ch_emu_transport;
+    this->emu_devices = get_driver_int_option(param->driver_param, "emu", 1);
+    if (this->emu_devices < 1)
+      this->emu_devices = 1;
+    this->emu_latency = get_driver_int_option(param->driver_param, "emu_latency", 1000);
+    this->emu_jitter = get_driver_int_option(param->driver_param, "emu_jitter", 0);
+    this->emu_errors = get_driver_int_option(param->driver_param, "emu_errors", 0);
+    llprintf(LOG_1, "using %d emulated controllers: latency %d us, jitter %d us, errors %d/1000\n", this->emu_devices, this->emu_latency, this->emu_jitter, this->emu_errors);
+  }
+
+  this->transport = NULL;
+  if (transport->init(this)) {
+    pthread_cond_destroy(&this->transfer_done);
+    pthread_mutex_destroy(&this->lock);
+    return -1;
+  }
+  this->transport = transport;
+
+  if (transport->scan(this)) {
+    df10ch_dispose(this);
+    return -1;
+  }
+
+  if (!this->ctrls) {
+    strcpy(this->output_driver.errmsg, "USB: no DF10CH devices found!");
+    df10ch_dispose(this);
+    return -1;
+  }
+
+    // Ignore channel configuration defined by plugin parameters
+  param->top = 0;
+  param->bottom = 0;
+  param->left = 0;
+  param->right = 0;
+  param->center = 0;
+  param->top_left = 0;
+  param->top_right = 0;
+  param->bottom_left = 0;
+  param->bottom_right = 0;
+
+    // Read controller configuration
+  df10ch_ctrl_t *ctrl = this->ctrls;
+  while (ctrl) {
+    if (df10ch_check_firmware(ctrl)) {
+      df10ch_dispose(this);
+      return -1;
+    }
+
+      // read eeprom configuration data only if it has been changed since last open
+    pthread_mutex_lock(&df10ch_config_cache_lock);
+    df10ch_config_t *cfg = df10ch_get_config(ctrl);
+    if (!cfg) {
+      pthread_mutex_unlock(&df10ch_config_cache_lock);
+      df10ch_dispose(this);
+      return -1;
+    }
+    memcpy(ctrl->eedata, cfg->eedata, sizeof(ctrl->eedata));
+    ctrl->pwm_res = cfg->pwm_res;
+    ctrl->num_req_channels = cfg->num_req_channels;
+      // cache entry may be rebuilt by another driver instance, gamma tables are never freed
+    ctrl->channel_config = (df10ch_channel_config_t *) malloc((cfg->num_req_channels ? cfg->num_req_channels: 1) * sizeof(df10ch_channel_config_t));
+    if (ctrl->channel_config)
+      memcpy(ctrl->channel_config, cfg->channel_config, cfg->num_req_channels * sizeof(df10ch_channel_config_t));
+    pthread_mutex_unlock(&df10ch_config_cache_lock);
+    if (!ctrl->channel_config) {
+      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: out of memory!", ctrl->id);
+      df10ch_dispose(this);
+      return -1;
+    }
+    const uint8_t *eedata = ctrl->eedata;
+
+    ctrl->config_version = eedata[2] + (eedata[3] << 8);
+    if (ctrl->config_version > this->config_version)
+      this->config_version = ctrl->config_version;
+
+      // Determine channel layout
+    int n;
+    n = eedata[4 + DF10CH_AREA_TOP];
+    if (n > param->top)
+      param->top = n;
+    n = eedata[4 + DF10CH_AREA_BOTTOM];
+    if (n > param->bottom)
+      param->bottom = n;
+    n = eedata[4 + DF10CH_AREA_LEFT];
+    if (n > param->left)
+      param->left = n;
+    n = eedata[4 + DF10CH_AREA_RIGHT];
+    if (n > param->right)
+      param->right = n;
+    n = eedata[4 + DF10CH_AREA_CENTER];
+    if (n > param->center)
+      param->center = n;
+    n = eedata[4 + DF10CH_AREA_TOP_LEFT];
+    if (n > param->top_left)
+      param->top_left = n;
+    n = eedata[4 + DF10CH_AREA_TOP_RIGHT];
+    if (n > param->top_right)
+      param->top_right = n;
+    n = eedata[4 + DF10CH_AREA_BOTTOM_LEFT];
+    if (n > param->bottom_left)
+      param->bottom_left = n;
+    n = eedata[4 + DF10CH_AREA_BOTTOM_RIGHT];
+    if (n > param->bottom_right)
+      param->bottom_right = n;
+
+    if (ctrl->config_version > 1) {
+      int eei = 14 + ctrl->num_req_channels * 6;
+      param->overscan = eedata[eei];
+      param->analyze_size = eedata[eei + 1];
+      param->edge_weighting = eedata[eei + 2];
+    }
+
+      // Prepare USB request for sending brightness values
+    ctrl->transfer_data = calloc(1, (LIBUSB_CONTROL_SETUP_SIZE + ctrl->num_req_channels * 2));
+    libusb_fill_control_setup(ctrl->transfer_data, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE, PWM_REQ_SET_BRIGHTNESS, 0, 0, ctrl->num_req_channels * 2);
+    ctrl->payload = calloc(1, ctrl->num_req_channels * 2 + 2);
+    ctrl->sent_payload = calloc(1, ctrl->num_req_channels * 2 + 2);
+    ctrl->dither_err = calloc(1, ctrl->num_req_channels + 1);
+    ctrl->sent_valid = 0;
+    ctrl->transfer = libusb_alloc_transfer(0);
+    if (!ctrl->transfer_data || !ctrl->payload || !ctrl->sent_payload || !ctrl->dither_err || !ctrl->transfer) {
+      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: out of memory!", ctrl->id);
+      df10ch_dispose(this);
+      return -1;
+    }
+    libusb_fill_control_transfer(ctrl->transfer, ctrl->dev, ctrl->transfer_data, df10ch_reply_cb, ctrl, DF10CH_USB_DEFAULT_TIMEOUT);
+    ctrl->pending_submit = 0;
+    ctrl->payload_pending = 0;
+
+    ctrl = ctrl->next;
+  }
+
+  this->rescan = 0;
+  gettimeofday(&this->tvrescan, NULL);
+
+    // USB completion handling is done by a separate thread so that output path never waits for a controller
+  this->event_thread_running = 1;
+  int rc = pthread_create(&this->event_thread, NULL, df10ch_event_loop, this);
+  if (rc) {
+    this->event_thread_running = 0;
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "can't create USB event thread: %s", strerror(rc));
+    df10ch_dispose(this);
+    return -1;
+  }
+
+  this->param = *param;
+  return 0;
+}
+
+
+static int df10ch_driver_configure(output_driver_t *this_gen, atmo_parameters_t *param) {
+  df10ch_output_driver_t *this = (df10ch_output_driver_t *) this_gen;
+
+    // Ignore channel configuration defined by plugin parameters
+  param->top = this->param.top;
+  param->bottom = this->param.bottom;
+  param->left = this->param.left;
+  param->right = this->param.right;
+  param->center = this->param.center;
+  param->top_left = this->param.top_left;
+  param->top_right = this->param.top_right;
+  param->bottom_left = this->param.bottom_left;
+  param->bottom_right = this->param.bottom_right;
+
+  if (this->config_version > 1) {
+    param->overscan = this->param.overscan;
+    param->analyze_size = this->param.analyze_size;
+    param->edge_weighting = this->param.edge_weighting;
+  }
+
+  this->param = *param;
+  return 0;
+}
+
+
+static int df10ch_driver_close(output_driver_t *this_gen) {
+  df10ch_output_driver_t *this = (df10ch_output_driver_t *) this_gen;
+
+  df10ch_stop_event_thread(this);
+  df10ch_dispose(this);
+
+  if (LOG_1) {
+    char buf[256];
+    atmo_hist_format(&this->output_driver.write_hist, "transmit latency", buf, sizeof(buf));
+    llprintf(LOG_1, "%s, %d replaced payloads\n", buf, this->replaced_cnt);
+  }
+
+  if (this->transfer_err_cnt) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%d transfer errors happen", this->transfer_err_cnt);
+    return -1;
+  }
+  return 0;
+}
+
+
+static void df10ch_driver_get_stats(output_driver_t *this_gen, output_driver_stats_t *stats) {
+  df10ch_output_driver_t *this = (df10ch_output_driver_t *) this_gen;
+
+  pthread_mutex_lock(&this->lock);
+  stats->transfers = this->output_driver.write_hist.cnt;
+  stats->errors = this->transfer_err_cnt;
+  stats->replaced = this->replaced_cnt;
+  df10ch_ctrl_t *ctrl = this->ctrls;
+  while (ctrl) {
+    stats->queued += ctrl->payload_pending + ctrl->pending_submit;
+    ctrl = ctrl->next;
+  }
+  pthread_mutex_unlock(&this->lock);
+}
+
+
+static void df10ch_driver_get_hist(output_driver_t *this_gen, atmo_hist_t *write_hist, atmo_trace_t *trace) {
+  df10ch_output_driver_t *this = (df10ch_output_driver_t *) this_gen;
+
+  pthread_mutex_lock(&this->lock);
+  *write_hist = this->output_driver.write_hist;
+  *trace = this->output_driver.trace;
+  pthread_mutex_unlock(&this->lock);
+}
+
+
+  // Build index of first color of each area
+static void df10ch_area_map(df10ch_output_driver_t *this, int *area_map) {
+  int c = 0;
+  area_map[DF10CH_AREA_TOP] = c;
+  c += this->param.top;
+  area_map[DF10CH_AREA_BOTTOM] = c;
+  c += this->param.bottom;
+  area_map[DF10CH_AREA_LEFT] = c;
+  c += this->param.left;
+  area_map[DF10CH_AREA_RIGHT] = c;
+  c += this->param.right;
+  area_map[DF10CH_AREA_CENTER] = c;
+  c += this->param.center;
+  area_map[DF10CH_AREA_TOP_LEFT] = c;
+  c += this->param.top_left;
+  area_map[DF10CH_AREA_TOP_RIGHT] = c;
+  c += this->param.top_right;
+  area_map[DF10CH_AREA_BOTTOM_LEFT] = c;
+  c += this->param.bottom_left;
+  area_map[DF10CH_AREA_BOTTOM_RIGHT] = c;
+}
+
+
+  // Initiate asynchron data transfer of new payload to controller or let it be send after completion of the pending one. Driver lock must be held.
+static void df10ch_publish_payload(df10ch_output_driver_t *this, df10ch_ctrl_t *ctrl, int do_submit) {
+  if (do_submit || ctrl->payload_pending) {
+    if (ctrl->payload_pending && !ctrl->detached)
+      ++this->replaced_cnt;
+    ctrl->payload_pending = 1;
+    if (this->output_driver.trace_tag.analyzed)
+      ctrl->payload_tag = this->output_driver.trace_tag;
+    if (!ctrl->pending_submit && !this->sync_mode)
+      df10ch_submit_payload(ctrl);
+  }
+}
+
+
+static void df10ch_driver_output_colors(output_driver_t *this_gen, rgb_color_t *colors, rgb_color_t *last_colors) {
+  df10ch_output_driver_t *this = (df10ch_output_driver_t *) this_gen;
+  int area_map[9];
+
+  df10ch_area_map(this, area_map);
+
+    // Publish brightness values to controllers. Completion is handled by the event thread.
+  pthread_mutex_lock(&this->lock);
+  df10ch_ctrl_t *ctrl = this->ctrls;
+  while (ctrl) {
+      // Generate payload data (brightness values)
+    int do_submit = 0;
+    uint8_t *payload = ctrl->payload;
+    df10ch_channel_config_t *cfg = ctrl->channel_config;
+    int nch = ctrl->num_req_channels;
+    while (nch) {
+      int i = area_map[cfg->area] + cfg->area_num;
+      rgb_color_t *c = colors + i;
+      rgb_color_t *lc = last_colors ? last_colors + i: NULL;
+      int v = 0;
+      switch (cfg->color) {
+      case 0: // Red
+        v = c->r;
+        if (!lc || v != lc->r)
+          do_submit = 1;
+        break;
+      case 1: // Green
+        v = c->g;
+        if (!lc || v != lc->g)
+          do_submit = 1;
+        break;
+      case 2: // Blue
+        v = c->b;
+        if (!lc || v != lc->b)
+          do_submit = 1;
+      }
+
+        // gamma and white calibration correction
+      uint16_t bv = cfg->gamma_tab->tab[v];
+      payload[cfg->req_channel * 2] = bv;
+      payload[cfg->req_channel * 2 + 1] = bv >> 8;
+
+      ++cfg;
+      --nch;
+    }
+
+    if (!last_colors)
+      ctrl->sent_valid = 0;
+
+      // 8 bit output ends a high rate output run, next run starts without residue
+    memset(ctrl->dither_err, 0, ctrl->num_req_channels + 1);
+
+    df10ch_publish_payload(this, ctrl, do_submit);
+    ctrl = ctrl->next;
+  }
+
+    // in synchronized mode a frame is send to all controllers together
+  if (this->sync_mode)
+    df10ch_submit_synced(this);
+  pthread_mutex_unlock(&this->lock);
+}
+
+
+  /*
+   * High rate output of 16 bit colors. The gamma table is interpolated between the 8 bit colors and the fraction
+   * of a PWM step that can not be send is carried over to the next cycle of the channel (temporal error diffusion),
+   * so that the controller shows the exact brightness on average.
+   */
+static void df10ch_driver_output_colors16(output_driver_t *this_gen, rgb16_color_t *colors) {
+  df10ch_output_driver_t *this = (df10ch_output_driver_t *) this_gen;
+  int area_map[9];
+
+  df10ch_area_map(this, area_map);
+
+  pthread_mutex_lock(&this->lock);
+  df10ch_ctrl_t *ctrl = this->ctrls;
+  while (ctrl) {
+    int do_submit = 0;
+    uint8_t *payload = ctrl->payload;
+    uint8_t *err = ctrl->dither_err;
+    df10ch_channel_config_t *cfg = ctrl->channel_config;
+    int nch = ctrl->num_req_channels;
+    while (nch) {
+      rgb16_color_t *c = colors + area_map[cfg->area] + cfg->area_num;
+      unsigned int v = 0;
+      switch (cfg->color) {
+      case 0: // Red
+        v = c->r;
+        break;
+      case 1: // Green
+        v = c->g;
+        break;
+      case 2: // Blue
+        v = c->b;
+      }
+
+        // gamma and white calibration correction in 1/256 PWM steps
+      const uint32_t *tab = cfg->gamma_tab->tab16 + (v >> 8);
+      uint32_t bv = tab[0] + (((tab[1] - tab[0]) * (v & 0xff)) >> 8) + *err;
+      *err = bv & 0xff;
+      bv >>= 8;
+      if (bv > ctrl->pwm_res)
+        bv = ctrl->pwm_res;
+
+      uint8_t *p = payload + cfg->req_channel * 2;
+      if (p[0] != (uint8_t) bv || p[1] != (uint8_t) (bv >> 8)) {
+        p[0] = bv;
+        p[1] = bv >> 8;
+        do_submit = 1;
+      }
+
+      ++err;
+      ++cfg;
+      --nch;
+    }
+
+    df10ch_publish_payload(this, ctrl, do_submit);
+    ctrl = ctrl->next;
+  }
+
+  if (this->sync_mode)
+    df10ch_submit_synced(this);
+  pthread_mutex_unlock(&this->lock);
+}
+
+
+static void df10ch_driver_init(output_driver_t *output_driver, const char *name) {
+  output_driver->open = df10ch_driver_open;
+  output_driver->configure = df10ch_driver_configure;
+  output_driver->close = df10ch_driver_close;
+  output_driver->output_colors = df10ch_driver_output_colors;
+  output_driver->output_colors16 = df10ch_driver_output_colors16;
+  output_driver->get_stats = df10ch_driver_get_stats;
+  output_driver->get_hist = df10ch_driver_get_hist;
+  output_driver->trace_async = 1;
+}
+
+
+const output_driver_module_t atmo_output_driver_module __attribute__((visibility("default"))) = {
+  OUTPUT_DRIVER_MODULE_VERSION,
+  sizeof(output_driver_t),
+  sizeof(df10ch_output_driver_t),
+  df10ch_driver_init
+};
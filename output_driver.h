@@ -22,32 +22,21 @@
 #include <termios.h>
 #include <regex.h>
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <dlfcn.h>
+
+#include "atmo_driver.h"
 
 
 /*
- * abstraction for output drivers
+ * return ';' separated options that follow the device or host within driver parameter
  */
-typedef struct output_driver_s output_driver_t;
-struct output_driver_s {
-    /* open device and configure for number of channels */
-  int (*open)(output_driver_t *this, atmo_parameters_t *param);
-
-    /* configure device for number of channels */
-  int (*configure)(output_driver_t *this, atmo_parameters_t *param);
-
-    /* close device */
-  int (*close)(output_driver_t *this);
-
-    /*
-     * send RGB color values to device
-     * last_colors is NULL when first initial color packet is send
-     * order for 'colors' is: top 1,2,3..., bottom 1,2,3..., left 1,2,3..., right 1,2,3..., center, top left, top right, bottom left, bottom right
-     */
-  void (*output_colors)(output_driver_t *this, rgb_color_t *new_colors, rgb_color_t *last_colors);
-
-    /* provide detailed error message here if open of device fails */
-  char errmsg[128];
-};
+static const char *get_driver_options(const char *driver_param) {
+  const char *s = index(driver_param, ';');
+  return (s) ? s + 1: NULL;
+}
 
 
 
@@ -55,24 +44,205 @@ struct output_driver_s {
  *    File output driver
  **********************************************************************************************************/
 
+#include "atmo_rec.h"
+
+#define FILE_REC_BUFFER_SIZE      (64 * 1024)
+#define FILE_REC_FLUSH_INTERVAL   1000      // Max. time records are buffered [ms]
+
 typedef struct {
   output_driver_t output_driver;
   atmo_parameters_t param;
   FILE *fd;
   int id;
+
+    /* binary recording */
+  int recfd;
+  uint8_t *rec_buf, *write_buf;       // Records are collected in rec_buf, writer thread writes write_buf
+  int rec_len;
+  pthread_t writer_thread;
+  pthread_mutex_t lock;
+  pthread_cond_t flush;
+  int writer_running;
+  int dropped_cnt;
+  int write_err_cnt;
 } file_output_driver_t;
 
 
+  /* Append record to buffer, record is dropped if buffer is full. Driver lock must be held. */
+static uint8_t *file_add_record(file_output_driver_t *this, int type, int size) {
+  size = (size + 7) & ~7;
+  if (this->rec_len + size > FILE_REC_BUFFER_SIZE) {
+    ++this->dropped_cnt;
+    pthread_cond_signal(&this->flush);
+    return NULL;
+  }
+  atmo_rec_record_t *rec = (atmo_rec_record_t *) (this->rec_buf + this->rec_len);
+  memset(rec, 0, size);
+  rec->type = type;
+  rec->size = size;
+  this->rec_len += size;
+  if (this->rec_len >= FILE_REC_BUFFER_SIZE / 2)
+    pthread_cond_signal(&this->flush);
+  return (uint8_t *) rec;
+}
+
+
+static void file_add_layout_record(file_output_driver_t *this) {
+  atmo_rec_layout_t *rec;
+
+  pthread_mutex_lock(&this->lock);
+  if ((rec = (atmo_rec_layout_t *) file_add_record(this, ATMO_REC_LAYOUT, sizeof(atmo_rec_layout_t)))) {
+    rec->layout[0] = this->param.top;
+    rec->layout[1] = this->param.bottom;
+    rec->layout[2] = this->param.left;
+    rec->layout[3] = this->param.right;
+    rec->layout[4] = this->param.center;
+    rec->layout[5] = this->param.top_left;
+    rec->layout[6] = this->param.top_right;
+    rec->layout[7] = this->param.bottom_left;
+    rec->layout[8] = this->param.bottom_right;
+  }
+  pthread_mutex_unlock(&this->lock);
+}
+
+
+static void *file_writer_loop(void *this_gen) {
+  file_output_driver_t *this = (file_output_driver_t *) this_gen;
+  struct timeval tvnow, tvdiff, tvtimeout;
+  struct timespec ts;
+  char buf[128];
+
+  pthread_mutex_lock(&this->lock);
+  for (;;) {
+    if (this->rec_len) {
+        /* swap buffers and write collected records */
+      uint8_t *wbuf = this->rec_buf;
+      int len = this->rec_len;
+      this->rec_buf = this->write_buf;
+      this->write_buf = wbuf;
+      this->rec_len = 0;
+      pthread_mutex_unlock(&this->lock);
+
+      int64_t tstart = atmo_hist_now();
+      while (len > 0) {
+        int n = write(this->recfd, wbuf, len);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0) {
+          strerror_r(errno, buf, sizeof(buf));
+          llprintf(LOG_1, "writing recording failed: %s\n", buf);
+          break;
+        }
+        wbuf += n;
+        len -= n;
+      }
+
+      pthread_mutex_lock(&this->lock);
+      if (len > 0)
+        ++this->write_err_cnt;
+      else
+        atmo_hist_add(&this->output_driver.write_hist, atmo_hist_now() - tstart);
+    }
+
+    if (!this->writer_running)
+      break;
+
+    gettimeofday(&tvnow, NULL);
+    tvdiff.tv_sec = FILE_REC_FLUSH_INTERVAL / 1000;
+    tvdiff.tv_usec = (FILE_REC_FLUSH_INTERVAL % 1000) * 1000;
+    timeradd(&tvnow, &tvdiff, &tvtimeout);
+    ts.tv_sec = tvtimeout.tv_sec;
+    ts.tv_nsec = tvtimeout.tv_usec * 1000;
+    pthread_cond_timedwait(&this->flush, &this->lock, &ts);
+  }
+  pthread_mutex_unlock(&this->lock);
+  return NULL;
+}
+
+
+static int file_open_recording(file_output_driver_t *this, const char *filename) {
+  atmo_rec_header_t hdr;
+  char buf[64];         /* error message must fit into errmsg */
+
+  int fd = open(filename, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    strerror_r(errno, this->output_driver.errmsg, sizeof(this->output_driver.errmsg));
+    return -1;
+  }
+
+    /* new file gets header, an existing recording is continued */
+  int n = pread(fd, &hdr, sizeof(hdr), 0);
+  if (n == 0) {
+    memset(&hdr, 0, sizeof(hdr));
+    strcpy(hdr.magic, ATMO_REC_MAGIC);
+    hdr.version = ATMO_REC_VERSION;
+    n = write(fd, &hdr, sizeof(hdr));
+  }
+  if (n != sizeof(hdr) || strcmp(hdr.magic, ATMO_REC_MAGIC) || hdr.version != ATMO_REC_VERSION) {
+    if (n < 0) {
+      strerror_r(errno, buf, sizeof(buf));
+      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "could not access recording: %s", buf);
+    } else
+      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "'%s' is not a recording of this version", filename);
+    close(fd);
+    return -1;
+  }
+
+  this->rec_buf = (uint8_t *) malloc(FILE_REC_BUFFER_SIZE);
+  this->write_buf = (uint8_t *) malloc(FILE_REC_BUFFER_SIZE);
+  if (!this->rec_buf || !this->write_buf) {
+    strcpy(this->output_driver.errmsg, "out of memory");
+    goto fail;
+  }
+
+  this->recfd = fd;
+  this->rec_len = 0;
+  this->dropped_cnt = 0;
+  this->write_err_cnt = 0;
+  this->writer_running = 1;
+  pthread_mutex_init(&this->lock, NULL);
+  pthread_cond_init(&this->flush, NULL);
+  int rc = pthread_create(&this->writer_thread, NULL, file_writer_loop, this);
+  if (rc) {
+    strerror_r(rc, buf, sizeof(buf));
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "can't create writer thread: %s", buf);
+    pthread_cond_destroy(&this->flush);
+    pthread_mutex_destroy(&this->lock);
+    goto fail;
+  }
+
+  file_add_layout_record(this);
+  return 0;
+
+fail:
+  free(this->rec_buf);
+  free(this->write_buf);
+  this->rec_buf = this->write_buf = NULL;
+  this->recfd = -1;
+  close(fd);
+  return -1;
+}
+
+
 static int file_driver_open(output_driver_t *this_gen, atmo_parameters_t *p) {
   file_output_driver_t *this = (file_output_driver_t *) this_gen;
+  char filename[256], *s;
 
   this->param = *p;
   this->id = 0;
+  this->fd = NULL;
+  this->recfd = -1;
+
+  snprintf(filename, sizeof(filename), "%s", this->param.driver_param);
+  if ((s = index(filename, ';')))
+    *s = 0;
+  if (!filename[0])
+    strcpy(filename, "xine_atmo_data.out");
 
-  if (this->param.driver_param && strlen(this->param.driver_param))
-    this->fd = fopen(this->param.driver_param, "a");
-  else
-    this->fd = fopen("xine_atmo_data.out", "a");
+  if (get_driver_option(get_driver_options(this->param.driver_param), "binary", NULL, 0))
+    return file_open_recording(this, filename);
+
+  this->fd = fopen(filename, "a");
 
   if (this->fd == NULL) {
     strerror_r(errno, this->output_driver.errmsg, sizeof(this->output_driver.errmsg));
@@ -84,6 +254,8 @@ static int file_driver_open(output_driver_t *this_gen, atmo_parameters_t *p) {
 static int file_driver_configure(output_driver_t *this_gen, atmo_parameters_t *p) {
   file_output_driver_t *this = (file_output_driver_t *) this_gen;
   this->param = *p;
+  if (this->recfd >= 0)
+    file_add_layout_record(this);
   return 0;
 }
 
@@ -94,16 +266,73 @@ static int file_driver_close(output_driver_t *this_gen) {
     fclose(this->fd);
     this->fd = NULL;
   }
+
+  if (this->recfd >= 0) {
+    pthread_mutex_lock(&this->lock);
+    this->writer_running = 0;
+    pthread_cond_signal(&this->flush);
+    pthread_mutex_unlock(&this->lock);
+    pthread_join(this->writer_thread, NULL);
+    pthread_cond_destroy(&this->flush);
+    pthread_mutex_destroy(&this->lock);
+    close(this->recfd);
+    this->recfd = -1;
+    free(this->rec_buf);
+    free(this->write_buf);
+    this->rec_buf = this->write_buf = NULL;
+
+    if (this->dropped_cnt || this->write_err_cnt) {
+      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%d frames dropped, %d write errors happen", this->dropped_cnt, this->write_err_cnt);
+      return -1;
+    }
+  }
   return 0;
 }
 
 
+static void file_record_colors(file_output_driver_t *this, rgb_color_t *colors) {
+  const atmo_parameters_t *p = &this->param;
+  const int n = p->top + p->bottom + p->left + p->right + p->center + p->top_left + p->top_right + p->bottom_left + p->bottom_right;
+  atmo_rec_frame_t *rec;
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  pthread_mutex_lock(&this->lock);
+  if ((rec = (atmo_rec_frame_t *) file_add_record(this, ATMO_REC_FRAME, sizeof(atmo_rec_frame_t) + n * sizeof(rgb_color_t)))) {
+    rec->timestamp = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    rec->vpts = this->output_driver.vpts;
+    memcpy(rec->colors, colors, n * sizeof(rgb_color_t));
+  }
+  pthread_mutex_unlock(&this->lock);
+}
+
+
+static void file_driver_get_hist(output_driver_t *this_gen, atmo_hist_t *write_hist, atmo_trace_t *trace) {
+  file_output_driver_t *this = (file_output_driver_t *) this_gen;
+
+    /* lock exists only while writer is running */
+  if (this->recfd < 0) {
+    *write_hist = this->output_driver.write_hist;
+    *trace = this->output_driver.trace;
+    return;
+  }
+
+  pthread_mutex_lock(&this->lock);
+  *write_hist = this->output_driver.write_hist;
+  *trace = this->output_driver.trace;
+  pthread_mutex_unlock(&this->lock);
+}
+
+
 static void file_driver_output_colors(output_driver_t *this_gen, rgb_color_t *colors, rgb_color_t *last_colors) {
   file_output_driver_t *this = (file_output_driver_t *) this_gen;
   FILE *fd = this->fd;
   struct timeval tvnow;
   int c;
 
+  if (this->recfd >= 0)
+    file_record_colors(this, colors);
+
   if (fd) {
     gettimeofday(&tvnow, NULL);
     fprintf(fd, "%d: %ld.%03ld ---\n", this->id++, tvnow.tv_sec, tvnow.tv_usec / 1000);
@@ -149,35 +378,212 @@ static void file_driver_output_colors(output_driver_t *this_gen, rgb_color_t *co
  *    Serial output driver
  *************************************************************************************************/
 
+#define LEDSTRIP_MAX_LEDS         1024
+#define SERIAL_MAX_MSG_SIZE       (6 + LEDSTRIP_MAX_LEDS * 3)
+#define SERIAL_DEFAULT_BAUD       38400
+#define SERIAL_WRITE_TIMEOUT      500     // Timeout for writing one message [ms]
+
 typedef struct {
   output_driver_t output_driver;
   atmo_parameters_t param;
   int devfd;
+  pthread_t writer_thread;
+  pthread_mutex_t lock;
+  pthread_cond_t msg_ready;
+  int writer_running;
+  uint8_t msg[SERIAL_MAX_MSG_SIZE];     // Latest message not yet taken by writer thread
+  int msg_len;                          // Length of latest message, zero if there is none
+  atmo_trace_tag_t msg_tag;             // Trace tag of latest message
+  int replaced_cnt;
+  int write_err_cnt;
 } serial_output_driver_t;
 
 
+static const struct {
+  int baud;
+  speed_t speed;
+} serial_baud_rates[] = {
+  { 9600, B9600 },
+  { 19200, B19200 },
+  { 38400, B38400 },
+  { 57600, B57600 },
+  { 115200, B115200 },
+  { 230400, B230400 },
+#ifdef B460800
+  { 460800, B460800 },
+#endif
+#ifdef B500000
+  { 500000, B500000 },
+#endif
+#ifdef B921600
+  { 921600, B921600 },
+#endif
+#ifdef B1000000
+  { 1000000, B1000000 },
+#endif
+#ifdef B1500000
+  { 1500000, B1500000 },
+#endif
+#ifdef B2000000
+  { 2000000, B2000000 },
+#endif
+#ifdef B3000000
+  { 3000000, B3000000 },
+#endif
+#ifdef B4000000
+  { 4000000, B4000000 },
+#endif
+};
+
+
+static int serial_write_msg(serial_output_driver_t *this, const uint8_t *msg, int len) {
+  struct pollfd pfd;
+  char buf[128];
+
+  pfd.fd = this->devfd;
+  pfd.events = POLLOUT;
+  while (len > 0) {
+    int n = write(this->devfd, msg, len);
+    if (n > 0) {
+      msg += n;
+      len -= n;
+    } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+      strerror_r(errno, buf, sizeof(buf));
+      llprintf(LOG_1, "writing to serial port failed: %s\n", buf);
+      return -1;
+    } else if (n < 0 && errno == EAGAIN && poll(&pfd, 1, SERIAL_WRITE_TIMEOUT) == 0) {
+      llprintf(LOG_1, "timeout while writing to serial port\n");
+      return -1;
+    }
+  }
+
+    /* Wait until message is on the wire so that the next message taken is the latest one */
+  tcdrain(this->devfd);
+  return 0;
+}
+
+
+static void *serial_writer_loop(void *this_gen) {
+  serial_output_driver_t *this = (serial_output_driver_t *) this_gen;
+  uint8_t msg[SERIAL_MAX_MSG_SIZE];
+
+  pthread_mutex_lock(&this->lock);
+    /* A message published before stop (e.g. lights off) is still send */
+  while (this->writer_running || this->msg_len) {
+    if (!this->msg_len) {
+      pthread_cond_wait(&this->msg_ready, &this->lock);
+      continue;
+    }
+    int len = this->msg_len;
+    memcpy(msg, this->msg, len);
+    atmo_trace_tag_t tag = this->msg_tag;
+    this->msg_len = 0;
+    pthread_mutex_unlock(&this->lock);
+
+    int64_t tstart = atmo_hist_now();
+    int rc = serial_write_msg(this, msg, len);
+    int64_t tend = atmo_hist_now();
+
+    pthread_mutex_lock(&this->lock);
+    if (rc)
+      ++this->write_err_cnt;
+    else {
+      atmo_hist_add(&this->output_driver.write_hist, tend - tstart);
+      atmo_trace_complete(&this->output_driver.trace, &tag, tend);
+    }
+  }
+  pthread_mutex_unlock(&this->lock);
+  return NULL;
+}
+
+
+  /* Publish message to writer thread. A message not yet taken is replaced. */
+static void serial_send_msg(serial_output_driver_t *this, const uint8_t *msg, int len) {
+  pthread_mutex_lock(&this->lock);
+  if (this->msg_len)
+    ++this->replaced_cnt;
+  memcpy(this->msg, msg, len);
+  this->msg_len = len;
+  this->msg_tag = this->output_driver.trace_tag;
+  pthread_cond_signal(&this->msg_ready);
+  pthread_mutex_unlock(&this->lock);
+}
+
+
+static void serial_driver_get_stats(output_driver_t *this_gen, output_driver_stats_t *stats) {
+  serial_output_driver_t *this = (serial_output_driver_t *) this_gen;
+
+  if (this->devfd < 0)
+    return;
+
+  pthread_mutex_lock(&this->lock);
+  stats->transfers = this->output_driver.write_hist.cnt;
+  stats->errors = this->write_err_cnt;
+  stats->replaced = this->replaced_cnt;
+  stats->queued = this->msg_len ? 1: 0;
+  pthread_mutex_unlock(&this->lock);
+}
+
+
+static void serial_driver_get_hist(output_driver_t *this_gen, atmo_hist_t *write_hist, atmo_trace_t *trace) {
+  serial_output_driver_t *this = (serial_output_driver_t *) this_gen;
+
+  if (this->devfd < 0) {
+    *write_hist = this->output_driver.write_hist;
+    *trace = this->output_driver.trace;
+    return;
+  }
+
+  pthread_mutex_lock(&this->lock);
+  *write_hist = this->output_driver.write_hist;
+  *trace = this->output_driver.trace;
+  pthread_mutex_unlock(&this->lock);
+}
+
+
 static int serial_driver_open(output_driver_t *this_gen, atmo_parameters_t *p) {
   serial_output_driver_t *this = (serial_output_driver_t *) this_gen;
-  char buf[256], buf1[64], *s;
+  char buf[256], buf1[64], param[256], *s;
   const char *devname = NULL;
   regex_t preg;
-  int rc;
+  int rc, i;
 
   this->param = *p;
   this->devfd = -1;
+  this->replaced_cnt = 0;
+  this->write_err_cnt = 0;
 
-  if (!this->param.driver_param || !strlen(this->param.driver_param))
+  if (!strlen(this->param.driver_param))
   {
     strcpy(this->output_driver.errmsg, "no device parameter");
     return -1;
   }
 
-  if (strncmp(this->param.driver_param, "usb:", 4) == 0) {
+    /* Device is followed by optional ';' separated options */
+  snprintf(param, sizeof(param), "%s", this->param.driver_param);
+  if ((s = index(param, ';')))
+    *s = 0;
+  const char *options = get_driver_options(this->param.driver_param);
+
+  int baud = get_driver_int_option(options, "baud", SERIAL_DEFAULT_BAUD);
+  speed_t bconst = B0;
+  for (i = 0; i < (int)(sizeof(serial_baud_rates) / sizeof(serial_baud_rates[0])); ++i) {
+    if (serial_baud_rates[i].baud == baud) {
+      bconst = serial_baud_rates[i].speed;
+      break;
+    }
+  }
+  if (bconst == B0) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "unsupported baud rate %d", baud);
+    return -1;
+  }
+
+  if (strncmp(param, "usb:", 4) == 0) {
       /* Lookup serial USB device name */
-    rc = regcomp(&preg, this->param.driver_param + 4, REG_EXTENDED | REG_NOSUB);
+    rc = regcomp(&preg, param + 4, REG_EXTENDED | REG_NOSUB);
     if (rc) {
       regerror(rc, &preg, buf, sizeof(buf));
-      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "illegal device identification pattern '%s': %s", this->param.driver_param + 4, buf);
+      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "illegal device identification pattern '%.40s': %.40s", param + 4, buf);
       regfree(&preg);
       return -1;
     }
@@ -185,7 +591,7 @@ static int serial_driver_open(output_driver_t *this_gen, atmo_parameters_t *p) {
     FILE *procfd = fopen("/proc/tty/driver/usbserial", "r");
     if (!procfd) {
       strerror_r(errno, buf, sizeof(buf));
-      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "could not open /proc/tty/driver/usbserial: %s", buf);
+      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "could not open /proc/tty/driver/usbserial: %.64s", buf);
       regfree(&preg);
       return -1;
     }
@@ -193,7 +599,7 @@ static int serial_driver_open(output_driver_t *this_gen, atmo_parameters_t *p) {
     while (fgets(buf, sizeof(buf), procfd)) {
       if (!regexec(&preg, buf, 0, NULL, 0) && (s = index(buf, ':'))) {
         *s = 0;
-        snprintf(buf1, sizeof(buf1), "/dev/ttyUSB%s", buf);
+        snprintf(buf1, sizeof(buf1), "/dev/ttyUSB%.16s", buf);
         devname = buf1;
         break;
       }
@@ -204,21 +610,20 @@ static int serial_driver_open(output_driver_t *this_gen, atmo_parameters_t *p) {
       strcpy(this->output_driver.errmsg, "could not find usb device in /proc/tty/driver/usbserial");
       return -1;
     }
-    llprintf(LOG_1, "USB tty device for '%s' is '%s'\n", this->param.driver_param + 4, devname);
+    llprintf(LOG_1, "USB tty device for '%s' is '%s'\n", param + 4, devname);
   } else {
-    devname = this->param.driver_param;
+    devname = param;
   }
 
     /* open serial port */
-  int devfd = open(devname, O_RDWR | O_NOCTTY);
+  int devfd = open(devname, O_RDWR | O_NOCTTY | O_NONBLOCK);
   if (devfd < 0) {
     strerror_r(errno, buf, sizeof(buf));
-    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "could not open serial port: %s", buf);
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "could not open serial port: %.64s", buf);
     return -1;
   }
 
     /* configure serial port */
-  const int bconst = B38400;
   struct termios tio;
   memset(&tio, 0, sizeof(tio));
   tio.c_cflag = (CS8 | CREAD | CLOCAL);
@@ -228,13 +633,30 @@ static int serial_driver_open(output_driver_t *this_gen, atmo_parameters_t *p) {
   cfsetospeed(&tio, bconst);
   if (tcsetattr(devfd, TCSANOW, &tio)) {
     strerror_r(errno, buf, sizeof(buf));
-    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "configuration of serial port failed: %s", buf);
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "configuration of serial port failed: %.64s", buf);
     close(devfd);
     return -1;
   }
   tcflush(devfd, TCIOFLUSH);
 
+    /* start writer thread */
   this->devfd = devfd;
+  this->msg_len = 0;
+  this->writer_running = 1;
+  pthread_mutex_init(&this->lock, NULL);
+  pthread_cond_init(&this->msg_ready, NULL);
+  rc = pthread_create(&this->writer_thread, NULL, serial_writer_loop, this);
+  if (rc) {
+    strerror_r(rc, buf, sizeof(buf));
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "can't create writer thread: %.64s", buf);
+    pthread_cond_destroy(&this->msg_ready);
+    pthread_mutex_destroy(&this->lock);
+    close(devfd);
+    this->devfd = -1;
+    return -1;
+  }
+
+  llprintf(LOG_1, "serial port '%s' opened with %d baud\n", devname, baud);
   return 0;
 }
 
@@ -249,9 +671,25 @@ static int serial_driver_configure(output_driver_t *this_gen, atmo_parameters_t
 static int serial_driver_close(output_driver_t *this_gen) {
   serial_output_driver_t *this = (serial_output_driver_t *) this_gen;
 
-  if (this->devfd >= 0) {
-    close(this->devfd);
-    this->devfd = -1;
+  if (this->devfd < 0)
+    return 0;
+
+  pthread_mutex_lock(&this->lock);
+  this->writer_running = 0;
+  pthread_cond_signal(&this->msg_ready);
+  pthread_mutex_unlock(&this->lock);
+  pthread_join(this->writer_thread, NULL);
+  pthread_cond_destroy(&this->msg_ready);
+  pthread_mutex_destroy(&this->lock);
+
+  close(this->devfd);
+  this->devfd = -1;
+
+  llprintf(LOG_1, "serial port closed: %d replaced messages\n", this->replaced_cnt);
+
+  if (this->write_err_cnt) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%d write errors happen", this->write_err_cnt);
+    return -1;
   }
   return 0;
 }
@@ -320,8 +758,7 @@ static void classic_driver_output_colors(output_driver_t *this_gen, rgb_color_t
   }
 
     /* send data to target */
-  if (write(this->devfd, msg, sizeof(msg)) > 0)
-    tcdrain(this->devfd); /* flush buffer */
+  serial_send_msg(this, msg, sizeof(msg));
 }
 
 
@@ -379,726 +816,897 @@ static void df4ch_driver_output_colors(output_driver_t *this_gen, rgb_color_t *c
   }
 
     /* send data to target */
-  if (write(this->devfd, msg, sizeof(msg)) > 0)
-    tcdrain(this->devfd); /* flush buffer */
+  serial_send_msg(this, msg, sizeof(msg));
 }
 
 
 
-/***************************************************************************************************
- *    DF10CH output driver for my own designed "next generation" 10ch RGB Controller
- ***************************************************************************************************/
+/********************************************************************************
+ * Adalight and TPM2 protocol for addressable LED strips driven by a
+ * microcontroller at the serial port
+ ********************************************************************************/
 
-#include <libusb.h>
-#include "df10ch_usb_proto.h"
+enum { LEDSTRIP_ADALIGHT, LEDSTRIP_TPM2 };
 
-#define DF10CH_USB_CFG_VENDOR_ID     0x16c0
-#define DF10CH_USB_CFG_PRODUCT_ID    0x05dc
-#define DF10CH_USB_CFG_VENDOR_NAME   "yak54@gmx.net"
-#define DF10CH_USB_CFG_PRODUCT       "DF10CH"
-#define DF10CH_USB_CFG_SERIAL        "AP"
-#define DF10CH_USB_DEFAULT_TIMEOUT   100
+typedef struct {
+  serial_output_driver_t serial;
+  int protocol;
+  int nleds;
+  int header_len;
+  uint8_t header[6];
+  uint16_t led_map[LEDSTRIP_MAX_LEDS];    // Index of color for each LED in strip order
+} ledstrip_output_driver_t;
 
-#define DF10CH_MAX_CHANNELS     30
-#define DF10CH_SIZE_CONFIG      (17 + DF10CH_MAX_CHANNELS * 6)
-#define DF10CH_CONFIG_VALID_ID  0xA0A1
 
-enum { DF10CH_AREA_TOP, DF10CH_AREA_BOTTOM, DF10CH_AREA_LEFT, DF10CH_AREA_RIGHT, DF10CH_AREA_CENTER, DF10CH_AREA_TOP_LEFT, DF10CH_AREA_TOP_RIGHT, DF10CH_AREA_BOTTOM_LEFT, DF10CH_AREA_BOTTOM_RIGHT };
+static int ledstrip_add_leds(ledstrip_output_driver_t *this, uint16_t *cw_map, int *nleds, int leds, int first, int areas, int reverse, const char *name) {
+  int i;
 
-typedef struct df10ch_gamma_tab_s {
-  struct df10ch_gamma_tab_s *next;
-  uint8_t gamma;
-  uint16_t white_cal;
-  uint16_t tab[256];
-} df10ch_gamma_tab_t;
+  if (!leds)
+    return 0;
+  if (!areas) {
+    snprintf(this->serial.output_driver.errmsg, sizeof(this->serial.output_driver.errmsg), "LEDs at %s border but no %s areas configured", name, name);
+    return -1;
+  }
+  if (*nleds + leds > LEDSTRIP_MAX_LEDS) {
+    snprintf(this->serial.output_driver.errmsg, sizeof(this->serial.output_driver.errmsg), "too many LEDs (maximum is %d)", LEDSTRIP_MAX_LEDS);
+    return -1;
+  }
 
-typedef struct {
-  int req_channel;          // Channel number in request
-  int area;                 // Source area
-  int area_num;             // Source area number
-  int color;                // Source color
-  df10ch_gamma_tab_t *gamma_tab;  // Corresponding gamma table
-} df10ch_channel_config_t;
-
-typedef struct df10ch_output_driver_s df10ch_output_driver_t;
-
-typedef struct df10ch_ctrl_s {
-  struct df10ch_ctrl_s *next;
-  df10ch_output_driver_t *driver;
-  libusb_device_handle *dev;
-  int idx_serial_number;        // USB string index of serial number
-  uint16_t config_version;      // Version number of configuration data
-  uint16_t pwm_res;             // PWM resolution
-  int num_req_channels;         // Number of channels in request
-  df10ch_channel_config_t *channel_config;      // List of channel configurations
-  char id[32];                  // ID of Controller
-  struct libusb_transfer *transfer; // Prepared set brightness request for asynchrony submitting
-  uint8_t *transfer_data;       // Data of set brightness request
-  int pending_submit;           // Is true if a asynchrony transfer is pending
-  int transfer_error;
-} df10ch_ctrl_t;
-
-struct df10ch_output_driver_s {
-  output_driver_t output_driver;
-  libusb_context *ctx;
-  atmo_parameters_t param;          // Global channel layout
-  df10ch_ctrl_t *ctrls;             // List of found controllers
-  df10ch_gamma_tab_t *gamma_tabs;   // List of calculated gamma tables
-  uint16_t config_version;          // (Maximum) Version number of configuration data
-  int max_transmit_latency;
-  int avg_transmit_latency;
-  int transfer_err_cnt;             // Number of transfer errors
-};
+    /* LEDs of a border are distributed evenly to its areas */
+  for (i = 0; i < leds; ++i) {
+    int a = (i * areas) / leds;
+    cw_map[(*nleds)++] = first + ((reverse) ? areas - 1 - a: a);
+  }
+  return 0;
+}
 
 
-static const char *df10ch_usb_errmsg(int rc) {
-  switch (rc) {
-  case LIBUSB_SUCCESS:
-    return ("Success (no error)");
-  case LIBUSB_ERROR_IO:
-    return ("Input/output error");
-  case LIBUSB_ERROR_INVALID_PARAM:
-    return ("Invalid parameter");
-  case LIBUSB_ERROR_ACCESS:
-    return ("Access denied (insufficient permissions)");
-  case LIBUSB_ERROR_NO_DEVICE:
-    return ("No such device (it may have been disconnected)");
-  case LIBUSB_ERROR_NOT_FOUND:
-    return ("Entity not found");
-  case LIBUSB_ERROR_BUSY:
-    return ("Resource busy");
-  case LIBUSB_ERROR_TIMEOUT:
-    return ("Operation timed out");
-  case LIBUSB_ERROR_OVERFLOW:
-    return ("Overflow");
-  case LIBUSB_ERROR_PIPE:
-    return ("Pipe error");
-  case LIBUSB_ERROR_INTERRUPTED:
-    return ("System call interrupted (perhaps due to signal)");
-  case LIBUSB_ERROR_NO_MEM:
-    return ("Insufficient memory");
-  case LIBUSB_ERROR_NOT_SUPPORTED:
-    return ("Operation not supported or unimplemented on this platform");
-  case LIBUSB_ERROR_OTHER:
-    return ("Other error");
-  }
-  return ("?");
-}
+static int ledstrip_build_map(ledstrip_output_driver_t *this, atmo_parameters_t *p) {
+  uint16_t cw_map[LEDSTRIP_MAX_LEDS];
+  const char *options = get_driver_options(p->driver_param);
+  int i, n = 0;
+
+  const int top = 0;
+  const int bottom = top + p->top;
+  const int left = bottom + p->bottom;
+  const int right = left + p->left;
+  const int center = right + p->right;
+  const int top_left = center + p->center;
+  const int top_right = top_left + p->top_left;
+  const int bottom_left = top_right + p->top_right;
+  const int bottom_right = bottom_left + p->bottom_left;
+
+    /* Build map clockwise starting at bottom left corner */
+  if (ledstrip_add_leds(this, cw_map, &n, get_driver_int_option(options, "leds_left", p->left), left, p->left, 1, "left") ||
+      ledstrip_add_leds(this, cw_map, &n, p->top_left, top_left, 1, 0, "top left") ||
+      ledstrip_add_leds(this, cw_map, &n, get_driver_int_option(options, "leds_top", p->top), top, p->top, 0, "top") ||
+      ledstrip_add_leds(this, cw_map, &n, p->top_right, top_right, 1, 0, "top right") ||
+      ledstrip_add_leds(this, cw_map, &n, get_driver_int_option(options, "leds_right", p->right), right, p->right, 0, "right") ||
+      ledstrip_add_leds(this, cw_map, &n, p->bottom_right, bottom_right, 1, 0, "bottom right") ||
+      ledstrip_add_leds(this, cw_map, &n, get_driver_int_option(options, "leds_bottom", p->bottom), bottom, p->bottom, 1, "bottom") ||
+      ledstrip_add_leds(this, cw_map, &n, p->bottom_left, bottom_left, 1, 0, "bottom left"))
+    return -1;
 
+  if (!n) {
+    strcpy(this->serial.output_driver.errmsg, "no LEDs configured");
+    return -1;
+  }
+
+    /* Rotate to first LED of strip and apply direction */
+  const int start = get_driver_int_option(options, "start", 0);
+  const int dir = get_driver_option(options, "ccw", NULL, 0) ? -1: 1;
+  for (i = 0; i < n; ++i)
+    this->led_map[i] = cw_map[(((start + dir * i) % n) + n) % n];
+  this->nleds = n;
+
+    /* Precompute frame header */
+  const int data_len = n * 3;
+  if (this->protocol == LEDSTRIP_ADALIGHT) {
+    this->header[0] = 'A';
+    this->header[1] = 'd';
+    this->header[2] = 'a';
+    this->header[3] = (n - 1) >> 8;
+    this->header[4] = (n - 1) & 0xFF;
+    this->header[5] = this->header[3] ^ this->header[4] ^ 0x55;
+    this->header_len = 6;
+  } else {
+    this->header[0] = 0xC9;   /* start byte */
+    this->header[1] = 0xDA;   /* data frame */
+    this->header[2] = data_len >> 8;
+    this->header[3] = data_len & 0xFF;
+    this->header_len = 4;
+  }
 
-static const char * df10ch_usb_transfer_errmsg(int s) {
-  switch (s) {
-  case LIBUSB_TRANSFER_COMPLETED:
-    return ("Transfer completed without error");
-  case LIBUSB_TRANSFER_ERROR:
-    return ("Transfer failed");
-  case LIBUSB_TRANSFER_TIMED_OUT:
-    return ("Transfer timed out");
-  case LIBUSB_TRANSFER_CANCELLED:
-    return ("Transfer was cancelled");
-  case LIBUSB_TRANSFER_STALL:
-    return ("Control request stalled");
-  case LIBUSB_TRANSFER_NO_DEVICE:
-    return ("Device was disconnected");
-  case LIBUSB_TRANSFER_OVERFLOW:
-    return ("Device sent more data than requested");
-  }
-  return ("?");
+  llprintf(LOG_1, "%s: %d LEDs\n", (this->protocol == LEDSTRIP_ADALIGHT) ? "Adalight": "TPM2", n);
+  return 0;
 }
 
 
-static void df10ch_comm_errmsg(int stat, char *rc) {
-  if (stat == 0)
-    strcpy(rc, "OK");
-  else
-    *rc = 0;
-  if (stat & (1<<COMM_ERR_OVERRUN))
-      strcat(rc, " OVERRUN");
-  if (stat & (1<<COMM_ERR_FRAME))
-      strcat(rc, " FRAME");
-  if (stat & (1<<COMM_ERR_TIMEOUT))
-      strcat(rc, " TIMEOUT");
-  if (stat & (1<<COMM_ERR_START))
-      strcat(rc, " START");
-  if (stat & (1<<COMM_ERR_OVERFLOW))
-      strcat(rc, " OVERFLOW");
-  if (stat & (1<<COMM_ERR_CRC))
-      strcat(rc, " CRC");
-  if (stat & (1<<COMM_ERR_DUPLICATE))
-      strcat(rc, " DUPLICATE");
-  if (stat & (1<<COMM_ERR_DEBUG))
-      strcat(rc, " DEBUG");
+static int ledstrip_driver_open(output_driver_t *this_gen, atmo_parameters_t *p) {
+  ledstrip_output_driver_t *this = (ledstrip_output_driver_t *) this_gen;
+
+  if (serial_driver_open(this_gen, p))
+    return -1;
+  if (ledstrip_build_map(this, p)) {
+    serial_driver_close(this_gen);
+    return -1;
+  }
+  return 0;
 }
 
 
-static int df10ch_control_in_transfer(df10ch_ctrl_t *ctrl, uint8_t req, uint16_t val, uint16_t index, unsigned int timeout, uint8_t *buf, uint16_t buflen)
-{
-      // Use a return buffer always so that the controller is able to send a USB reply status
-      // This is special for VUSB at controller side
-    unsigned char rcbuf[1];
-    int len = buflen;
-    if (!len)
-    {
-        buf = rcbuf;
-        len = 1;
-    }
+static int ledstrip_driver_configure(output_driver_t *this_gen, atmo_parameters_t *p) {
+  ledstrip_output_driver_t *this = (ledstrip_output_driver_t *) this_gen;
 
-      // Because VUSB at controller sends ACK reply before CRC check of received data we have to retry sending request our self if data is corrupted
-    int n = 0, retrys = 0;
-    while (retrys < 3)
-    {
-        n = libusb_control_transfer(ctrl->dev, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE, req, val, index, buf, len, timeout);
-        if (n != LIBUSB_ERROR_INTERRUPTED)
-        {
-            if (n < 0)
-              ++ctrl->driver->transfer_err_cnt;
-            if (n >= 0 || n != LIBUSB_ERROR_PIPE)
-                break;
-            ++retrys;
-            llprintf(LOG_1, "%s: sending USB control transfer message %d failed (pipe error): retry %d\n", ctrl->id, req, retrys);
-        }
-    }
+  if (ledstrip_build_map(this, p))
+    return -1;
+  return serial_driver_configure(this_gen, p);
+}
 
-    if (n < 0)
-    {
-        llprintf(LOG_1, "%s: sending USB control transfer message %d failed: %s\n", ctrl->id, req, df10ch_usb_errmsg(n));
-        return -1;
-    }
 
-    if (n != buflen)
-    {
-        llprintf(LOG_1, "%s: sending USB control transfer message %d failed: read %d bytes but expected %d bytes\n", ctrl->id, req, n, buflen);
-        return -1;
-    }
+static void ledstrip_driver_output_colors(output_driver_t *this_gen, rgb_color_t *colors, rgb_color_t *last_colors) {
+  ledstrip_output_driver_t *this = (ledstrip_output_driver_t *) this_gen;
+  uint8_t msg[SERIAL_MAX_MSG_SIZE];
 
-    return 0;
+  if (this->serial.devfd < 0)
+    return;
+
+  memcpy(msg, this->header, this->header_len);
+  uint8_t *d = msg + this->header_len;
+  const uint16_t *map = this->led_map;
+  const uint16_t *end = map + this->nleds;
+  while (map < end) {
+    const rgb_color_t *c = colors + *map++;
+    d[0] = c->r;
+    d[1] = c->g;
+    d[2] = c->b;
+    d += 3;
+  }
+  if (this->protocol == LEDSTRIP_TPM2)
+    *d++ = 0x36;      /* end byte */
+
+    /* send data to target */
+  serial_send_msg(&this->serial, msg, d - msg);
 }
 
 
-static void df10ch_dispose(df10ch_output_driver_t *this) {
-  df10ch_ctrl_t *ctrl = this->ctrls;
-  while (ctrl) {
-    libusb_free_transfer(ctrl->transfer);
-    libusb_release_interface(ctrl->dev, 0);
-    libusb_close(ctrl->dev);
 
-    df10ch_ctrl_t *next = ctrl->next;
-    free(ctrl->transfer_data);
-    free(ctrl->channel_config);
-    free(ctrl);
-    ctrl = next;
+/***************************************************************************************************
+ *    E1.31 (sACN) and Art-Net output driver for DMX over UDP
+ ***************************************************************************************************/
+
+#define NET_MAX_UNIVERSES       16
+#define NET_MAX_SLOTS           512
+#define NET_MAX_PACKET          (126 + NET_MAX_SLOTS)
+#define NET_DEFAULT_KEEPALIVE   1000      // Resend interval of unchanged universes [ms]
+#define NET_RETRY_DELAY         10        // Delay before universes not accepted by the socket are sent again [ms]
+#define E131_PORT               5568
+#define ARTNET_PORT             6454
+
+enum { NET_E131, NET_ARTNET };
+
+typedef struct {
+  uint8_t packet[NET_MAX_PACKET];   // Prebuilt packet, only sequence number and data change
+  int len;
+  int data_offset;                  // Offset of DMX data within packet
+  int first, ncolors;               // Range of colors send with this universe
+  int changed;
+  uint8_t seq;
+  struct sockaddr_in addr;
+  struct timeval last_send;
+} net_universe_t;
+
+typedef struct {
+  output_driver_t output_driver;
+  atmo_parameters_t param;
+  int protocol;
+  int sockfd;
+  int keepalive;
+  int nuniverses;
+  net_universe_t universes[NET_MAX_UNIVERSES];
+  struct sockaddr_in dest;          // Destination, zero address for E1.31 multicast
+  uint8_t cid[16];
+  pthread_t sender_thread;
+  pthread_mutex_t lock;
+  pthread_cond_t data_ready;
+  int sender_running;
+  int data_changed;
+  int full_update;                  // Next colors are copied to all universes
+  atmo_trace_tag_t data_tag;        // Trace tag of changed data not yet send
+  int send_err_cnt;
+} net_output_driver_t;
+
+
+static void net_put16(uint8_t *p, int v) {
+  p[0] = v >> 8;
+  p[1] = v & 0xFF;
+}
+
+
+static void net_build_packet(net_output_driver_t *this, net_universe_t *u, int universe, int slots, int priority) {
+  uint8_t *p = u->packet;
+
+  memset(p, 0, sizeof(u->packet));
+  if (this->protocol == NET_E131) {
+    const int len = 126 + slots;
+      /* root layer */
+    net_put16(p + 0, 0x0010);               /* preamble size */
+    memcpy(p + 4, "ASC-E1.17", 9);          /* ACN packet identifier */
+    net_put16(p + 16, 0x7000 | (len - 16)); /* flags and length */
+    p[21] = 0x04;                           /* VECTOR_ROOT_E131_DATA */
+    memcpy(p + 22, this->cid, 16);
+      /* framing layer */
+    net_put16(p + 38, 0x7000 | (len - 38));
+    p[43] = 0x02;                           /* VECTOR_E131_DATA_PACKET */
+    strcpy((char *)(p + 44), "xine atmo post plugin");
+    p[108] = priority;
+    net_put16(p + 113, universe);
+      /* DMP layer */
+    net_put16(p + 115, 0x7000 | (len - 115));
+    p[117] = 0x02;                          /* VECTOR_DMP_SET_PROPERTY */
+    p[118] = 0xA1;                          /* address and data type */
+    net_put16(p + 121, 1);                  /* address increment */
+    net_put16(p + 123, slots + 1);          /* property value count including start code */
+    u->data_offset = 126;
+    u->len = len;
+  } else {
+    slots += slots & 1;                     /* length must be even */
+    memcpy(p, "Art-Net", 8);
+    p[8] = 0x00;                            /* OpDmx, little endian */
+    p[9] = 0x50;
+    p[11] = 14;                             /* protocol version */
+    p[14] = universe & 0xFF;                /* SubUni */
+    p[15] = (universe >> 8) & 0x7F;         /* Net */
+    net_put16(p + 16, slots);
+    u->data_offset = 18;
+    u->len = 18 + slots;
   }
+}
 
-  if (this->ctx)
-    libusb_exit(this->ctx);
 
-  df10ch_gamma_tab_t *gt = this->gamma_tabs;
-  while (gt) {
-    df10ch_gamma_tab_t *next = gt->next;
-    free(gt);
-    gt = next;
+static int net_build_universes(net_output_driver_t *this, atmo_parameters_t *p) {
+  const char *options = get_driver_options(p->driver_param);
+  int i;
+
+  int slots = get_driver_int_option(options, "channels", 510);
+  if (slots < 3 || slots > NET_MAX_SLOTS) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "illegal number of channels per universe %d", slots);
+    return -1;
   }
+  const int colors_per_universe = slots / 3;
+  const int n = p->top + p->bottom + p->left + p->right + p->center + p->top_left + p->top_right + p->bottom_left + p->bottom_right;
+  const int nuniverses = (n + colors_per_universe - 1) / colors_per_universe;
+  if (nuniverses > NET_MAX_UNIVERSES) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "too many universes required (maximum is %d)", NET_MAX_UNIVERSES);
+    return -1;
+  }
+  const int start = get_driver_int_option(options, "universe", (this->protocol == NET_E131) ? 1: 0);
+  const int min_universe = (this->protocol == NET_E131) ? 1: 0;
+  const int max_universe = (this->protocol == NET_E131) ? 63999: 32767;
+  if (start < min_universe || start + nuniverses - 1 > max_universe) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "universes %d - %d out of range %d - %d", start, start + nuniverses - 1, min_universe, max_universe);
+    return -1;
+  }
+  const int priority = get_driver_int_option(options, "priority", 100);
+  if (priority < 0 || priority > 200) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "illegal priority %d", priority);
+    return -1;
+  }
+
+  pthread_mutex_lock(&this->lock);
+  for (i = 0; i < nuniverses; ++i) {
+    net_universe_t *u = &this->universes[i];
+    const int universe = start + i;
+    u->first = i * colors_per_universe;
+    u->ncolors = (n - u->first < colors_per_universe) ? n - u->first: colors_per_universe;
+    net_build_packet(this, u, universe, u->ncolors * 3, priority);
+    u->seq = 0;
+    u->changed = 0;
+    gettimeofday(&u->last_send, NULL);
+    u->addr = this->dest;
+    if (!u->addr.sin_addr.s_addr)
+      u->addr.sin_addr.s_addr = htonl(0xEFFF0000 | (universe & 0xFFFF)); /* multicast 239.255.x.y */
+  }
+  this->nuniverses = nuniverses;
+  this->full_update = 1;
+  pthread_mutex_unlock(&this->lock);
 
-  this->ctrls = NULL;
-  this->ctx = NULL;
-  this->gamma_tabs = NULL;
+  llprintf(LOG_1, "%s: %d universes starting at %d\n", (this->protocol == NET_E131) ? "E1.31": "Art-Net", nuniverses, start);
+  return 0;
 }
 
 
-static void df10ch_wait_for_replys(df10ch_output_driver_t *this) {
-    // wait for end of all pending transfers
-  struct timeval timeout;
-  timeout.tv_sec = 0;
-  timeout.tv_usec = (DF10CH_USB_DEFAULT_TIMEOUT + 50) * 1000;
-  df10ch_ctrl_t *ctrl = this->ctrls;
-  while (ctrl) {
-    if (ctrl->pending_submit) {
-      int rc = libusb_handle_events_timeout(this->ctx, &timeout);
-      if (rc && rc != LIBUSB_ERROR_INTERRUPTED) {
-        llprintf(LOG_1, "handling USB events failed: %s\n", df10ch_usb_errmsg(rc));
-        break;
-      }
+  /* Send changed universes and universes due for keep alive with one system call. Driver lock must be held.
+   * Universes not sent stay changed or due and are sent with the next call. Returns number of universes not sent. */
+static int net_send_universes(net_output_driver_t *this, struct timeval *now) {
+  struct mmsghdr msgs[NET_MAX_UNIVERSES];
+  struct iovec iovs[NET_MAX_UNIVERSES];
+  net_universe_t *sent_universes[NET_MAX_UNIVERSES];
+  struct timeval tvdiff;
+  int i, n = 0, sent = 0;
+
+  for (i = 0; i < this->nuniverses; ++i) {
+    net_universe_t *u = &this->universes[i];
+    if (!u->changed) {
+      if (!this->keepalive)
+        continue;
+      timersub(now, &u->last_send, &tvdiff);
+      if (tvdiff.tv_sec * 1000 + tvdiff.tv_usec / 1000 < this->keepalive)
+        continue;
     }
-    else
-      ctrl = ctrl->next;
+
+    if (this->protocol == NET_E131)
+      u->packet[111] = u->seq++;
+    else {
+      if (!++u->seq)     /* zero disables sequence checking */
+        u->seq = 1;
+      u->packet[12] = u->seq;
+    }
+
+    sent_universes[n] = u;
+    iovs[n].iov_base = u->packet;
+    iovs[n].iov_len = u->len;
+    memset(&msgs[n], 0, sizeof(msgs[n]));
+    msgs[n].msg_hdr.msg_name = &u->addr;
+    msgs[n].msg_hdr.msg_namelen = sizeof(u->addr);
+    msgs[n].msg_hdr.msg_iov = &iovs[n];
+    msgs[n].msg_hdr.msg_iovlen = 1;
+    ++n;
   }
+  this->data_changed = 0;
+
+  if (n) {
+    int64_t tstart = atmo_hist_now();
+    int rc = 0;
+
+      /* retry remaining packets after a short count until nothing more is accepted */
+    while (sent < n && (rc = sendmmsg(this->sockfd, msgs + sent, n - sent, MSG_DONTWAIT)) > 0)
+      sent += rc;
+    for (i = 0; i < sent; ++i) {
+      sent_universes[i]->changed = 0;
+      sent_universes[i]->last_send = *now;
+    }
 
-  ctrl = this->ctrls;
-  while (ctrl) {
-    if (ctrl->transfer_error) {
-      char reply_errmsg[128], request_errmsg[128];
-      uint8_t data[1];
-      if (df10ch_control_in_transfer(ctrl, REQ_GET_REPLY_ERR_STATUS, 0, 0, DF10CH_USB_DEFAULT_TIMEOUT, data, 1))
-        strcpy(reply_errmsg, "N/A");
-      else
-        df10ch_comm_errmsg(data[0], reply_errmsg);
-      if (df10ch_control_in_transfer(ctrl, PWM_REQ_GET_REQUEST_ERR_STATUS, 0, 0, DF10CH_USB_DEFAULT_TIMEOUT, data, 1))
-        strcpy(request_errmsg, "N/A");
-      else
-        df10ch_comm_errmsg(data[0], request_errmsg);
-      llprintf(LOG_1, "%s: comm error USB: %s, PWM: %s\n", ctrl->id, reply_errmsg, request_errmsg);
+    if (sent < n) {
+      char buf[128];
+      if (!this->send_err_cnt++) {
+        strerror_r((rc < 0) ? errno: EAGAIN, buf, sizeof(buf));
+        llprintf(LOG_1, "sending UDP packets failed: %s\n", buf);
+      }
+    } else {
+      int64_t tend = atmo_hist_now();
+      atmo_hist_add(&this->output_driver.write_hist, tend - tstart);
+      atmo_trace_complete(&this->output_driver.trace, &this->data_tag, tend);
     }
-    ctrl = ctrl->next;
   }
+  this->data_tag.analyzed = 0;
+  return n - sent;
 }
 
 
-static void df10ch_reply_cb(struct libusb_transfer *transfer) {
-  df10ch_ctrl_t *ctrl = (df10ch_ctrl_t *) transfer->user_data;
-  ctrl->pending_submit = 0;
-  if (transfer->status != LIBUSB_TRANSFER_COMPLETED && transfer->status != LIBUSB_TRANSFER_CANCELLED) {
-    ++ctrl->driver->transfer_err_cnt;
-    ctrl->transfer_error = 1;
-    llprintf(LOG_1, "%s: submitting USB control transfer message failed: %s\n", ctrl->id, df10ch_usb_transfer_errmsg(transfer->status));
+static void *net_sender_loop(void *this_gen) {
+  net_output_driver_t *this = (net_output_driver_t *) this_gen;
+  struct timeval tvnow, tvdiff, tvtimeout;
+  struct timespec ts;
+  int unsent, delay;
+
+  pthread_mutex_lock(&this->lock);
+  for (;;) {
+    gettimeofday(&tvnow, NULL);
+    unsent = net_send_universes(this, &tvnow);
+
+      /* Data published before stop (e.g. lights off) is still send */
+    if (!this->sender_running)
+      break;
+    if (this->data_changed)
+      continue;
+
+    delay = unsent ? NET_RETRY_DELAY: this->keepalive;
+    if (delay) {
+      tvdiff.tv_sec = delay / 1000;
+      tvdiff.tv_usec = (delay % 1000) * 1000;
+      timeradd(&tvnow, &tvdiff, &tvtimeout);
+      ts.tv_sec = tvtimeout.tv_sec;
+      ts.tv_nsec = tvtimeout.tv_usec * 1000;
+      pthread_cond_timedwait(&this->data_ready, &this->lock, &ts);
+    }
+    else
+      pthread_cond_wait(&this->data_ready, &this->lock);
   }
+  pthread_mutex_unlock(&this->lock);
+  return NULL;
 }
 
 
-static int df10ch_driver_open(output_driver_t *this_gen, atmo_parameters_t *param) {
-  df10ch_output_driver_t *this = (df10ch_output_driver_t *) this_gen;
+static int net_driver_open(output_driver_t *this_gen, atmo_parameters_t *p) {
+  net_output_driver_t *this = (net_output_driver_t *) this_gen;
+  char buf[256], *s;
+  int i, rc;
 
-  this->config_version = 0;
-  this->max_transmit_latency = 0;
-  this->avg_transmit_latency = 0;
-  this->transfer_err_cnt = 0;
+  this->param = *p;
+  this->sockfd = -1;
+  this->nuniverses = 0;
+  this->send_err_cnt = 0;
+
+  const char *options = get_driver_options(this->param.driver_param);
+  this->keepalive = get_driver_int_option(options, "keepalive", NET_DEFAULT_KEEPALIVE);
+
+    /* Destination host is optional: E1.31 uses multicast, Art-Net broadcast */
+  struct sockaddr_in *addr = &this->dest;
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons((this->protocol == NET_E131) ? E131_PORT: ARTNET_PORT);
+  if (this->protocol == NET_ARTNET)
+    addr->sin_addr.s_addr = htonl(INADDR_BROADCAST);
+
+  snprintf(buf, sizeof(buf), "%s", this->param.driver_param);
+  if ((s = index(buf, ';')))
+    *s = 0;
+  if (buf[0]) {
+    if ((s = index(buf, ':'))) {
+      *s++ = 0;
+      addr->sin_port = htons(atoi(s));
+    }
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    rc = getaddrinfo(buf, NULL, &hints, &res);
+    if (rc) {
+      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "could not resolve host '%.64s': %s", buf, gai_strerror(rc));
+      return -1;
+    }
+    addr->sin_addr = ((struct sockaddr_in *) res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+  }
 
-  if (libusb_init(&this->ctx) < 0) {
-    strcpy(this->output_driver.errmsg, "can't initialize USB library");
+  int sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (sockfd < 0) {
+    strerror_r(errno, buf, sizeof(buf));
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "could not create UDP socket: %.64s", buf);
     return -1;
   }
+  int on = 1;
+  setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+
+    /* Component identifier of this source */
+  unsigned int seed = (unsigned int) time(NULL) ^ (unsigned int) getpid();
+  for (i = 0; i < 16; ++i)
+    this->cid[i] = rand_r(&seed) >> 7;
+
+  this->sockfd = sockfd;
+  pthread_mutex_init(&this->lock, NULL);
+  pthread_cond_init(&this->data_ready, NULL);
+
+  if (net_build_universes(this, p))
+    goto fail;
+
+  this->sender_running = 1;
+  rc = pthread_create(&this->sender_thread, NULL, net_sender_loop, this);
+  if (rc) {
+    strerror_r(rc, buf, sizeof(buf));
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "can't create sender thread: %.64s", buf);
+    goto fail;
+  }
+  return 0;
+
+fail:
+  pthread_cond_destroy(&this->data_ready);
+  pthread_mutex_destroy(&this->lock);
+  close(sockfd);
+  this->sockfd = -1;
+  return -1;
+}
+
+
+static int net_driver_configure(output_driver_t *this_gen, atmo_parameters_t *p) {
+  net_output_driver_t *this = (net_output_driver_t *) this_gen;
 
-  libusb_device **list = NULL;
-  size_t cnt = libusb_get_device_list(this->ctx, &list);
-  if (cnt < 0) {
-    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "getting list of USB devices failed: %s", df10ch_usb_errmsg(cnt));
-    df10ch_dispose(this);
+  if (net_build_universes(this, p))
     return -1;
-  }
+  this->param = *p;
+  return 0;
+}
 
-    // Note: Because controller uses obdev's free USB product/vendor ID's we have to do special lookup for finding
-    // the controllers. See file "USB-IDs-for-free.txt" of VUSB distribution.
-  int rc;
-  size_t i;
-  for (i = 0; i < cnt; i++) {
-    libusb_device *d = list[i];
-    struct libusb_device_descriptor desc;
-
-    int busnum = libusb_get_bus_number(d);
-    int devnum = libusb_get_device_address(d);
-
-    rc = libusb_get_device_descriptor(d, &desc);
-    if (rc < 0)
-      llprintf(LOG_1, "USB[%d,%d]: getting USB device descriptor failed: %s\n", busnum, devnum, df10ch_usb_errmsg(rc));
-    else if (desc.idVendor == DF10CH_USB_CFG_VENDOR_ID && desc.idProduct == DF10CH_USB_CFG_PRODUCT_ID) {
-      libusb_device_handle *hdl = NULL;
-      rc = libusb_open(d, &hdl);
-      if (rc < 0)
-        llprintf(LOG_1, "USB[%d,%d]: open of USB device failed: %s\n", busnum, devnum, df10ch_usb_errmsg(rc));
-      else {
-        unsigned char buf[256];
-        rc = libusb_get_string_descriptor_ascii(hdl, desc.iManufacturer, buf, sizeof(buf));
-        if (rc < 0)
-          llprintf(LOG_1, "USB[%d,%d]: getting USB manufacturer string failed: %s\n", busnum, devnum, df10ch_usb_errmsg(rc));
-        else if (rc == sizeof(DF10CH_USB_CFG_VENDOR_NAME) - 1 && !memcmp(buf, DF10CH_USB_CFG_VENDOR_NAME, rc)) {
-          rc = libusb_get_string_descriptor_ascii(hdl, desc.iProduct, buf, sizeof(buf));
-          if (rc < 0)
-            llprintf(LOG_1, "USB[%d,%d]: getting USB product string failed: %s\n", busnum, devnum, df10ch_usb_errmsg(rc));
-          else if (rc == sizeof(DF10CH_USB_CFG_PRODUCT) - 1 && !memcmp(buf, DF10CH_USB_CFG_PRODUCT, rc)) {
-            char id[32];
-            snprintf(id, sizeof(id), "DF10CH[%d,%d]", busnum, devnum);
-            rc = libusb_set_configuration(hdl, 1);
-            if (rc < 0)
-              llprintf(LOG_1, "%s: setting USB configuration failed: %s\n", id, df10ch_usb_errmsg(rc));
-            else {
-              rc = libusb_claim_interface(hdl, 0);
-              if (rc < 0)
-                llprintf(LOG_1, "%s: claiming USB interface failed: %s\n", id, df10ch_usb_errmsg(rc));
-              else {
-                df10ch_ctrl_t *ctrl = (df10ch_ctrl_t *) calloc(1, sizeof(df10ch_ctrl_t));
-                ctrl->next = this->ctrls;
-                this->ctrls = ctrl;
-                ctrl->driver = this;
-                ctrl->dev = hdl;
-                ctrl->idx_serial_number = desc.iSerialNumber;
-                strcpy(ctrl->id, id);
-                llprintf(LOG_1, "%s: device opened\n", id);
-                continue;
-              }
-            }
-          }
-        }
-        libusb_close(hdl);
-      }
-    }
-  }
 
-  libusb_free_device_list(list, 1);
+static int net_driver_close(output_driver_t *this_gen) {
+  net_output_driver_t *this = (net_output_driver_t *) this_gen;
+
+  if (this->sockfd < 0)
+    return 0;
+
+  pthread_mutex_lock(&this->lock);
+  this->sender_running = 0;
+  pthread_cond_signal(&this->data_ready);
+  pthread_mutex_unlock(&this->lock);
+  pthread_join(this->sender_thread, NULL);
+  pthread_cond_destroy(&this->data_ready);
+  pthread_mutex_destroy(&this->lock);
+
+  close(this->sockfd);
+  this->sockfd = -1;
 
-  if (!this->ctrls) {
-    strcpy(this->output_driver.errmsg, "USB: no DF10CH devices found!");
-    df10ch_dispose(this);
+  if (this->send_err_cnt) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%d send errors happen", this->send_err_cnt);
     return -1;
   }
+  return 0;
+}
 
-    // Ignore channel configuration defined by plugin parameters
-  param->top = 0;
-  param->bottom = 0;
-  param->left = 0;
-  param->right = 0;
-  param->center = 0;
-  param->top_left = 0;
-  param->top_right = 0;
-  param->bottom_left = 0;
-  param->bottom_right = 0;
-
-    // Read controller configuration
-  df10ch_ctrl_t *ctrl = this->ctrls;
-  while (ctrl) {
-    uint8_t data[256];
-
-      // Check that USB controller is running application firmware and not bootloader
-    rc = libusb_get_string_descriptor_ascii(ctrl->dev, ctrl->idx_serial_number, data, sizeof(data) - 1);
-    if (rc < 0) {
-      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: getting USB serial number string failed: %s", ctrl->id, df10ch_usb_errmsg(rc));
-      df10ch_dispose(this);
-      return -1;
-    }
-    if (rc != sizeof(DF10CH_USB_CFG_SERIAL) - 1 || memcmp(data, DF10CH_USB_CFG_SERIAL, rc)) {
-      data[rc] = 0;
-      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: application firmware of USB controller is not running! Current mode is: %s", ctrl->id, data);
-      df10ch_dispose(this);
-      return -1;
-    }
 
-      // check that PWM controller is running application firmware and not bootloader
-    if (df10ch_control_in_transfer(ctrl, PWM_REQ_GET_VERSION, 0, 0, DF10CH_USB_DEFAULT_TIMEOUT, data, 2)) {
-      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: reading PWM controller version fails!", ctrl->id);
-      df10ch_dispose(this);
-      return -1;
-    }
-    if (data[0] != PWM_VERS_APPL) {
-      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: application firmware of PWM controller is not running! Current mode is: %d", ctrl->id, data[0]);
-      df10ch_dispose(this);
-      return -1;
-    }
+static void net_driver_output_colors(output_driver_t *this_gen, rgb_color_t *colors, rgb_color_t *last_colors) {
+  net_output_driver_t *this = (net_output_driver_t *) this_gen;
+  int i;
 
-      // read eeprom configuration data
-    uint8_t eedata[DF10CH_SIZE_CONFIG];
-    if (df10ch_control_in_transfer(ctrl, REQ_READ_EE_DATA, 0, 1, DF10CH_USB_DEFAULT_TIMEOUT, eedata, sizeof(eedata))) {
-      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: reading eeprom config data fails!", ctrl->id);
-      df10ch_dispose(this);
-      return -1;
-    }
+  if (this->sockfd < 0)
+    return;
 
-      // check that configuration data is valid
-    int cfg_valid_id = eedata[0] + (eedata[1] << 8);
-    if (cfg_valid_id != DF10CH_CONFIG_VALID_ID) {
-      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: controller is not configured! Please run setup program first", ctrl->id);
-      df10ch_dispose(this);
-      return -1;
+  pthread_mutex_lock(&this->lock);
+  for (i = 0; i < this->nuniverses; ++i) {
+    net_universe_t *u = &this->universes[i];
+    const rgb_color_t *c = colors + u->first;
+    if (last_colors && !this->full_update && !memcmp(c, last_colors + u->first, u->ncolors * sizeof(rgb_color_t)))
+      continue;
+
+    const rgb_color_t *end = c + u->ncolors;
+    uint8_t *d = u->packet + u->data_offset;
+    while (c < end) {
+      d[0] = c->r;
+      d[1] = c->g;
+      d[2] = c->b;
+      d += 3;
+      ++c;
     }
+    u->changed = 1;
+    this->data_changed = 1;
+  }
+  this->full_update = 0;
+  if (this->data_changed) {
+    this->data_tag = this->output_driver.trace_tag;
+    pthread_cond_signal(&this->data_ready);
+  }
+  pthread_mutex_unlock(&this->lock);
+}
 
-    ctrl->config_version = eedata[2] + (eedata[3] << 8);
-    if (ctrl->config_version > this->config_version)
-      this->config_version = ctrl->config_version;
-
-      // Determine channel layout
-    int n;
-    n = eedata[4 + DF10CH_AREA_TOP];
-    if (n > param->top)
-      param->top = n;
-    n = eedata[4 + DF10CH_AREA_BOTTOM];
-    if (n > param->bottom)
-      param->bottom = n;
-    n = eedata[4 + DF10CH_AREA_LEFT];
-    if (n > param->left)
-      param->left = n;
-    n = eedata[4 + DF10CH_AREA_RIGHT];
-    if (n > param->right)
-      param->right = n;
-    n = eedata[4 + DF10CH_AREA_CENTER];
-    if (n > param->center)
-      param->center = n;
-    n = eedata[4 + DF10CH_AREA_TOP_LEFT];
-    if (n > param->top_left)
-      param->top_left = n;
-    n = eedata[4 + DF10CH_AREA_TOP_RIGHT];
-    if (n > param->top_right)
-      param->top_right = n;
-    n = eedata[4 + DF10CH_AREA_BOTTOM_LEFT];
-    if (n > param->bottom_left)
-      param->bottom_left = n;
-    n = eedata[4 + DF10CH_AREA_BOTTOM_RIGHT];
-    if (n > param->bottom_right)
-      param->bottom_right = n;
-
-    ctrl->num_req_channels = eedata[13];
-    if (ctrl->num_req_channels > DF10CH_MAX_CHANNELS)
-      ctrl->num_req_channels = DF10CH_MAX_CHANNELS;
-
-    if (ctrl->config_version > 1) {
-      int eei = 14 + ctrl->num_req_channels * 6;
-      param->overscan = eedata[eei];
-      param->analyze_size = eedata[eei + 1];
-      param->edge_weighting = eedata[eei + 2];
-    }
 
-      // Read PWM resolution
-    if (df10ch_control_in_transfer(ctrl, PWM_REQ_GET_MAX_PWM, 0, 0, DF10CH_USB_DEFAULT_TIMEOUT, data, 2)) {
-      snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%s: reading PWM resolution data fails!", ctrl->id);
-      df10ch_dispose(this);
-      return -1;
-    }
-    ctrl->pwm_res = data[0] + (data[1] << 8);
-
-      // Build channel configuration list
-    int nch = ctrl->num_req_channels;
-    df10ch_channel_config_t *ccfg = (df10ch_channel_config_t *) calloc(nch, sizeof(df10ch_channel_config_t));
-    ctrl->channel_config = ccfg;
-    int eei = 14;
-    while (nch) {
-      ccfg->req_channel = eedata[eei];
-      ccfg->area = eedata[eei + 1] >> 2;
-      ccfg->color = eedata[eei + 1] & 0x03;
-      ccfg->area_num = eedata[eei + 2];
-      uint8_t gamma = eedata[eei + 3];
-      if (gamma < 10)
-        gamma = 10;
-      uint16_t white_cal = eedata[eei + 4] + (eedata[eei + 5] << 8);
-
-        // Lookup gamma table for gamma and white calibration value
-      df10ch_gamma_tab_t *gt = this->gamma_tabs;
-      while (gt && gamma != gt->gamma && white_cal != gt->white_cal)
-        gt = gt->next;
-      if (!gt) {
-          // Calculate new gamma table
-        gt = (df10ch_gamma_tab_t *) calloc(1, sizeof(df10ch_gamma_tab_t));
-        gt->next = this->gamma_tabs;
-        this->gamma_tabs = gt;
-        gt->gamma = gamma;
-        gt->white_cal = white_cal;
-        const double dgamma = gamma / 10.0;
-        const double dwhite_cal = white_cal;
-        int v;
-        for (v = 0; v < 256; ++v) {
-          gt->tab[v] = (uint16_t) (lround(pow(((double)v / 255.0), dgamma) * dwhite_cal));
-          if (gt->tab[v] > ctrl->pwm_res)
-            gt->tab[v] = ctrl->pwm_res;
-        }
-      }
-      ccfg->gamma_tab = gt;
+static void net_driver_get_stats(output_driver_t *this_gen, output_driver_stats_t *stats) {
+  net_output_driver_t *this = (net_output_driver_t *) this_gen;
 
-      ++ccfg;
-      eei += 6;
-      --nch;
-    }
+  if (this->sockfd < 0)
+    return;
 
-      // Prepare USB request for sending brightness values
-    ctrl->transfer_data = calloc(1, (LIBUSB_CONTROL_SETUP_SIZE + ctrl->num_req_channels * 2));
-    libusb_fill_control_setup(ctrl->transfer_data, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE, PWM_REQ_SET_BRIGHTNESS, 0, 0, ctrl->num_req_channels * 2);
-    ctrl->transfer = libusb_alloc_transfer(0);
-    libusb_fill_control_transfer(ctrl->transfer, ctrl->dev, ctrl->transfer_data, df10ch_reply_cb, ctrl, DF10CH_USB_DEFAULT_TIMEOUT);
-    ctrl->pending_submit = 0;
+  pthread_mutex_lock(&this->lock);
+  stats->transfers = this->output_driver.write_hist.cnt;
+  stats->errors = this->send_err_cnt;
+  stats->queued = this->data_changed;
+  pthread_mutex_unlock(&this->lock);
+}
+
+
+static void net_driver_get_hist(output_driver_t *this_gen, atmo_hist_t *write_hist, atmo_trace_t *trace) {
+  net_output_driver_t *this = (net_output_driver_t *) this_gen;
 
-    ctrl = ctrl->next;
+  if (this->sockfd < 0) {
+    *write_hist = this->output_driver.write_hist;
+    *trace = this->output_driver.trace;
+    return;
   }
 
-  this->param = *param;
-  return 0;
+  pthread_mutex_lock(&this->lock);
+  *write_hist = this->output_driver.write_hist;
+  *trace = this->output_driver.trace;
+  pthread_mutex_unlock(&this->lock);
 }
 
 
-static int df10ch_driver_configure(output_driver_t *this_gen, atmo_parameters_t *param) {
-  df10ch_output_driver_t *this = (df10ch_output_driver_t *) this_gen;
 
-    // Ignore channel configuration defined by plugin parameters
-  param->top = this->param.top;
-  param->bottom = this->param.bottom;
-  param->left = this->param.left;
-  param->right = this->param.right;
-  param->center = this->param.center;
-  param->top_left = this->param.top_left;
-  param->top_right = this->param.top_right;
-  param->bottom_left = this->param.bottom_left;
-  param->bottom_right = this->param.bottom_right;
+/***************************************************************************************************
+ *    Shared memory output driver for local consumers
+ ***************************************************************************************************/
 
-  if (this->config_version > 1) {
-    param->overscan = this->param.overscan;
-    param->analyze_size = this->param.analyze_size;
-    param->edge_weighting = this->param.edge_weighting;
-  }
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "atmo_shm.h"
 
-  this->param = *param;
-  return 0;
-}
+#define SHM_DEFAULT_SLOTS       16
+#define SHM_MAX_SLOTS           1024
 
+typedef struct {
+  output_driver_t output_driver;
+  atmo_parameters_t param;
+  char name[64];
+  atmo_shm_header_t *shm;
+  size_t shm_size;
+  uint64_t frame;
+} shm_output_driver_t;
+
+
+static int shm_driver_open(output_driver_t *this_gen, atmo_parameters_t *p) {
+  shm_output_driver_t *this = (shm_output_driver_t *) this_gen;
+  char buf[64];
 
-static int df10ch_driver_close(output_driver_t *this_gen) {
-  df10ch_output_driver_t *this = (df10ch_output_driver_t *) this_gen;
+  this->param = *p;
+  this->shm = NULL;
+  this->frame = 0;
 
-    // Cancel all pending requests
-  df10ch_ctrl_t *ctrl = this->ctrls;
-  while (ctrl) {
-    if (ctrl->pending_submit)
-      libusb_cancel_transfer(ctrl->transfer);
-    ctrl = ctrl->next;
+  const char *s = index(this->param.driver_param, ';');
+  size_t len = s ? (size_t) (s - this->param.driver_param): strlen(this->param.driver_param);
+  if (len >= sizeof(this->name)) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "shared memory name is longer than %d characters", (int) sizeof(this->name) - 1);
+    return -1;
+  }
+  memcpy(this->name, this->param.driver_param, len);
+  this->name[len] = 0;
+  if (!this->name[0])
+    strcpy(this->name, ATMO_SHM_DEFAULT_NAME);
+
+  int nslots = get_driver_int_option(get_driver_options(this->param.driver_param), "frames", SHM_DEFAULT_SLOTS);
+  if (nslots < 2) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "illegal number of frames %d", nslots);
+    return -1;
+  }
+  if (nslots > SHM_MAX_SLOTS) {
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "too many frames %d (maximum is %d)", nslots, SHM_MAX_SLOTS);
+    return -1;
   }
 
-  df10ch_wait_for_replys(this);
-  df10ch_dispose(this);
+  int fd = shm_open(this->name, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    strerror_r(errno, buf, sizeof(buf));
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "could not open shared memory '%s': %.30s", this->name, buf);
+    return -1;
+  }
 
-  llprintf(LOG_1, "average transmit latency: %d [us]\n", this->avg_transmit_latency);
+  size_t size = sizeof(atmo_shm_header_t) + nslots * sizeof(atmo_shm_frame_t);
+  struct stat st;
+  if (fstat(fd, &st)) {
+    strerror_r(errno, buf, sizeof(buf));
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "could not get size of shared memory: %s", buf);
+    close(fd);
+    return -1;
+  }
 
-  if (this->transfer_err_cnt) {
-    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "%d transfer errors happen", this->transfer_err_cnt);
+    /* Never shrink the segment, readers still mapping a larger one from a previous session would get SIGBUS */
+  if ((size_t) st.st_size > size)
+    size = st.st_size;
+  else if (ftruncate(fd, size)) {
+    strerror_r(errno, buf, sizeof(buf));
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "could not set size of shared memory: %s", buf);
+    close(fd);
     return -1;
   }
+
+  atmo_shm_header_t *shm = (atmo_shm_header_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED) {
+    strerror_r(errno, buf, sizeof(buf));
+    snprintf(this->output_driver.errmsg, sizeof(this->output_driver.errmsg), "could not map shared memory: %s", buf);
+    return -1;
+  }
+
+    /* Readers that are still attached from a previous session see the new write count */
+  __atomic_store_n(&shm->magic, 0, __ATOMIC_RELEASE);
+  shm->version = ATMO_SHM_VERSION;
+  shm->nslots = nslots;
+  shm->slot_size = sizeof(atmo_shm_frame_t);
+  memset(shm->slots, 0, nslots * sizeof(atmo_shm_frame_t));
+  __atomic_store_n(&shm->write_count, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&shm->writer_active, 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&shm->magic, ATMO_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  this->shm = shm;
+  this->shm_size = size;
+  llprintf(LOG_1, "shared memory '%s' opened with %d frames\n", this->name, nslots);
   return 0;
 }
 
 
-static void df10ch_driver_output_colors(output_driver_t *this_gen, rgb_color_t *colors, rgb_color_t *last_colors) {
-  df10ch_output_driver_t *this = (df10ch_output_driver_t *) this_gen;
-  struct timeval tvnow, tvlast, tvdiff;
-
-    // Build area mapping table
-  rgb_color_t *area_map[9];
-  rgb_color_t *c = colors;
-  area_map[DF10CH_AREA_TOP] = c;
-  c += this->param.top;
-  area_map[DF10CH_AREA_BOTTOM] = c;
-  c += this->param.bottom;
-  area_map[DF10CH_AREA_LEFT] = c;
-  c += this->param.left;
-  area_map[DF10CH_AREA_RIGHT] = c;
-  c += this->param.right;
-  area_map[DF10CH_AREA_CENTER] = c;
-  c += this->param.center;
-  area_map[DF10CH_AREA_TOP_LEFT] = c;
-  c += this->param.top_left;
-  area_map[DF10CH_AREA_TOP_RIGHT] = c;
-  c += this->param.top_right;
-  area_map[DF10CH_AREA_BOTTOM_LEFT] = c;
-  c += this->param.bottom_left;
-  area_map[DF10CH_AREA_BOTTOM_RIGHT] = c;
-
-  if (LOG_1)
-    gettimeofday(&tvlast, NULL);
-
-    // Generate transfer messages and send it to controllers
-  df10ch_ctrl_t *ctrl = this->ctrls;
-  while (ctrl) {
-      // Generate payload data (brightness values)
-    int do_submit = 0;
-    uint8_t *payload = ctrl->transfer_data + LIBUSB_CONTROL_SETUP_SIZE;
-    df10ch_channel_config_t *cfg = ctrl->channel_config;
-    int nch = ctrl->num_req_channels;
-    while (nch) {
-      c = area_map[cfg->area] + cfg->area_num;
-      rgb_color_t *lc = last_colors ? last_colors + (c - colors): NULL;
-      int v = 0;
-      switch (cfg->color) {
-      case 0: // Red
-        v = c->r;
-        if (!lc || v != lc->r)
-          do_submit = 1;
-        break;
-      case 1: // Green
-        v = c->g;
-        if (!lc || v != lc->g)
-          do_submit = 1;
-        break;
-      case 2: // Blue
-        v = c->b;
-        if (!lc || v != lc->b)
-          do_submit = 1;
-      }
+static int shm_driver_configure(output_driver_t *this_gen, atmo_parameters_t *p) {
+  shm_output_driver_t *this = (shm_output_driver_t *) this_gen;
+  this->param = *p;
+  return 0;
+}
 
-        // gamma and white calibration correction
-      uint16_t bv = cfg->gamma_tab->tab[v];
-      payload[cfg->req_channel * 2] = bv;
-      payload[cfg->req_channel * 2 + 1] = bv >> 8;
 
-      ++cfg;
-      --nch;
-    }
+static void shm_wake_readers(atmo_shm_header_t *shm) {
+  __atomic_add_fetch(&shm->futex, 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &shm->futex, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
 
-      // initiate asynchron data transfer to controller
-    if (do_submit) {
-      ctrl->transfer_error = 0;
-      int rc = libusb_submit_transfer(ctrl->transfer);
-      if (rc)
-        llprintf(LOG_1, "%s: submitting USB control transfer message failed: %s\n", ctrl->id, df10ch_usb_errmsg(rc));
-      else
-        ctrl->pending_submit = 1;
-    }
 
-    ctrl = ctrl->next;
+static int shm_driver_close(output_driver_t *this_gen) {
+  shm_output_driver_t *this = (shm_output_driver_t *) this_gen;
+
+  if (this->shm) {
+    __atomic_store_n(&this->shm->writer_active, 0, __ATOMIC_RELEASE);
+    shm_wake_readers(this->shm);
+    munmap(this->shm, this->shm_size);
+    this->shm = NULL;
   }
+  return 0;
+}
 
-    // wait for end of all pending transfers
-  df10ch_wait_for_replys(this);
 
-  if (LOG_1) {
-    gettimeofday(&tvnow, NULL);
-    timersub(&tvnow, &tvlast, &tvdiff);
-    this->avg_transmit_latency = (this->avg_transmit_latency + tvdiff.tv_usec) / 2;
-    if (tvdiff.tv_usec > this->max_transmit_latency) {
-      this->max_transmit_latency = tvdiff.tv_usec;
-      llprintf(LOG_1, "max/avg transmit latency: %d/%d [us]\n", this->max_transmit_latency, this->avg_transmit_latency);
-    }
-  }
+static void shm_driver_output_colors(output_driver_t *this_gen, rgb_color_t *colors, rgb_color_t *last_colors) {
+  shm_output_driver_t *this = (shm_output_driver_t *) this_gen;
+  atmo_shm_header_t *shm = this->shm;
+  struct timespec ts;
+
+  if (!shm)
+    return;
+
+  const atmo_parameters_t *p = &this->param;
+  int n = p->top + p->bottom + p->left + p->right + p->center + p->top_left + p->top_right + p->bottom_left + p->bottom_right;
+  if (n > ATMO_SHM_MAX_CHANNELS)
+    n = ATMO_SHM_MAX_CHANNELS;
+
+  const uint64_t count = shm->write_count;
+  atmo_shm_frame_t *f = &shm->slots[count % shm->nslots];
+
+    /* Mark slot as being written */
+  __atomic_store_n(&f->seq, f->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  f->frame = this->frame++;
+  f->timestamp = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  f->vpts = this->output_driver.vpts;
+  f->nchannels = n;
+  f->layout[0] = p->top;
+  f->layout[1] = p->bottom;
+  f->layout[2] = p->left;
+  f->layout[3] = p->right;
+  f->layout[4] = p->center;
+  f->layout[5] = p->top_left;
+  f->layout[6] = p->top_right;
+  f->layout[7] = p->bottom_left;
+  f->layout[8] = p->bottom_right;
+  memcpy(f->colors, colors, n * sizeof(rgb_color_t));
+
+  __atomic_store_n(&f->seq, f->seq + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&shm->write_count, count + 1, __ATOMIC_RELEASE);
+  shm_wake_readers(shm);
 }
 
 
+
 /*
  * Output Drivers
  */
 
-#define NUM_DRIVERS     4       /* Number of registered drivers */
-static char *driver_enum[NUM_DRIVERS+1] = { "none", "file", "classic", "df4ch", "df10ch" };
+#define NUM_DRIVERS     9       /* Number of registered drivers */
+static char *driver_enum[NUM_DRIVERS+1] = { "none", "file", "classic", "df4ch", "df10ch", "adalight", "tpm2", "e131", "artnet", "shm" };
 
 typedef union {
   output_driver_t output_driver;
   file_output_driver_t file_output_driver;
   serial_output_driver_t serial_output_driver;
-  df10ch_output_driver_t df10ch_output_driver;
+  ledstrip_output_driver_t ledstrip_output_driver;
+  net_output_driver_t net_output_driver;
+  shm_output_driver_t shm_output_driver;
+  uint8_t module_output_driver[OUTPUT_DRIVER_MODULE_MAX_SIZE];
 } output_drivers_t;
 
 
+#ifndef ATMO_DRIVER_DIR
+#define ATMO_DRIVER_DIR         "."
+#endif
+
+static pthread_mutex_t output_driver_modules_lock = PTHREAD_MUTEX_INITIALIZER;
+static const output_driver_module_t *output_driver_modules[NUM_DRIVERS+1];   /* loaded modules by driver */
+
+/*
+ * Load module 'atmo_<driver name>.so' from directory given by environment variable ATMO_DRIVER_DIR or the
+ * build time default. A loaded module stays loaded and is only opened once.
+ */
+static const output_driver_module_t *load_output_driver_module(int driver, char *errmsg, size_t size) {
+  const char *dir = getenv("ATMO_DRIVER_DIR");
+  const output_driver_module_t *module;
+  char path[1024];
+  void *handle;
+
+  pthread_mutex_lock(&output_driver_modules_lock);
+  if (!(module = output_driver_modules[driver])) {
+    snprintf(path, sizeof(path), "%s/atmo_%s.so", (dir && dir[0]) ? dir: ATMO_DRIVER_DIR, driver_enum[driver]);
+    if (!(handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)))
+      snprintf(errmsg, size, "can't load output driver module: %s", dlerror());
+    else {
+      module = (const output_driver_module_t *) dlsym(handle, OUTPUT_DRIVER_MODULE_SYMBOL);
+      if (!module || module->version != OUTPUT_DRIVER_MODULE_VERSION || module->api_size != sizeof(output_driver_t) ||
+          module->size > OUTPUT_DRIVER_MODULE_MAX_SIZE) {
+        snprintf(errmsg, size, "'atmo_%s.so' is not a compatible output driver module", driver_enum[driver]);
+        dlclose(handle);
+        module = NULL;
+      } else
+        output_driver_modules[driver] = module;
+    }
+  }
+  pthread_mutex_unlock(&output_driver_modules_lock);
+  return module;
+}
+
+
+  /* driver of a module that could not be loaded, the error message is set at load time */
+static int unavailable_driver_open(output_driver_t *this, atmo_parameters_t *p) {
+  return -1;
+}
+
+
 static output_driver_t * get_output_driver(output_drivers_t *output_drivers, int driver) {
   memset(output_drivers, 0, sizeof(output_drivers_t));
 
   output_driver_t *output_driver = &output_drivers->output_driver;
+  const output_driver_module_t *module;
   switch(driver) {
   case 1: /* file */
     output_driver->open = file_driver_open;
     output_driver->configure = file_driver_configure;
     output_driver->close = file_driver_close;
     output_driver->output_colors = file_driver_output_colors;
+    output_driver->get_hist = file_driver_get_hist;
+    output_drivers->file_output_driver.recfd = -1;
     break;
   case 2: /* classic */
     output_driver->open = serial_driver_open;
     output_driver->configure = serial_driver_configure;
     output_driver->close = serial_driver_close;
     output_driver->output_colors = classic_driver_output_colors;
+    output_driver->get_stats = serial_driver_get_stats;
+    output_driver->get_hist = serial_driver_get_hist;
     output_drivers->serial_output_driver.devfd = -1;
+    output_driver->trace_async = 1;
     break;
   case 3: /* df4ch */
     output_driver->open = serial_driver_open;
     output_driver->configure = serial_driver_configure;
     output_driver->close = serial_driver_close;
     output_driver->output_colors = df4ch_driver_output_colors;
+    output_driver->get_stats = serial_driver_get_stats;
+    output_driver->get_hist = serial_driver_get_hist;
     output_drivers->serial_output_driver.devfd = -1;
+    output_driver->trace_async = 1;
     break;
-  case 4: /* df10ch */
-    output_driver->open = df10ch_driver_open;
-    output_driver->configure = df10ch_driver_configure;
-    output_driver->close = df10ch_driver_close;
-    output_driver->output_colors = df10ch_driver_output_colors;
+  case 5: /* adalight */
+  case 6: /* tpm2 */
+    output_driver->open = ledstrip_driver_open;
+    output_driver->configure = ledstrip_driver_configure;
+    output_driver->close = serial_driver_close;
+    output_driver->output_colors = ledstrip_driver_output_colors;
+    output_driver->get_stats = serial_driver_get_stats;
+    output_driver->get_hist = serial_driver_get_hist;
+    output_drivers->ledstrip_output_driver.serial.devfd = -1;
+    output_driver->trace_async = 1;
+    output_drivers->ledstrip_output_driver.protocol = (driver == 5) ? LEDSTRIP_ADALIGHT: LEDSTRIP_TPM2;
+    break;
+  case 7: /* e131 */
+  case 8: /* artnet */
+    output_driver->open = net_driver_open;
+    output_driver->configure = net_driver_configure;
+    output_driver->close = net_driver_close;
+    output_driver->output_colors = net_driver_output_colors;
+    output_driver->get_stats = net_driver_get_stats;
+    output_driver->get_hist = net_driver_get_hist;
+    output_drivers->net_output_driver.sockfd = -1;
+    output_driver->trace_async = 1;
+    output_drivers->net_output_driver.protocol = (driver == 7) ? NET_E131: NET_ARTNET;
+    break;
+  case 9: /* shm */
+    output_driver->open = shm_driver_open;
+    output_driver->configure = shm_driver_configure;
+    output_driver->close = shm_driver_close;
+    output_driver->output_colors = shm_driver_output_colors;
     break;
-  default: /* none */
+  case 0: /* none */
     output_driver = NULL;
+    break;
+  default: /* drivers without builtin implementation (df10ch) are provided by a module */
+    if (driver < 0 || driver > NUM_DRIVERS)
+      output_driver = NULL;
+    else if ((module = load_output_driver_module(driver, output_driver->errmsg, sizeof(output_driver->errmsg))))
+      module->init(output_driver, driver_enum[driver]);
+    else
+      output_driver->open = unavailable_driver_open;
   }
   return output_driver;
 }
@@ -24,15 +24,28 @@
  *
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <math.h>
 #include <errno.h>
+#include <sched.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <xine/post.h>
 
@@ -48,73 +61,24 @@ extern long int lround(double); /* Missing in math.h? */
 #define LOG_2           0
 
 
-#define OUTPUT_RATE             20      /* rate of output loop [ms] */
 #define GRAB_TIMEOUT            100     /* max. time waiting for next grab image [ms] */
 #define THREAD_RESPONSE_TIMEOUT 500000  /* timeout for thread state change [us] */
-
-#define NUM_AREAS               9       /* Number of different areas (top, bottom ...) */
-
-/* accuracy of color calculation */
-#define h_MAX   255
-#define s_MAX   255
-#define v_MAX   255
-
-/* macros */
-#define MIN(X, Y)  ((X) < (Y) ? (X) : (Y))
-#define MAX(X, Y)  ((X) > (Y) ? (X) : (Y))
-#define POS_DIV(a, b)  ( (a)/(b) + ( ((a)%(b) >= (b)/2 ) ? 1 : 0) )
-
-
-typedef struct { uint8_t h, s, v; } hsv_color_t;
-typedef struct { uint8_t r, g, b; } rgb_color_t;
-typedef struct { uint64_t r, g, b; } rgb_color_sum_t;
-
-/*
- * Plugin
- */
-
-typedef struct {
-  int enabled;
-  int driver;
-  char driver_param[256];
-  int top;
-  int bottom;
-  int left;
-  int right;
-  int center;
-  int top_left;
-  int top_right;
-  int bottom_left;
-  int bottom_right;
-  int analyze_rate;
-  int analyze_size;
-  int overscan;
-  int darkness_limit;
-  int edge_weighting;
-  int hue_win_size;
-  int sat_win_size;
-  int hue_threshold;
-  int uniform_brightness;
-  int brightness;
-  int filter;
-  int filter_smoothness;
-  int filter_length;
-  int filter_threshold;
-  int filter_delay;
-  int wc_red;
-  int wc_green;
-  int wc_blue;
-  int gamma;
-  int start_delay;
-} atmo_parameters_t;
+#define CLOSE_OVERHEAD_LIMIT    1000    /* expected max. time for suspending threads on video port close [us] */
 
 
+#include "atmo_types.h"
 #include "output_driver.h"
+#include "atmo_analyze.h"
+#include "atmo_capture.h"
+#include "atmo_cache.h"
 
 
 #define NUM_FILTERS     2
 static char *filter_enum[NUM_FILTERS+1] = { "off", "percentage", "combined" };
 
+#define NUM_SCHED_POLICIES     2
+static char *sched_enum[NUM_SCHED_POLICIES+1] = { "normal", "fifo", "rr" };
+
 
 START_PARAM_DESCR(atmo_parameters_t)
 PARAM_ITEM(POST_PARAM_TYPE_BOOL, enabled, NULL, 0, 1, 0,
@@ -123,6 +87,8 @@ PARAM_ITEM(POST_PARAM_TYPE_INT, driver, driver_enum, 0, NUM_DRIVERS, 0,
   "output driver")
 PARAM_ITEM(POST_PARAM_TYPE_CHAR, driver_param, NULL, 0, 0, 0,
   "parameters for output driver")
+PARAM_ITEM(POST_PARAM_TYPE_CHAR, sinks, NULL, 0, 0, 0,
+  "additional output drivers")
 PARAM_ITEM(POST_PARAM_TYPE_INT, top, NULL, 0, 25, 0,
   "number of areas at top border")
 PARAM_ITEM(POST_PARAM_TYPE_INT, bottom, NULL, 0, 25, 0,
@@ -171,6 +137,8 @@ PARAM_ITEM(POST_PARAM_TYPE_INT, filter_threshold, NULL, 1, 100, 0,
   "filter threshold [%]")
 PARAM_ITEM(POST_PARAM_TYPE_INT, filter_delay, NULL, 0, 1000, 0,
   "delay for output send to controller [ms]")
+PARAM_ITEM(POST_PARAM_TYPE_INT, output_rate, NULL, 50, 200, 0,
+  "output rate [Hz], above 50 Hz colors are dithered by drivers with 16 bit color support")
 PARAM_ITEM(POST_PARAM_TYPE_INT, wc_red, NULL, 0, 255, 0,
   "white calibration correction factor of red color channel")
 PARAM_ITEM(POST_PARAM_TYPE_INT, wc_green, NULL, 0, 255, 0,
@@ -181,15 +149,119 @@ PARAM_ITEM(POST_PARAM_TYPE_INT, gamma, NULL, 0, 30, 0,
   "gamma correction factor")
 PARAM_ITEM(POST_PARAM_TYPE_INT, start_delay, NULL, 0, 5000, 0,
   "delay after stream start before first output is send [ms]")
+PARAM_ITEM(POST_PARAM_TYPE_INT, output_sched, sched_enum, 0, NUM_SCHED_POLICIES, 0,
+  "scheduling policy of output thread")
+PARAM_ITEM(POST_PARAM_TYPE_INT, output_priority, NULL, 1, 99, 0,
+  "real time priority of output thread")
+PARAM_ITEM(POST_PARAM_TYPE_INT, grab_cpus, NULL, 0, 0x7fffffff, 0,
+  "cpu affinity mask of grab thread (0 = all cpus)")
+PARAM_ITEM(POST_PARAM_TYPE_INT, output_cpus, NULL, 0, 0x7fffffff, 0,
+  "cpu affinity mask of output thread (0 = all cpus)")
+PARAM_ITEM(POST_PARAM_TYPE_BOOL, lock_memory, NULL, 0, 1, 0,
+  "lock color and filter buffers into memory")
+PARAM_ITEM(POST_PARAM_TYPE_CHAR, capture_file, NULL, 0, 0, 0,
+  "capture analyze images into file (debug)")
+PARAM_ITEM(POST_PARAM_TYPE_INT, stats_interval, NULL, 0, 3600, 0,
+  "interval of run time statistics report [s] (0 = off)")
+PARAM_ITEM(POST_PARAM_TYPE_BOOL, stats_report, NULL, 0, 1, 0,
+  "report run time statistics now")
+PARAM_ITEM(POST_PARAM_TYPE_CHAR, stats_socket, NULL, 0, 0, 0,
+  "unix domain socket serving run time statistics as JSON")
+PARAM_ITEM(POST_PARAM_TYPE_BOOL, color_cache, NULL, 0, 1, 0,
+  "cache analyzed colors of local media files in a sidecar file")
 END_PARAM_DESCR(atmo_param_descr)
 
 
+/*
+ * Additional output driver (sink) with its own layout that is driven by its own thread.
+ * The output thread only queues the latest colors, a colors set not yet taken is replaced.
+ */
+#define MAX_SINK_CHANNELS       128
+
+typedef struct atmo_sink_s atmo_sink_t;
+struct atmo_sink_s {
+  atmo_sink_t *next;
+  xine_t *xine;
+  int id;
+  atmo_parameters_t parm;           /* driver, driver parameter and layout of sink */
+  int own_layout;                   /* layout is given by sink parameter, otherwise layout follows main layout */
+  output_drivers_t output_drivers;
+  output_driver_t *output_driver;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t colors_ready;
+  int running;
+  int queued;                       /* queued colors not yet taken by sink thread */
+  int queued_layout[NUM_AREAS];
+  rgb_color_t queued_colors[MAX_SINK_CHANNELS];
+  int64_t queued_vpts;
+  int replaced_cnt;
+};
+
+
 typedef struct {
   post_class_t post_class;
   xine_t *xine;
 } atmo_post_class_t;
 
 enum { TS_STOP, TS_RUNNING, TS_SUSPEND, TS_SUSPENDED, TS_TICKET_REVOKED };
+static const char *thread_state_names[] = { "stopped", "running", "suspend", "suspended", "ticket revoked" };
+
+typedef struct {
+  int sched;
+  int priority;
+  int cpus;
+} thread_sched_t;
+
+/*
+ * Run time statistics of a thread: time histograms of its stages and consumed cpu time.
+ * They are updated and reported only by the owning thread.
+ */
+#define MAX_THREAD_STATS        5
+
+enum { GRAB_STAT_GRAB, GRAB_STAT_HSV, GRAB_STAT_HUE, GRAB_STAT_SAT, GRAB_STAT_BRIGHTNESS, NUM_GRAB_STATS };
+static const char *grab_stat_names[NUM_GRAB_STATS] = { "grab wait", "hsv conversion", "hue histogram", "saturation histogram", "brightness" };
+
+enum { OUTPUT_STAT_FILTER, OUTPUT_STAT_CORRECTION, OUTPUT_STAT_OUTPUT, NUM_OUTPUT_STATS };
+static const char *output_stat_names[NUM_OUTPUT_STATS] = { "filter", "correction", "driver output" };
+
+typedef struct {
+  const char *name;
+  const char **stat_names;
+  int nstats;
+  atmo_hist_t hist[MAX_THREAD_STATS];
+  int64_t start, cpu_start;         /* begin of statistics period [us] */
+  int request;                      /* last handled report request */
+} thread_stats_t;
+
+/*
+ * Snapshot of the live state of a thread for the statistics server.
+ * The owning thread publishes it periodically with a sequence counter that is odd while the snapshot is written,
+ * so readers never take a lock.
+ */
+#define SNAPSHOT_INTERVAL       100     /* [ms] */
+#define SNAPSHOT_MAX_COLORS     256
+
+typedef struct {
+  uint32_t seq;                     /* odd while snapshot is written */
+  int state;                        /* thread state, TS_STOP if thread is not running */
+  int64_t timestamp;                /* time of publishing, 0 if never published [us] */
+  double rate;                      /* cycles per second within last second */
+  uint64_t cycles;                  /* grab: analyzed frames, output: output cycles */
+  uint64_t unchanged;               /* grab: skipped unchanged frames, output: cycles without changed colors */
+  uint64_t failures, timeouts;      /* grab failures and timeouts */
+  int64_t stats_start;              /* begin of period of stage histograms [us] */
+  atmo_hist_t hist[MAX_THREAD_STATS];
+    /* output thread only */
+  int driver;
+  output_driver_stats_t driver_stats;
+  atmo_hist_t transmit, latency;
+  int nchannels;
+  rgb_color_t colors[SNAPSHOT_MAX_COLORS];
+    /* used by owning thread only */
+  int64_t next_publish, rate_start;
+  uint64_t rate_cycles;
+} thread_snapshot_t;
 
 typedef struct atmo_post_plugin_s
 {
@@ -200,42 +272,41 @@ typedef struct atmo_post_plugin_s
   atmo_parameters_t default_parm;
   post_video_port_t *port;
   pthread_mutex_t port_lock;
+  char mrl[1024];                     /* mrl of opened stream, taken at video open */
 
     /* channel configuration related */
   atmo_parameters_t active_parm;
-  int sum_channels;
+  atmo_channels_t *channels;          /* active channel layout */
+  atmo_channels_t *pending_channels;  /* new channel layout that output thread will swap in */
 
   /* thread related */
   int *grab_thread_state, *output_thread_state;
+  int grab_cmd_fd, output_cmd_fd;   /* eventfd's for waking up threads on state change commands */
+  int grab_in_progress;             /* grab thread is waiting for a grabbed frame */
+  int grab_generation;              /* incremented when a grab in progress is cancelled */
+  int send_initial_colors;          /* output thread has to send first initial color packet */
+  int stats_request;                /* incremented for an on demand statistics report */
   pthread_t grab_thread, output_thread;
   pthread_mutex_t lock;
   pthread_cond_t thread_state_change;
 
+    /* statistics server related */
+  thread_snapshot_t grab_snapshot, output_snapshot;   /* live state published by grab and output thread */
+  struct atmo_stats_server_s *stats_server;
+
     /* output related */
   output_driver_t *output_driver;
   output_drivers_t output_drivers;
   int driver_opened;
-  rgb_color_t *output_colors, *last_output_colors;
-
-    /* analyze related */
-  uint64_t *hue_hist, *sat_hist;
-  uint64_t *w_hue_hist, *w_sat_hist;
-  uint64_t *avg_bright;
-  int *most_used_hue, *last_most_used_hue, *most_used_sat, *avg_cnt;
-  rgb_color_t *analyzed_colors;
-
-    /* filter related */
-  rgb_color_t *filtered_colors;
-  rgb_color_t *mean_filter_values;
-  rgb_color_sum_t *mean_filter_sum_values;
-  int old_mean_length;
+  int output_dithered;                /* driver got dithered 16 bit colors, 8 bit last output colors are not exact */
+  atmo_sink_t *sinks;                 /* additional output drivers */
 } atmo_post_plugin_t;
 
 
 static int build_post_api_parameter_string(char *buf, int size, xine_post_api_descr_t *descr, void *values, void *defaults) {
   xine_post_api_parameter_t *p = descr->parameter;
   int sep = 0;
-  char arg[512];
+  char arg[1024];
 
   while (p->type != POST_PARAM_TYPE_LAST) {
     if (!p->readonly) {
@@ -282,8 +353,11 @@ static int parse_post_api_parameter_string(xine_post_api_descr_t *descr, void *v
 
   while (p->type != POST_PARAM_TYPE_LAST) {
     if (!p->readonly) {
+        /* skip occurrences of name within other parameters or values */
       char *arg = strstr(param, p->name);
-      if (arg && arg[strlen(p->name)] == '=' && (arg == param || arg[-1] == ',' || isspace(arg[-1]))) {
+      while (arg && !(arg[strlen(p->name)] == '=' && (arg == param || arg[-1] == ',' || isspace(arg[-1]))))
+        arg = strstr(arg + 1, p->name);
+      if (arg) {
         arg += strlen(p->name) + 1;
         char *v = (char *)values + p->offset;
         int iv;
@@ -367,394 +441,999 @@ static int join_post_api_parameters(xine_post_api_descr_t *descr, void *dst, voi
 }
 
 
-static inline void rgb_to_hsv(hsv_color_t *hsv, int r, int g, int b) {
-  int min, max, delta;
-  int h = 0;
+static void wait_for_thread_command(atmo_post_plugin_t *this, int cmd_fd, struct timeval *tvtimeout) {
+  struct timeval tvnow, tvdiff;
+  struct timespec ts;
+  struct pollfd pfd;
+  eventfd_t cnt;
 
-  min = MIN(MIN(r, g), b);
-  max = MAX(MAX(r, g), b);
+  gettimeofday(&tvnow, NULL);
+  if (!timercmp(tvtimeout, &tvnow, >))
+    return;
+  timersub(tvtimeout, &tvnow, &tvdiff);
+  ts.tv_sec = tvdiff.tv_sec;
+  ts.tv_nsec = tvdiff.tv_usec * 1000;
 
-  delta = max - min;
+    /* wait until timeout or until a control function writes to the command channel */
+  pfd.fd = cmd_fd;
+  pfd.events = POLLIN;
+  pthread_mutex_unlock(&this->lock);
+  if (ppoll(&pfd, 1, &ts, NULL) > 0)
+    eventfd_read(cmd_fd, &cnt);
+  pthread_mutex_lock(&this->lock);
+}
 
-  hsv->v = (uint8_t) POS_DIV(max * v_MAX, 255);
 
-  if (delta == 0) {
-    h = 0;
-    hsv->s = 0;
-  } else {
-    hsv->s = (uint8_t) POS_DIV((delta * s_MAX) ,max);
+static void set_thread_sched(atmo_post_plugin_t *this, const char *name, thread_sched_t *ts, int sched, int priority, int cpus) {
+  int err;
 
-    int dr = (max - r) + 3 * delta;
-    int dg = (max - g) + 3 * delta;
-    int db = (max - b) + 3 * delta;
-    int divisor = 6 * delta;
+  if (sched != ts->sched || (sched && priority != ts->priority)) {
+    struct sched_param sp;
+    int policy = SCHED_OTHER;
+    memset(&sp, 0, sizeof(sp));
+    if (sched) {
+      policy = (sched == 1) ? SCHED_FIFO: SCHED_RR;
+      sp.sched_priority = MAX(MIN(priority, sched_get_priority_max(policy)), sched_get_priority_min(policy));
+    }
+    if ((err = pthread_setschedparam(pthread_self(), policy, &sp)))
+      xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo: can't set %s scheduling for %s thread (%s), using normal scheduling\n", sched_enum[sched], name, strerror(err));
+    else
+      llprintf(LOG_1, "%s thread scheduling: %s, priority %d\n", name, sched_enum[sched], sp.sched_priority);
+    ts->sched = sched;
+    ts->priority = priority;
+  }
 
-    if (r == max) {
-      h = POS_DIV(( (db - dg) * h_MAX ) , divisor);
-    } else if (g == max) {
-      h = POS_DIV( ((dr - db) * h_MAX) , divisor) + (h_MAX/3);
-    } else if (b == max) {
-      h = POS_DIV(( (dg - dr) * h_MAX) , divisor) + (h_MAX/3) * 2;
+  if (cpus != ts->cpus) {
+    cpu_set_t cpuset;
+    int cpu, ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    CPU_ZERO(&cpuset);
+    for (cpu = 0; cpu < ncpus && cpu < CPU_SETSIZE; ++cpu) {
+      if (!cpus || (cpu < 31 && (cpus & (1 << cpu))))
+        CPU_SET(cpu, &cpuset);
     }
+    if ((err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset)))
+      xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo: can't set cpu affinity 0x%x for %s thread (%s)\n", cpus, name, strerror(err));
+    else
+      llprintf(LOG_1, "%s thread cpu affinity: 0x%x\n", name, cpus);
+    ts->cpus = cpus;
+  }
+}
+
+
+static int64_t thread_cpu_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 
-    if (h < 0) {
-      h += h_MAX;
+static void reset_thread_stats(thread_stats_t *ts) {
+  memset(ts->hist, 0, sizeof(ts->hist));
+  ts->start = atmo_hist_now();
+  ts->cpu_start = thread_cpu_time();
+}
+
+
+static void init_thread_stats(thread_stats_t *ts, const char *name, const char **stat_names, int nstats, int request) {
+  ts->name = name;
+  ts->stat_names = stat_names;
+  ts->nstats = nstats;
+  ts->request = request;
+  reset_thread_stats(ts);
+}
+
+
+  /* Report statistics when requested or report interval has expired. Plugin lock must not be held. */
+static void report_thread_stats(atmo_post_plugin_t *this, thread_stats_t *ts, int request, int interval, output_driver_t *output_driver) {
+  const int64_t now = atmo_hist_now();
+  atmo_hist_t write_hist;
+  atmo_trace_t trace;
+  char buf[256];
+  int i;
+
+  if (request == ts->request && (!interval || now - ts->start < (int64_t) interval * 1000000))
+    return;
+  ts->request = request;
+
+  const int64_t period = now - ts->start;
+  const int64_t cpu = thread_cpu_time() - ts->cpu_start;
+  xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo: %s thread statistics of last %d.%03d s: cpu time %d.%03d s (%.1f%%)\n",
+           ts->name, (int) (period / 1000000), (int) ((period / 1000) % 1000), (int) (cpu / 1000000), (int) ((cpu / 1000) % 1000),
+           period ? (100.0 * cpu) / period: 0.0);
+  for (i = 0; i < ts->nstats; ++i) {
+    if (ts->hist[i].cnt) {
+      atmo_hist_format(&ts->hist[i], ts->stat_names[i], buf, sizeof(buf));
+      xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo:   %s\n", buf);
     }
-    if (h > h_MAX) {
-      h -= h_MAX;
+  }
+  memset(&write_hist, 0, sizeof(write_hist));
+  memset(&trace, 0, sizeof(trace));
+  if (output_driver)
+    get_output_driver_hist(output_driver, &write_hist, &trace);
+    /* transmit times of driver are counted since driver has been opened */
+  if (write_hist.cnt) {
+    atmo_hist_format(&write_hist, "driver transmit since open", buf, sizeof(buf));
+    xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo:   %s\n", buf);
+  }
+    /* glass to device latency and the share of each hop on it */
+  if (trace.total.cnt) {
+    const atmo_trace_t *t = &trace;
+    const double total = (double) t->total.sum / t->total.cnt;
+    atmo_hist_format(&t->total, "glass to device latency since open", buf, sizeof(buf));
+    xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo:   %s\n", buf);
+    for (i = 0; i < ATMO_TRACE_HOPS; ++i) {
+      if (t->hop[i].cnt) {
+        atmo_hist_format(&t->hop[i], atmo_trace_hop_names[i], buf, sizeof(buf));
+        xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo:     %s, %.0f%% of total\n", buf,
+                 total > 0.0 ? (100.0 * t->hop[i].sum / t->hop[i].cnt) / total: 0.0);
+      }
     }
   }
-  hsv->h = (uint8_t) h;
+  reset_thread_stats(ts);
 }
 
 
-static void calc_hsv_image(hsv_color_t *hsv, uint8_t *rgb, int img_size) {
-  while (img_size--) {
-    rgb_to_hsv(hsv, rgb[0], rgb[1], rgb[2]);
-    ++hsv;
-    rgb += 3;
+  /* Returns true if the snapshot of the calling thread is due for publishing */
+static int snapshot_due(thread_snapshot_t *snap) {
+  const int64_t now = atmo_hist_now();
+
+  if (now < snap->next_publish)
+    return 0;
+  snap->next_publish = now + SNAPSHOT_INTERVAL * 1000;
+  if (now - snap->rate_start >= 1000000) {
+    if (snap->rate_start)
+      snap->rate = (snap->cycles - snap->rate_cycles) * 1000000.0 / (now - snap->rate_start);
+    snap->rate_start = now;
+    snap->rate_cycles = snap->cycles;
   }
+  return 1;
 }
 
 
-static void calc_weight(atmo_post_plugin_t *this, uint8_t *weight, const int width, const int height, const int edge_weighting) {
-  int row, col, c;
+static void publish_snapshot(thread_snapshot_t *dst, thread_snapshot_t *snap, const thread_stats_t *ts) {
+  snap->timestamp = atmo_hist_now();
+  snap->stats_start = ts->start;
+  memcpy(snap->hist, ts->hist, sizeof(snap->hist));
 
-  const double w = edge_weighting > 10 ? (double)edge_weighting / 10.0: 10.0;
+  snap->seq = dst->seq + 1;
+  __atomic_store_n(&dst->seq, snap->seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(dst, snap, sizeof(*dst));
+  __atomic_store_n(&dst->seq, snap->seq + 1, __ATOMIC_RELEASE);
+}
 
-  const int top_channels = this->active_parm.top;
-  const int bottom_channels = this->active_parm.bottom;
-  const int left_channels = this->active_parm.left;
-  const int right_channels = this->active_parm.right;
-  const int center_channel = this->active_parm.center;
-  const int top_left_channel = this->active_parm.top_left;
-  const int top_right_channel = this->active_parm.top_right;
-  const int bottom_left_channel = this->active_parm.bottom_left;
-  const int bottom_right_channel = this->active_parm.bottom_right;
 
-  const int sum_top_channels = top_channels + top_left_channel + top_right_channel;
-  const int sum_bottom_channels = bottom_channels + bottom_left_channel + bottom_right_channel;
-  const int sum_left_channels = left_channels + bottom_left_channel + top_left_channel;
-  const int sum_right_channels = right_channels + bottom_right_channel + top_right_channel;
+  /* Copy snapshot published by another thread */
+static void read_snapshot(const thread_snapshot_t *src, thread_snapshot_t *snap) {
+  for (;;) {
+    const uint32_t seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+    if (!(seq & 1)) {
+      memcpy(snap, src, sizeof(*snap));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&src->seq, __ATOMIC_RELAXED) == seq)
+        return;
+    }
+    sched_yield();
+  }
+}
 
-  const int center_y = height / 2;
-  const int center_x = width / 2;
 
-  const double fheight = height - 1;
-  const double fwidth = width - 1;
+  /* Add output related live state to snapshot. Plugin lock must be held. */
+static void fill_output_snapshot(atmo_post_plugin_t *this, thread_snapshot_t *snap) {
+  output_driver_t *output_driver = this->output_driver;
+  atmo_channels_t *ch = this->channels;
 
-  for (row = 0; row < height; ++row)
-  {
-    double row_norm = (double)row / fheight;
-    int top = (int)(255.0 * pow(1.0 - row_norm, w));
-    int bottom = (int)(255.0 * pow(row_norm, w));
+  snap->driver = this->active_parm.driver;
+  memset(&snap->driver_stats, 0, sizeof(snap->driver_stats));
+  if (output_driver) {
+    atmo_trace_t trace;
+    if (output_driver->get_stats)
+      output_driver->get_stats(output_driver, &snap->driver_stats);
+    get_output_driver_hist(output_driver, &snap->transmit, &trace);
+    snap->latency = trace.total;
+  }
+  snap->nchannels = ch ? ch->sum_channels: 0;
+  if (snap->nchannels)
+    memcpy(snap->colors, ch->last_output_colors, ((snap->nchannels < SNAPSHOT_MAX_COLORS) ? snap->nchannels: SNAPSHOT_MAX_COLORS) * sizeof(rgb_color_t));
+}
 
-    for (col = 0; col < width; ++col)
-    {
-      double col_norm = (double)col / fwidth;
-      int left = (int)(255.0 * pow((1.0 - col_norm), w));
-      int right = (int)(255.0 * pow(col_norm, w));
 
-      for (c = top_left_channel; c < (top_channels + top_left_channel); ++c)
-        *weight++ = (col >= ((width * c) / sum_top_channels) && col < ((width * (c + 1)) / sum_top_channels) && row < center_y) ? top: 0;
+  /* plugin lock must be held */
+static void unref_channels(atmo_channels_t *ch) {
+  if (ch && !--ch->refs)
+    free_channels(ch);
+}
 
-      for (c = bottom_left_channel; c < (bottom_channels + bottom_left_channel); ++c)
-        *weight++ = (col >= ((width * c) / sum_bottom_channels) && col < ((width * (c + 1)) / sum_bottom_channels) && row >= center_y) ? bottom: 0;
 
-      for (c = top_left_channel; c < (left_channels + top_left_channel); ++c)
-        *weight++ = (row >= ((height * c) / sum_left_channels) && row < ((height * (c + 1)) / sum_left_channels) && col < center_x) ? left: 0;
+static void get_channels_layout(atmo_channels_t *ch, int *cnt) {
+  cnt[0] = ch->top;
+  cnt[1] = ch->bottom;
+  cnt[2] = ch->left;
+  cnt[3] = ch->right;
+  cnt[4] = ch->center;
+  cnt[5] = ch->top_left;
+  cnt[6] = ch->top_right;
+  cnt[7] = ch->bottom_left;
+  cnt[8] = ch->bottom_right;
+}
 
-      for (c = top_right_channel; c < (right_channels + top_right_channel); ++c)
-        *weight++ = (row >= ((height * c) / sum_right_channels) && row < ((height * (c + 1)) / sum_right_channels) && col >= center_x) ? right: 0;
 
-      if (center_channel)
-        *weight++ = 255;
+static void set_channels_layout(atmo_parameters_t *parm, atmo_channels_t *ch) {
+  parm->top = ch->top;
+  parm->bottom = ch->bottom;
+  parm->left = ch->left;
+  parm->right = ch->right;
+  parm->center = ch->center;
+  parm->top_left = ch->top_left;
+  parm->top_right = ch->top_right;
+  parm->bottom_left = ch->bottom_left;
+  parm->bottom_right = ch->bottom_right;
+}
 
-      if (top_left_channel)
-        *weight++ = (col < center_x && row < center_y) ? ((top > left) ? top: left) : 0;
 
-      if (top_right_channel)
-        *weight++ = (col >= center_x && row < center_y) ? ((top > right) ? top: right): 0;
+static int same_channels_layout(atmo_channels_t *ch, atmo_parameters_t *parm) {
+  return (ch->top == parm->top && ch->bottom == parm->bottom && ch->left == parm->left && ch->right == parm->right &&
+          ch->center == parm->center && ch->top_left == parm->top_left && ch->top_right == parm->top_right &&
+          ch->bottom_left == parm->bottom_left && ch->bottom_right == parm->bottom_right);
+}
 
-      if (bottom_left_channel)
-        *weight++ = (col < center_x && row >= center_y) ? ((bottom > left) ? bottom: left): 0;
 
-      if (bottom_right_channel)
-        *weight++ = (col >= center_x && row >= center_y) ? ((bottom > right) ? bottom: right): 0;
+static void carry_channels_state(atmo_channels_t *ch, atmo_channels_t *old) {
+  int cnt[NUM_AREAS], old_cnt[NUM_AREAS];
+  int a, c = 0, old_c = 0;
+
+    /* take over analyze and filter state of areas that have the same number of sections */
+  get_channels_layout(ch, cnt);
+  get_channels_layout(old, old_cnt);
+  for (a = 0; a < NUM_AREAS; ++a) {
+    const int n = cnt[a];
+    if (n && n == old_cnt[a]) {
+      memcpy(&ch->last_most_used_hue[c], &old->last_most_used_hue[old_c], n * sizeof(int));
+      memcpy(&ch->analyzed_colors[c], &old->analyzed_colors[old_c], n * sizeof(rgb_color_t));
+      memcpy(&ch->filtered_colors16[c], &old->filtered_colors16[old_c], n * sizeof(rgb16_color_t));
+      memcpy(&ch->filtered_colors[c], &old->filtered_colors[old_c], n * sizeof(rgb_color_t));
+      memcpy(&ch->mean_filter_values[c], &old->mean_filter_values[old_c], n * sizeof(rgb_color_t));
+      memcpy(&ch->mean_filter_sum_values[c], &old->mean_filter_sum_values[old_c], n * sizeof(rgb_color_sum_t));
     }
+    c += n;
+    old_c += old_cnt[a];
   }
+  ch->old_mean_length = old->old_mean_length;
 }
 
 
-static void calc_hue_hist(atmo_post_plugin_t *this, hsv_color_t *hsv, uint8_t *weight, int img_size) {
-  const int n = this->sum_channels;
-  uint64_t * const hue_hist = this->hue_hist;
-  const int darkness_limit = this->active_parm.darkness_limit;
+/*
+ * Capture of analyze images into a file for offline benchmarking and tuning.
+ * The grab thread copies the images into a bounded queue that is written by a writer thread.
+ * Images are dropped when the queue is full so that capturing does not affect the grab timing.
+ */
+#define CAPTURE_QUEUE_SIZE      16
+
+typedef struct {
+  xine_t *xine;
+  char path[sizeof(((atmo_parameters_t *)0)->capture_file)];
+  int fd;                           /* -1 if capture file could not be opened */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t frame_ready;
+  int running;
+  int head, cnt;                    /* read position and number of queued frames */
+  atmo_cap_frame_t *queue[CAPTURE_QUEUE_SIZE];
+  int alloc_size[CAPTURE_QUEUE_SIZE];
+  int written_cnt, dropped_cnt, write_err;
+} atmo_capture_t;
 
-  memset(hue_hist, 0, (n * (h_MAX+1) * sizeof(uint64_t)));
 
-  while (img_size--) {
-    if (hsv->v >= darkness_limit) {
-      int c;
-      for (c = 0; c < n; ++c)
-        hue_hist[c * (h_MAX+1) + hsv->h] += weight[c] * hsv->v;
+static void *atmo_capture_loop(void *arg) {
+  atmo_capture_t *cap = (atmo_capture_t *) arg;
+
+  pthread_mutex_lock(&cap->lock);
+  for (;;) {
+    while (cap->running && !cap->cnt)
+      pthread_cond_wait(&cap->frame_ready, &cap->lock);
+    if (!cap->cnt)
+      break;
+    atmo_cap_frame_t *f = cap->queue[cap->head];
+    pthread_mutex_unlock(&cap->lock);
+
+      /* queued frames are still written when capture is stopped */
+    if (!cap->write_err) {
+      uint8_t *p = (uint8_t *) f;
+      size_t n = f->size;
+      while (n) {
+        ssize_t rc = write(cap->fd, p, n);
+        if (rc < 0) {
+          if (errno == EINTR)
+            continue;
+          xine_log(cap->xine, XINE_LOG_PLUGIN, "atmo: write to capture file '%s' failed: %s\n", cap->path, strerror(errno));
+          cap->write_err = 1;
+          break;
+        }
+        p += rc;
+        n -= rc;
+      }
+      if (!n)
+        ++cap->written_cnt;
     }
-    weight += n;
-    ++hsv;
+
+    pthread_mutex_lock(&cap->lock);
+    cap->head = (cap->head + 1) % CAPTURE_QUEUE_SIZE;
+    --cap->cnt;
   }
+  pthread_mutex_unlock(&cap->lock);
+  return NULL;
 }
 
 
-static void calc_windowed_hue_hist(atmo_post_plugin_t *this) {
-  int i, c, w;
-  const int n = this->sum_channels;
-  uint64_t * const hue_hist = this->hue_hist;
-  uint64_t * const w_hue_hist = this->w_hue_hist;
-  const int hue_win_size = this->active_parm.hue_win_size;
+static atmo_capture_t *start_capture(xine_t *xine, const char *path) {
+  atmo_capture_t *cap = (atmo_capture_t *) calloc(1, sizeof(atmo_capture_t));
+  atmo_cap_header_t hdr;
+  struct stat st;
+  int err;
 
-  memset(w_hue_hist, 0, (n * (h_MAX+1) * sizeof(uint64_t)));
+  if (!cap)
+    return NULL;
+  cap->xine = xine;
+  snprintf(cap->path, sizeof(cap->path), "%s", path);
+
+    /* new frames are appended to an existing capture file */
+  cap->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (cap->fd < 0) {
+    xine_log(xine, XINE_LOG_PLUGIN, "atmo: can't open capture file '%s': %s\n", path, strerror(errno));
+    return cap;
+  }
+  if (fstat(cap->fd, &st) == 0 && st.st_size == 0) {
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, ATMO_CAP_MAGIC, sizeof(ATMO_CAP_MAGIC));
+    hdr.version = ATMO_CAP_VERSION;
+    if (write(cap->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+      xine_log(xine, XINE_LOG_PLUGIN, "atmo: write to capture file '%s' failed: %s\n", path, strerror(errno));
+      close(cap->fd);
+      cap->fd = -1;
+      return cap;
+    }
+  } else if (pread(cap->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || memcmp(hdr.magic, ATMO_CAP_MAGIC, sizeof(ATMO_CAP_MAGIC)) || hdr.version != ATMO_CAP_VERSION) {
+    xine_log(xine, XINE_LOG_PLUGIN, "atmo: '%s' is not a capture file\n", path);
+    close(cap->fd);
+    cap->fd = -1;
+    return cap;
+  }
 
-  for (i = 0; i < (h_MAX+1); ++i)
-  {
-    for (w = -hue_win_size; w <= hue_win_size; w++)
-    {
-      int iw = i + w;
+  pthread_mutex_init(&cap->lock, NULL);
+  pthread_cond_init(&cap->frame_ready, NULL);
+  cap->running = 1;
+  if ((err = pthread_create(&cap->thread, NULL, atmo_capture_loop, cap))) {
+    xine_log(xine, XINE_LOG_PLUGIN, "atmo: can't create capture thread: %s\n", strerror(err));
+    pthread_cond_destroy(&cap->frame_ready);
+    pthread_mutex_destroy(&cap->lock);
+    close(cap->fd);
+    cap->fd = -1;
+    return cap;
+  }
+  llprintf(LOG_1, "capture of analyze images into '%s' started\n", path);
+  return cap;
+}
 
-      if (iw < 0)
-        iw = iw + h_MAX + 1;
-      if (iw > h_MAX)
-        iw = iw - h_MAX - 1;
 
-      uint64_t win_weight = (hue_win_size + 1) - abs(w);
+static void stop_capture(atmo_capture_t *cap) {
+  int i;
 
-      for (c = 0; c < n; ++c)
-        w_hue_hist[c * (h_MAX+1) + i] += hue_hist[c * (h_MAX+1) + iw] * win_weight;
-    }
+  if (cap->fd >= 0) {
+    pthread_mutex_lock(&cap->lock);
+    cap->running = 0;
+    pthread_cond_signal(&cap->frame_ready);
+    pthread_mutex_unlock(&cap->lock);
+    pthread_join(cap->thread, NULL);
+    pthread_cond_destroy(&cap->frame_ready);
+    pthread_mutex_destroy(&cap->lock);
+    close(cap->fd);
+    llprintf(LOG_1, "capture into '%s' stopped (%d frames written, %d frames dropped)\n", cap->path, cap->written_cnt, cap->dropped_cnt);
   }
+  for (i = 0; i < CAPTURE_QUEUE_SIZE; ++i)
+    free(cap->queue[i]);
+  free(cap);
 }
 
 
-static void calc_most_used_hue(atmo_post_plugin_t *this) {
-  int i, c;
+static void queue_capture_frame(atmo_capture_t *cap, xine_grab_video_frame_t *frame, int width, int height, int grab_width, int grab_height) {
+  struct timespec ts;
+  int pos, full;
 
-  const int n = this->sum_channels;
-  uint64_t * const w_hue_hist = this->w_hue_hist;
-  int * const most_used_hue = this->most_used_hue;
-  int * const last_most_used_hue = this->last_most_used_hue;
-  const double hue_threshold = (double)this->active_parm.hue_threshold / 100.0;
+  if (cap->fd < 0)
+    return;
 
-  memset(most_used_hue, 0, (n * sizeof(int)));
+  pthread_mutex_lock(&cap->lock);
+  full = (cap->cnt == CAPTURE_QUEUE_SIZE);
+  pos = (cap->head + cap->cnt) % CAPTURE_QUEUE_SIZE;
+  pthread_mutex_unlock(&cap->lock);
+  if (full) {
+    ++cap->dropped_cnt;
+    return;
+  }
 
-  for (c = 0; c < n; ++c) {
-    uint64_t v = 0;
-    for (i = 0; i < (h_MAX + 1); ++i) {
-      if (w_hue_hist[c * (h_MAX+1) + i] > v) {
-        v = w_hue_hist[c * (h_MAX+1) + i];
-        most_used_hue[c] = i;
-      }
+    /* the slot at the write position is owned by the grab thread until it is queued */
+  int size = ATMO_CAP_FRAME_SIZE(width, height);
+  if (size > cap->alloc_size[pos]) {
+    free(cap->queue[pos]);
+    cap->alloc_size[pos] = 0;
+    cap->queue[pos] = (atmo_cap_frame_t *) malloc(size);
+    if (!cap->queue[pos]) {
+      ++cap->dropped_cnt;
+      return;
     }
-    if (((double) w_hue_hist[c * (h_MAX+1) + last_most_used_hue[c]] / (double) v) > hue_threshold)
-      most_used_hue[c] = last_most_used_hue[c];
-    else
-      last_most_used_hue[c] = most_used_hue[c];
+    cap->alloc_size[pos] = size;
   }
+
+  atmo_cap_frame_t *f = cap->queue[pos];
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  memset(f, 0, sizeof(*f));
+  f->size = size;
+  f->width = width;
+  f->height = height;
+  f->grab_width = grab_width;
+  f->grab_height = grab_height;
+  f->crop_left = frame->crop_left;
+  f->crop_right = frame->crop_right;
+  f->crop_top = frame->crop_top;
+  f->crop_bottom = frame->crop_bottom;
+  f->vpts = frame->vpts;
+  f->timestamp = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  memcpy(f->img, frame->img, width * height * 3);
+  memset(f->img + width * height * 3, 0, size - sizeof(*f) - width * height * 3);
+
+  pthread_mutex_lock(&cap->lock);
+  ++cap->cnt;
+  pthread_cond_signal(&cap->frame_ready);
+  pthread_mutex_unlock(&cap->lock);
 }
 
 
-static void calc_sat_hist(atmo_post_plugin_t *this, hsv_color_t *hsv, uint8_t *weight, int img_size) {
-  const int n = this->sum_channels;
-  uint64_t * const sat_hist = this->sat_hist;
-  int * const most_used_hue = this->most_used_hue;
-  const int darkness_limit = this->active_parm.darkness_limit;
-  const int hue_win_size = this->active_parm.hue_win_size;
+/*
+ * Color cache: analyzed colors of local media files are kept in a sidecar file keyed by playback position.
+ * When a file is played again the grab thread takes the colors of the displayed position from the cache
+ * instead of grabbing and analyzing the frame. Positions not cached yet are analyzed and appended,
+ * they are used when the cache is opened next time. New records are queued and written in batches by a writer
+ * thread so that a slow file system does not stall the grab thread, records are dropped when the queue is full.
+ */
+#define CACHE_PATH_SIZE         1024
+#define CACHE_QUEUE_SIZE        256     /* [records] */
+#define CACHE_WRITE_BATCH       32      /* [records] */
+
+typedef struct {
+  xine_t *xine;
+  char mrl[CACHE_PATH_SIZE];
+  char path[CACHE_PATH_SIZE];
+  atmo_cache_header_t hdr;
+  int fd;                           /* -1 if file is not cached */
+  int rec_size;
+  uint8_t *recs;                    /* records loaded at open sorted by position */
+  int nrecs;
+  int64_t pos;                      /* position of last lookup, -1 if unknown */
+  const uint8_t *hit;               /* colors found by last lookup */
+  atmo_cache_rec_t *rec;            /* record to append */
+  int pending;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t recs_ready;
+  int running;
+  uint8_t *queue;                   /* CACHE_QUEUE_SIZE records to write */
+  int head, cnt;                    /* read position and number of queued records */
+  int hit_cnt, added_cnt, dropped_cnt, write_err;
+} atmo_cache_t;
+
 
-  memset(sat_hist, 0, (n * (s_MAX+1) * sizeof(uint64_t)));
+static void *atmo_cache_loop(void *arg) {
+  atmo_cache_t *cache = (atmo_cache_t *) arg;
 
-  while (img_size--) {
-    if (hsv->v >= darkness_limit) {
-      int h = hsv->h;
-      int c;
-      for (c = 0; c < n; ++c) {
-        if (h > (most_used_hue[c] - hue_win_size) && h < (most_used_hue[c] + hue_win_size))
-          sat_hist[c * (s_MAX+1) + hsv->s] += weight[c] * hsv->v;
+  pthread_mutex_lock(&cache->lock);
+  for (;;) {
+    while (cache->running && cache->cnt < CACHE_WRITE_BATCH)
+      pthread_cond_wait(&cache->recs_ready, &cache->lock);
+    if (!cache->cnt)
+      break;
+    const int cnt = (cache->head + cache->cnt > CACHE_QUEUE_SIZE) ? CACHE_QUEUE_SIZE - cache->head: cache->cnt;
+    uint8_t *p = cache->queue + (size_t) cache->head * cache->rec_size;
+    pthread_mutex_unlock(&cache->lock);
+
+      /* queued records are still written when cache is closed */
+    if (!cache->write_err) {
+      size_t n = (size_t) cnt * cache->rec_size;
+      while (n) {
+        ssize_t rc = write(cache->fd, p, n);
+        if (rc < 0) {
+          if (errno == EINTR)
+            continue;
+          xine_log(cache->xine, XINE_LOG_PLUGIN, "atmo: write to color cache '%s' failed: %s\n", cache->path, strerror(errno));
+          cache->write_err = 1;
+          break;
+        }
+        p += rc;
+        n -= rc;
       }
+      if (!n)
+        cache->added_cnt += cnt;
     }
-    weight += n;
-    ++hsv;
+
+    pthread_mutex_lock(&cache->lock);
+    cache->head = (cache->head + cnt) % CACHE_QUEUE_SIZE;
+    cache->cnt -= cnt;
   }
+  pthread_mutex_unlock(&cache->lock);
+  return NULL;
 }
 
 
-static void calc_windowed_sat_hist(atmo_post_plugin_t *this) {
-  int i, c, w;
-  const int n = this->sum_channels;
-  uint64_t * const sat_hist = this->sat_hist;
-  uint64_t * const w_sat_hist = this->w_sat_hist;
-  const int sat_win_size = this->active_parm.sat_win_size;
-
-  memset(w_sat_hist, 0, (n * (s_MAX+1) * sizeof(uint64_t)));
+static void init_color_cache_header(atmo_cache_header_t *hdr, const atmo_parameters_t *parm, const atmo_channels_t *ch) {
+  int layout[NUM_AREAS];
+
+  memset(layout, 0, sizeof(layout));
+  if (ch) {
+    layout[0] = ch->top;
+    layout[1] = ch->bottom;
+    layout[2] = ch->left;
+    layout[3] = ch->right;
+    layout[4] = ch->center;
+    layout[5] = ch->top_left;
+    layout[6] = ch->top_right;
+    layout[7] = ch->bottom_left;
+    layout[8] = ch->bottom_right;
+  }
+  atmo_cache_init_header(hdr, parm, layout);
+}
 
-  for (i = 0; i < (s_MAX+1); ++i)
-  {
-    for (w = -sat_win_size; w <= sat_win_size; w++)
-    {
-      int iw = i + w;
 
-      if (iw < 0)
-        iw = iw + s_MAX + 1;
-      if (iw > s_MAX)
-        iw = iw - s_MAX - 1;
+static int color_cache_path(const char *mrl, char *path, size_t size) {
+  struct stat st;
+  char *p;
 
-      uint64_t win_weight = (sat_win_size + 1) - abs(w);
+  if (!strncmp(mrl, "file://", 7))
+    mrl += 7;
+  else if (!strncmp(mrl, "file:", 5))
+    mrl += 5;
+  if (mrl[0] != '/' || strlen(mrl) + sizeof(ATMO_CACHE_SUFFIX) > size)
+    return 0;
+  strcpy(path, mrl);
 
-      for (c = 0; c < n; ++c)
-        w_sat_hist[c * (s_MAX+1) + i] += sat_hist[c * (s_MAX+1) + iw] * win_weight;
-    }
+    /* strip xine mrl options appended with '#' */
+  while (stat(path, &st) || !S_ISREG(st.st_mode)) {
+    if (!(p = strrchr(path, '#')))
+      return 0;
+    *p = 0;
   }
+  strcat(path, ATMO_CACHE_SUFFIX);
+  return 1;
 }
 
 
-static void calc_most_used_sat(atmo_post_plugin_t *this) {
-  int i, c;
-  const int n = this->sum_channels;
-  uint64_t * const w_sat_hist = this->w_sat_hist;
-  int * const most_used_sat = this->most_used_sat;
+static inline atmo_cache_rec_t *color_cache_rec(atmo_cache_t *cache, int i) {
+  return (atmo_cache_rec_t *) (cache->recs + (size_t) i * cache->rec_size);
+}
+
+
+static int cmp_color_cache_rec(const void *a, const void *b) {
+  const int64_t pa = ((const atmo_cache_rec_t *) a)->pos;
+  const int64_t pb = ((const atmo_cache_rec_t *) b)->pos;
+  return (pa > pb) - (pa < pb);
+}
 
-  memset(most_used_sat, 0, (n * sizeof(int)));
 
-  for (c = 0; c < n; ++c) {
-    uint64_t v = 0;
-    for (i = 0; i < (s_MAX + 1); ++i) {
-      if (w_sat_hist[c * (s_MAX+1) + i] > v) {
-        v = w_sat_hist[c * (s_MAX+1) + i];
-        most_used_sat[c] = i;
+static atmo_cache_t *open_color_cache(xine_t *xine, const char *mrl, const atmo_cache_header_t *hdr) {
+  atmo_cache_t *cache = (atmo_cache_t *) calloc(1, sizeof(atmo_cache_t));
+  atmo_cache_header_t file_hdr;
+  struct stat st;
+  int n, err;
+
+  if (!cache)
+    return NULL;
+  cache->xine = xine;
+  cache->fd = -1;
+  cache->pos = -1;
+  cache->hdr = *hdr;
+  cache->rec_size = ATMO_CACHE_REC_SIZE(hdr->nchannels);
+  snprintf(cache->mrl, sizeof(cache->mrl), "%s", mrl);
+
+    /* only local files are cached */
+  if (!color_cache_path(mrl, cache->path, sizeof(cache->path)))
+    return cache;
+
+  cache->rec = (atmo_cache_rec_t *) calloc(1, cache->rec_size);
+  cache->queue = (uint8_t *) malloc((size_t) CACHE_QUEUE_SIZE * cache->rec_size);
+  if (!cache->rec || !cache->queue)
+    return cache;
+
+  cache->fd = open(cache->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (cache->fd < 0) {
+    xine_log(xine, XINE_LOG_PLUGIN, "atmo: can't open color cache '%s': %s\n", cache->path, strerror(errno));
+    return cache;
+  }
+
+  if (fstat(cache->fd, &st) == 0 && st.st_size >= (off_t) sizeof(file_hdr) &&
+      pread(cache->fd, &file_hdr, sizeof(file_hdr), 0) == sizeof(file_hdr) &&
+      !memcmp(file_hdr.magic, hdr->magic, sizeof(file_hdr.magic)) && file_hdr.version == hdr->version) {
+    if (memcmp(&file_hdr, hdr, sizeof(file_hdr))) {
+        /* valid cache of other channel layout or analysis parameters is kept, it is not used while they differ */
+      llprintf(LOG_1, "color cache '%s' not used: other layout or analysis parameters\n", cache->path);
+      close(cache->fd);
+      cache->fd = -1;
+      return cache;
+    }
+      /* load cached records, a partly written record at the end is cut off */
+    n = (st.st_size - sizeof(file_hdr)) / cache->rec_size;
+    if (ftruncate(cache->fd, sizeof(file_hdr) + (off_t) n * cache->rec_size))
+      n = 0;
+    if (n && (cache->recs = (uint8_t *) malloc((size_t) n * cache->rec_size))) {
+      if (pread(cache->fd, cache->recs, (size_t) n * cache->rec_size, sizeof(file_hdr)) == (ssize_t) n * cache->rec_size) {
+        cache->nrecs = n;
+        qsort(cache->recs, n, cache->rec_size, cmp_color_cache_rec);
       }
     }
+  } else {
+      /* new cache or invalid cache or cache of an old version */
+    if (st.st_size)
+      llprintf(LOG_1, "color cache '%s' discarded\n", cache->path);
+    if (ftruncate(cache->fd, 0) || write(cache->fd, hdr, sizeof(*hdr)) != sizeof(*hdr)) {
+      xine_log(xine, XINE_LOG_PLUGIN, "atmo: write to color cache '%s' failed: %s\n", cache->path, strerror(errno));
+      close(cache->fd);
+      cache->fd = -1;
+      return cache;
+    }
   }
+
+  pthread_mutex_init(&cache->lock, NULL);
+  pthread_cond_init(&cache->recs_ready, NULL);
+  cache->running = 1;
+  if ((err = pthread_create(&cache->thread, NULL, atmo_cache_loop, cache))) {
+    xine_log(xine, XINE_LOG_PLUGIN, "atmo: can't create color cache writer thread: %s\n", strerror(err));
+    pthread_cond_destroy(&cache->recs_ready);
+    pthread_mutex_destroy(&cache->lock);
+    close(cache->fd);
+    cache->fd = -1;
+    return cache;
+  }
+  llprintf(LOG_1, "color cache '%s' opened (%d cached positions)\n", cache->path, cache->nrecs);
+  return cache;
 }
 
 
-static void calc_average_brightness(atmo_post_plugin_t *this, hsv_color_t *hsv, uint8_t *weight, int img_size) {
-  int c;
-  const int n = this->sum_channels;
-  const int darkness_limit = this->active_parm.darkness_limit;
-  const uint64_t bright = this->active_parm.brightness;
-  uint64_t * const avg_bright = this->avg_bright;
-  int * const avg_cnt = this->avg_cnt;
+  /* Queue pending record for the writer thread */
+static void write_color_cache(atmo_cache_t *cache) {
+  int pos, full, cnt;
 
-  memset(avg_bright, 0, (n * sizeof(uint64_t)));
-  memset(avg_cnt, 0, (n * sizeof(int)));
+  if (!cache->pending)
+    return;
+  cache->pending = 0;
+  if (cache->write_err)
+    return;
 
-  while (img_size--) {
-    const int v = hsv->v;
-    if (v >= darkness_limit) {
-      for (c = 0; c < n; ++c) {
-        avg_bright[c] += v * weight[c];
-        avg_cnt[c] += weight[c];
-      }
-    }
-    weight += n;
-    ++hsv;
+  pthread_mutex_lock(&cache->lock);
+  full = (cache->cnt == CACHE_QUEUE_SIZE);
+  pos = (cache->head + cache->cnt) % CACHE_QUEUE_SIZE;
+  pthread_mutex_unlock(&cache->lock);
+  if (full) {
+    ++cache->dropped_cnt;
+    return;
   }
 
-  for (c = 0; c < n; ++c) {
-    if (avg_cnt[c]) {
-      avg_bright[c] = (avg_bright[c] * bright) / (avg_cnt[c] * ((uint64_t)100));
-      if (avg_bright[c] > v_MAX)
-        avg_bright[c] = v_MAX;
-    }
+    /* the slot at the write position is owned by the grab thread until it is queued */
+  memcpy(cache->queue + (size_t) pos * cache->rec_size, cache->rec, cache->rec_size);
+
+  pthread_mutex_lock(&cache->lock);
+  cnt = ++cache->cnt;
+  if (cnt >= CACHE_WRITE_BATCH)
+    pthread_cond_signal(&cache->recs_ready);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+
+static void close_color_cache(atmo_cache_t *cache) {
+  if (cache->fd >= 0) {
+    write_color_cache(cache);
+    pthread_mutex_lock(&cache->lock);
+    cache->running = 0;
+    pthread_cond_signal(&cache->recs_ready);
+    pthread_mutex_unlock(&cache->lock);
+    pthread_join(cache->thread, NULL);
+    pthread_cond_destroy(&cache->recs_ready);
+    pthread_mutex_destroy(&cache->lock);
+    close(cache->fd);
+    llprintf(LOG_1, "color cache '%s' closed (%d positions taken from cache, %d positions added, %d positions dropped)\n", cache->path, cache->hit_cnt, cache->added_cnt, cache->dropped_cnt);
   }
+  free(cache->recs);
+  free(cache->rec);
+  free(cache->queue);
+  free(cache);
 }
 
 
-static void calc_uniform_average_brightness(atmo_post_plugin_t *this, hsv_color_t *hsv, int img_size) {
-  const int darkness_limit = this->active_parm.darkness_limit;
-  uint64_t avg = 0;
-  int cnt = 0;
+static int lookup_color_cache(atmo_cache_t *cache, xine_stream_t *stream, int max_distance) {
+  int pos_stream, pos_time, length_time;
+  int lo, hi, mid, i, best = -1;
+  int64_t d, best_d = 0;
 
-  while (img_size--) {
-    const int v = hsv->v;
-    if (v >= darkness_limit) {
-      avg += v;
-      ++cnt;
+  cache->pos = -1;
+  cache->hit = NULL;
+  if (cache->fd < 0 || !xine_get_pos_length(stream, &pos_stream, &pos_time, &length_time) || length_time <= 0 || pos_time < 0)
+    return 0;
+  cache->pos = pos_time;
+
+    /* nearest record to the displayed position */
+  lo = 0;
+  hi = cache->nrecs;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (color_cache_rec(cache, mid)->pos < pos_time)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (i = lo - 1; i <= lo; ++i) {
+    if (i < 0 || i >= cache->nrecs)
+      continue;
+    d = llabs(color_cache_rec(cache, i)->pos - pos_time);
+    if (best < 0 || d < best_d) {
+      best = i;
+      best_d = d;
     }
-    ++hsv;
   }
+  if (best < 0 || best_d > max_distance)
+    return 0;
 
-  if (cnt)
-    avg /= cnt;
-  else
-    avg = darkness_limit;
+  cache->hit = color_cache_rec(cache, best)->colors;
+  ++cache->hit_cnt;
+  return 1;
+}
 
-  avg = (avg * this->active_parm.brightness) / 100;
-  if (avg > v_MAX)
-    avg = v_MAX;
 
-  uint64_t * const avg_bright = this->avg_bright;
-  int c = this->sum_channels;
-  while (c)
-    avg_bright[--c] = avg;
+static void queue_color_cache(atmo_cache_t *cache, const rgb_color_t *colors) {
+  if (cache->pos < 0)
+    return;
+  cache->rec->pos = cache->pos;
+  memcpy(cache->rec->colors, colors, cache->hdr.nchannels * sizeof(rgb_color_t));
+  cache->pending = 1;
+}
+
+
+/*
+ * Statistics server: a unix domain socket that returns a JSON snapshot of the live state to each connecting client.
+ * The server thread only reads the snapshots published by grab and output thread and never takes the plugin lock.
+ */
+#define STATS_BUFFER_SIZE       32768
+#define STATS_WRITE_TIMEOUT     100     /* [ms] */
+
+typedef struct atmo_stats_server_s {
+  atmo_post_plugin_t *plugin;
+  char path[sizeof(((atmo_parameters_t *)0)->stats_socket)];
+  int fd;                           /* listening socket, -1 if it could not be created */
+  int cmd_fd;                       /* eventfd for stopping server thread */
+  pthread_t thread;
+  dev_t dev;                        /* identity of bound socket file */
+  ino_t ino;
+  int served_cnt;
+  thread_snapshot_t grab, output;
+  char buf[STATS_BUFFER_SIZE];
+  int len;
+} atmo_stats_server_t;
+
+
+static void stats_printf(atmo_stats_server_t *srv, const char *fmt, ...) {
+  va_list ap;
+
+  if (srv->len >= STATS_BUFFER_SIZE)
+    return;
+  va_start(ap, fmt);
+  int n = vsnprintf(srv->buf + srv->len, STATS_BUFFER_SIZE - srv->len, fmt, ap);
+  va_end(ap);
+  if (n > 0)
+    srv->len += n;
 }
 
 
-static void hsv_to_rgb(rgb_color_t *rgb, double h, double s, double v) {
-  rgb->r = rgb->g = rgb->b = 0;
+static void stats_print_hist(atmo_stats_server_t *srv, const char *name, const atmo_hist_t *h) {
+  stats_printf(srv, "\"%s\":{\"count\":%u,\"avg\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}", name, h->cnt,
+               h->cnt ? (uint32_t) (h->sum / h->cnt): 0, atmo_hist_percentile(h, 50), atmo_hist_percentile(h, 90),
+               atmo_hist_percentile(h, 99), h->max);
+}
 
-  h /= h_MAX;
-  s /= s_MAX;
-  v /= v_MAX;
 
-  if (s == 0.0) {
-    rgb->r = (uint8_t) (v * 255.0 + 0.5);
-    rgb->g = rgb->r;
-    rgb->b = rgb->r;
-  } else {
-    h = h * 6.0;
-    if (h == 6.0)
-      h = 0.0;
-    int i = (int) h;
-
-    double f = h - i;
-    double p = v * (1.0 - s);
-    double q = v * (1.0 - (s * f));
-    double t = v * (1.0 - (s * (1.0 - f)));
-
-    if (i == 0) {
-      rgb->r = (uint8_t) (v * 255.0 + 0.5);
-      rgb->g = (uint8_t) (t * 255.0 + 0.5);
-      rgb->b = (uint8_t) (p * 255.0 + 0.5);
-    } else if (i == 1) {
-      rgb->r = (uint8_t) (q * 255.0 + 0.5);
-      rgb->g = (uint8_t) (v * 255.0 + 0.5);
-      rgb->b = (uint8_t) (p * 255.0 + 0.5);
-    } else if (i == 2) {
-      rgb->r = (uint8_t) (p * 255.0 + 0.5);
-      rgb->g = (uint8_t) (v * 255.0 + 0.5);
-      rgb->b = (uint8_t) (t * 255.0 + 0.5);
-    } else if (i == 3) {
-      rgb->r = (uint8_t) (p * 255.0 + 0.5);
-      rgb->g = (uint8_t) (q * 255.0 + 0.5);
-      rgb->b = (uint8_t) (v * 255.0 + 0.5);
-    } else if (i == 4) {
-      rgb->r = (uint8_t) (t * 255.0 + 0.5);
-      rgb->g = (uint8_t) (p * 255.0 + 0.5);
-      rgb->b = (uint8_t) (v * 255.0 + 0.5);
-    } else {
-      rgb->r = (uint8_t) (v * 255.0 + 0.5);
-      rgb->g = (uint8_t) (p * 255.0 + 0.5);
-      rgb->b = (uint8_t) (q * 255.0 + 0.5);
+static void stats_print_thread(atmo_stats_server_t *srv, const thread_snapshot_t *snap, const char **stat_names, int nstats, int64_t now) {
+  int i;
+
+  stats_printf(srv, "\"state\":\"%s\",\"age\":%lld,\"rate\":%.1f,\"stats_period\":%lld,\"stages\":{",
+               thread_state_names[snap->state], snap->timestamp ? (long long) (now - snap->timestamp) / 1000: -1LL,
+               snap->rate, snap->stats_start ? (long long) (now - snap->stats_start) / 1000: 0LL);
+  for (i = 0; i < nstats; ++i) {
+    if (i)
+      stats_printf(srv, ",");
+    stats_print_hist(srv, stat_names[i], &snap->hist[i]);
+  }
+  stats_printf(srv, "}");
+}
+
+
+static void build_stats_json(atmo_stats_server_t *srv) {
+  const thread_snapshot_t *grab = &srv->grab, *out = &srv->output;
+  const int64_t now = atmo_hist_now();
+  int i;
+
+  read_snapshot(&srv->plugin->grab_snapshot, &srv->grab);
+  read_snapshot(&srv->plugin->output_snapshot, &srv->output);
+
+  srv->len = 0;
+  stats_printf(srv, "{\"version\":1,\"timestamp\":%lld,\"grab\":{", (long long) now);
+  stats_print_thread(srv, grab, grab_stat_names, NUM_GRAB_STATS, now);
+  stats_printf(srv, ",\"analyzed\":%llu,\"unchanged\":%llu,\"failures\":%llu,\"timeouts\":%llu},\"output\":{",
+               (unsigned long long) grab->cycles, (unsigned long long) grab->unchanged,
+               (unsigned long long) grab->failures, (unsigned long long) grab->timeouts);
+  stats_print_thread(srv, out, output_stat_names, NUM_OUTPUT_STATS, now);
+  stats_printf(srv, ",\"cycles\":%llu,\"unchanged\":%llu,\"driver\":{\"name\":\"%s\",\"transfers\":%u,\"errors\":%u,\"replaced\":%u,\"queued\":%d,",
+               (unsigned long long) out->cycles, (unsigned long long) out->unchanged,
+               (out->driver >= 0 && out->driver <= NUM_DRIVERS) ? driver_enum[out->driver]: "",
+               out->driver_stats.transfers, out->driver_stats.errors, out->driver_stats.replaced, out->driver_stats.queued);
+  stats_print_hist(srv, "transmit", &out->transmit);
+  stats_printf(srv, ",");
+  stats_print_hist(srv, "glass_to_device", &out->latency);
+  stats_printf(srv, "},\"channels\":%d,\"colors\":[", out->nchannels);
+  const int n = (out->nchannels < SNAPSHOT_MAX_COLORS) ? out->nchannels: SNAPSHOT_MAX_COLORS;
+  for (i = 0; i < n; ++i)
+    stats_printf(srv, "%s[%d,%d,%d]", i ? ",": "", out->colors[i].r, out->colors[i].g, out->colors[i].b);
+  stats_printf(srv, "]}}\n");
+}
+
+
+static void *atmo_stats_server_loop(void *arg) {
+  atmo_stats_server_t *srv = (atmo_stats_server_t *) arg;
+  struct pollfd pfd[2];
+
+  pfd[0].fd = srv->cmd_fd;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = srv->fd;
+  pfd[1].events = POLLIN;
+  for (;;) {
+    if (poll(pfd, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
     }
+    if (pfd[0].revents)
+      break;
+    if (!(pfd[1].revents & POLLIN))
+      continue;
+
+    int cfd = accept4(srv->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd < 0)
+      continue;
+
+      /* a client that does not read is dropped */
+    build_stats_json(srv);
+    const char *p = srv->buf;
+    int n = (srv->len < STATS_BUFFER_SIZE) ? srv->len: STATS_BUFFER_SIZE - 1;
+    struct pollfd cpfd = { cfd, POLLOUT, 0 };
+    while (n > 0) {
+      ssize_t rc = send(cfd, p, n, MSG_NOSIGNAL);
+      if (rc > 0) {
+        p += rc;
+        n -= rc;
+      } else if (rc < 0 && errno == EINTR)
+        continue;
+      else if (rc < 0 && errno == EAGAIN && poll(&cpfd, 1, STATS_WRITE_TIMEOUT) > 0)
+        continue;
+      else
+        break;
+    }
+    close(cfd);
+    ++srv->served_cnt;
   }
+  return NULL;
 }
 
 
-static void calc_rgb_values(atmo_post_plugin_t *this)
-{
-  int c;
-  const int n = this->sum_channels;
+static atmo_stats_server_t *start_stats_server(atmo_post_plugin_t *this, const char *path) {
+  atmo_stats_server_t *srv = (atmo_stats_server_t *) calloc(1, sizeof(atmo_stats_server_t));
+  xine_t *xine = this->post_plugin.xine;
+  struct sockaddr_un addr;
+  struct stat st;
+  int err;
 
-  for (c = 0; c < n; ++c)
-    hsv_to_rgb(&this->analyzed_colors[c], this->most_used_hue[c], this->most_used_sat[c], this->avg_bright[c]);
+  if (!srv)
+    return NULL;
+  srv->plugin = this;
+  snprintf(srv->path, sizeof(srv->path), "%s", path);
+  srv->cmd_fd = -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    xine_log(xine, XINE_LOG_PLUGIN, "atmo: statistics socket path '%s' is too long\n", path);
+    srv->fd = -1;
+    return srv;
+  }
+  strcpy(addr.sun_path, path);
+
+  srv->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (srv->fd < 0) {
+    xine_log(xine, XINE_LOG_PLUGIN, "atmo: can't create statistics socket: %s\n", strerror(errno));
+    return srv;
+  }
+
+    /* a stale socket of a previous player instance is replaced, a socket another player is listening on is kept */
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe_fd < 0) {
+      xine_log(xine, XINE_LOG_PLUGIN, "atmo: can't create statistics socket: %s\n", strerror(errno));
+      goto fail;
+    }
+    err = connect(probe_fd, (struct sockaddr *) &addr, sizeof(addr)) ? errno: 0;
+    close(probe_fd);
+    if (err != ECONNREFUSED) {
+      xine_log(xine, XINE_LOG_PLUGIN, "atmo: statistics socket '%s' is in use\n", path);
+      goto fail;
+    }
+    unlink(path);
+  }
+  if (bind(srv->fd, (struct sockaddr *) &addr, sizeof(addr)) || listen(srv->fd, 4)) {
+    xine_log(xine, XINE_LOG_PLUGIN, "atmo: can't bind statistics socket '%s': %s\n", path, strerror(errno));
+    goto fail;
+  }
+  if (stat(path, &st) == 0) {
+    srv->dev = st.st_dev;
+    srv->ino = st.st_ino;
+  }
+
+  srv->cmd_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (srv->cmd_fd < 0 || (err = pthread_create(&srv->thread, NULL, atmo_stats_server_loop, srv))) {
+    xine_log(xine, XINE_LOG_PLUGIN, "atmo: can't create statistics server thread: %s\n", strerror((srv->cmd_fd < 0) ? errno: err));
+    unlink(path);
+    goto fail;
+  }
+  llprintf(LOG_1, "statistics server on '%s' started\n", path);
+  return srv;
+
+fail:
+  if (srv->cmd_fd >= 0)
+    close(srv->cmd_fd);
+  srv->cmd_fd = -1;
+  close(srv->fd);
+  srv->fd = -1;
+  return srv;
+}
+
+
+static void stop_stats_server(atmo_stats_server_t *srv) {
+  if (srv->fd >= 0) {
+    struct stat st;
+    uint64_t n = 1;
+    if (write(srv->cmd_fd, &n, sizeof(n)) != sizeof(n))
+      llprintf(LOG_1, "can't wake up statistics server thread\n");
+    pthread_join(srv->thread, NULL);
+    close(srv->cmd_fd);
+    close(srv->fd);
+      /* path may have been taken over by another player meanwhile */
+    if (stat(srv->path, &st) == 0 && st.st_dev == srv->dev && st.st_ino == srv->ino)
+      unlink(srv->path);
+    llprintf(LOG_1, "statistics server on '%s' stopped (%d requests served)\n", srv->path, srv->served_cnt);
+  }
+  free(srv);
+}
+
+
+  /* Start, stop or move statistics server according to parameter 'stats_socket' */
+static void update_stats_server(atmo_post_plugin_t *this) {
+  if (this->stats_server && strcmp(this->stats_server->path, this->parm.stats_socket)) {
+    stop_stats_server(this->stats_server);
+    this->stats_server = NULL;
+  }
+  if (!this->stats_server && this->parm.stats_socket[0])
+    this->stats_server = start_stats_server(this, this->parm.stats_socket);
+}
+
+
+  /* Compare parameters affecting the analyzed colors (the ones of the color cache header) */
+static int analysis_parameters_equal(const atmo_parameters_t *a, const atmo_parameters_t *b) {
+  return a->analyze_size == b->analyze_size && a->overscan == b->overscan && a->darkness_limit == b->darkness_limit &&
+         a->edge_weighting == b->edge_weighting && a->hue_win_size == b->hue_win_size && a->sat_win_size == b->sat_win_size &&
+         a->hue_threshold == b->hue_threshold && a->uniform_brightness == b->uniform_brightness && a->brightness == b->brightness &&
+         a->top == b->top && a->bottom == b->bottom && a->left == b->left && a->right == b->right && a->center == b->center &&
+         a->top_left == b->top_left && a->top_right == b->top_right && a->bottom_left == b->bottom_left && a->bottom_right == b->bottom_right;
 }
 
 
@@ -763,17 +1442,34 @@ static void *atmo_grab_loop (void *this_gen) {
   xine_ticket_t *ticket = this->post_plugin.running_ticket;
   post_video_port_t *port = NULL;
   xine_video_port_t *video_port = NULL;
+  xine_stream_t *stream = NULL;
   xine_grab_video_frame_t *frame = NULL;
+  atmo_parameters_t analyzed_parm;
+  int64_t last_vpts = 0;
+  int analyzed = 0, paused = 0, analyzed_cnt = 0, unchanged_cnt = 0;
+  thread_sched_t sched = { 0, 0, 0 };
+  int grab_generation, grab;
   int rc;
-  int grab_width, grab_height, analyze_width, analyze_height, overscan, img_size;
-  int last_analyze_width = 0, last_analyze_height = 0;
+  int grab_width, grab_height, analyze_width = 0, analyze_height = 0, overscan, img_size;
   int alloc_img_size = 0;
-  int edge_weighting = 0;
   hsv_color_t *hsv_img = NULL;
-  uint8_t *weight = NULL;
+  atmo_channels_t *ch;
   struct timeval tvnow, tvlast, tvdiff, tvtimeout;
-  struct timespec ts;
   int thread_state = TS_RUNNING;
+  atmo_capture_t *capture = NULL;
+  char capture_file[sizeof(this->active_parm.capture_file)];
+  atmo_cache_t *cache = NULL;
+  atmo_cache_header_t cache_hdr;
+  char mrl[sizeof(this->mrl)];
+  int color_cache, cached;
+  thread_stats_t stats;
+  int stats_request, stats_interval;
+  int64_t tstage, frame_vpts = 0;
+  atmo_trace_tag_t trace_tag;
+  thread_snapshot_t snap;
+
+  memset(&trace_tag, 0, sizeof(trace_tag));
+  memset(&snap, 0, sizeof(snap));
 
   pthread_mutex_lock(&this->lock);
   this->grab_thread_state = &thread_state;
@@ -786,6 +1482,7 @@ static void *atmo_grab_loop (void *this_gen) {
 
   pthread_mutex_lock(&this->lock);
 
+  init_thread_stats(&stats, "grab", grab_stat_names, NUM_GRAB_STATS, this->stats_request);
   gettimeofday(&tvlast, NULL);
 
   for (;;) {
@@ -794,16 +1491,15 @@ static void *atmo_grab_loop (void *this_gen) {
     tvdiff.tv_sec = 0;
     tvdiff.tv_usec = this->active_parm.analyze_rate * 1000;
     timeradd(&tvlast, &tvdiff, &tvtimeout);
+    wait_for_thread_command(this, this->grab_cmd_fd, &tvtimeout);
     gettimeofday(&tvnow, NULL);
-    if (timercmp(&tvtimeout, &tvnow, >)) {
-      ts.tv_sec  = tvtimeout.tv_sec;
-      ts.tv_nsec = tvtimeout.tv_usec;
-      ts.tv_nsec *= 1000;
-      pthread_cond_timedwait(&this->thread_state_change, &this->lock, &ts);
-      gettimeofday(&tvnow, NULL);
-    }
     tvlast = tvnow;
 
+    if (snapshot_due(&snap)) {
+      snap.state = thread_state;
+      publish_snapshot(&this->grab_snapshot, &snap, &stats);
+    }
+
     if (thread_state == TS_STOP)
       break;
 
@@ -839,7 +1535,8 @@ static void *atmo_grab_loop (void *this_gen) {
       thread_state = TS_SUSPENDED;
       pthread_cond_broadcast(&this->thread_state_change);
 
-      llprintf(LOG_1, "grab thread suspended\n");
+      llprintf(LOG_1, "grab thread suspended (%d frames analyzed, %d unchanged frames skipped)\n", analyzed_cnt, unchanged_cnt);
+      analyzed_cnt = unchanged_cnt = 0;
     }
 
     if (thread_state == TS_SUSPENDED || !this->port)
@@ -863,117 +1560,248 @@ static void *atmo_grab_loop (void *this_gen) {
         break;
       }
 
+      analyzed = 0;
+      paused = 0;
       llprintf(LOG_1, "grab thread resumed\n");
     }
 
+    stream = port->stream;
+
+    grab_generation = this->grab_generation;
+    memcpy(capture_file, this->active_parm.capture_file, sizeof(capture_file));
+    stats_request = this->stats_request;
+    stats_interval = this->active_parm.stats_interval;
+    color_cache = this->active_parm.color_cache;
+    if (color_cache)
+      init_color_cache_header(&cache_hdr, &this->active_parm, this->channels);
+    memcpy(mrl, this->mrl, sizeof(mrl));
     pthread_mutex_unlock(&this->lock);
 
-      /* get actual displayed image size */
-    grab_width = video_port->get_property(video_port, VO_PROP_WINDOW_WIDTH);
-    grab_height = video_port->get_property(video_port, VO_PROP_WINDOW_HEIGHT);
-    if (grab_width > 0 && grab_height > 0) {
-
-        /* calculate size of analyze image */
-      analyze_width = (this->active_parm.analyze_size + 1) * 64;
-      analyze_height = (analyze_width * grab_height) / grab_width;
-
-        /* calculate size of grab (sub) window */
-      overscan = this->active_parm.overscan;
-      if (overscan) {
-        frame->crop_left = frame->crop_right = grab_width * overscan / 1000;
-        frame->crop_top = frame->crop_bottom = grab_height * overscan / 1000;
-        grab_width = grab_width - frame->crop_left - frame->crop_right;
-        grab_height = grab_height - frame->crop_top - frame->crop_bottom;
-      } else {
-        frame->crop_bottom = 0;
-        frame->crop_top = 0;
-        frame->crop_left =  0;
-        frame->crop_right = 0;
+    report_thread_stats(this, &stats, stats_request, stats_interval, NULL);
+
+      /* start or stop capture of analyze images */
+    if (capture && strcmp(capture->path, capture_file)) {
+      stop_capture(capture);
+      capture = NULL;
+    }
+    if (!capture && capture_file[0])
+      capture = start_capture(this->post_plugin.xine, capture_file);
+
+      /* open, switch or close color cache of played media file */
+    if (!color_cache || !cache_hdr.nchannels)
+      mrl[0] = 0;
+    if (cache && (!mrl[0] || strcmp(cache->mrl, mrl) || memcmp(&cache->hdr, &cache_hdr, sizeof(cache_hdr)))) {
+      close_color_cache(cache);
+      cache = NULL;
+    }
+    if (!cache && mrl[0])
+      cache = open_color_cache(this->post_plugin.xine, mrl, &cache_hdr);
+    if (cache)
+      write_color_cache(cache);
+
+    set_thread_sched(this, "grab", &sched, 0, 0, this->active_parm.grab_cpus);
+
+    rc = 1;
+    cached = 0;
+
+      /* no new frames are displayed while playback is paused so stop grabbing until it is resumed */
+    if (xine_get_param(stream, XINE_PARAM_SPEED) == XINE_SPEED_PAUSE) {
+      if (!paused) {
+        paused = 1;
+        llprintf(LOG_1, "grab thread paused\n");
+      }
+    } else {
+      if (paused) {
+        paused = 0;
+        llprintf(LOG_1, "grab thread continued\n");
       }
 
-        /* grab displayed video frame */
-      frame->timeout = GRAB_TIMEOUT;
-      frame->width = analyze_width;
-      frame->height = analyze_height;
-      frame->flags = XINE_GRAB_VIDEO_FRAME_FLAGS_CONTINUOUS | XINE_GRAB_VIDEO_FRAME_FLAGS_WAIT_NEXT;
-      if (!(rc = frame->grab(frame))) {
-        if (frame->width == analyze_width && frame->height == analyze_height) {
-          img_size = analyze_width * analyze_height;
-
-            /* allocate hsv and weight images */
-          if (img_size > alloc_img_size) {
-            free(hsv_img);
-            free(weight);
-            alloc_img_size = img_size;
-            hsv_img = (hsv_color_t *) malloc(img_size * sizeof(hsv_color_t));
-            weight = (uint8_t *) malloc(img_size * this->sum_channels * sizeof(uint8_t));
-            if (!hsv_img || !weight) {
-              pthread_mutex_lock(&this->lock);
-              break;
-            }
-            last_analyze_width = 0;
-            last_analyze_height = 0;
-            edge_weighting = 0;
-          }
+        /* colors of a cached position need no grab and analysis */
+      cached = cache && lookup_color_cache(cache, stream, 2 * this->active_parm.analyze_rate);
+
+        /* get actual displayed image size */
+      grab_width = video_port->get_property(video_port, VO_PROP_WINDOW_WIDTH);
+      grab_height = video_port->get_property(video_port, VO_PROP_WINDOW_HEIGHT);
+      if (cached) {
+        metronom_clock_t *clock = this->post_plugin.xine->clock;
+        frame_vpts = clock->get_current_time(clock);
+        memset(&trace_tag, 0, sizeof(trace_tag));
+        trace_tag.grab = atmo_hist_now();
+        rc = 0;
+      } else if (grab_width > 0 && grab_height > 0) {
+
+          /* calculate size of analyze image */
+        analyze_width = (this->active_parm.analyze_size + 1) * 64;
+        analyze_height = (analyze_width * grab_height) / grab_width;
+
+          /* calculate size of grab (sub) window */
+        overscan = this->active_parm.overscan;
+        if (overscan) {
+          frame->crop_left = frame->crop_right = grab_width * overscan / 1000;
+          frame->crop_top = frame->crop_bottom = grab_height * overscan / 1000;
+          grab_width = grab_width - frame->crop_left - frame->crop_right;
+          grab_height = grab_height - frame->crop_top - frame->crop_bottom;
+        } else {
+          frame->crop_bottom = 0;
+          frame->crop_top = 0;
+          frame->crop_left =  0;
+          frame->crop_right = 0;
+        }
 
-            /* calculate weight image */
-          if (analyze_width != last_analyze_width || analyze_height != last_analyze_height || edge_weighting != this->active_parm.edge_weighting) {
-            edge_weighting = this->active_parm.edge_weighting;
-            last_analyze_width = analyze_width;
-            last_analyze_height = analyze_height;
-            calc_weight(this, weight, analyze_width, analyze_height, edge_weighting);
-            llprintf(LOG_1, "analyze size %dx%d, grab %dx%d@%d,%d\n", analyze_width, analyze_height, grab_width, grab_height, frame->crop_left, frame->crop_top);
-          }
+          /* grab displayed video frame */
+        frame->timeout = GRAB_TIMEOUT;
+        frame->width = analyze_width;
+        frame->height = analyze_height;
+        frame->flags = XINE_GRAB_VIDEO_FRAME_FLAGS_CONTINUOUS | XINE_GRAB_VIDEO_FRAME_FLAGS_WAIT_NEXT;
 
-            /* analyze grabbed image */
-          calc_hsv_image(hsv_img, frame->img, img_size);
-          calc_hue_hist(this, hsv_img, weight, img_size);
-          calc_windowed_hue_hist(this);
-          calc_most_used_hue(this);
-          calc_sat_hist(this, hsv_img, weight, img_size);
-          calc_windowed_sat_hist(this);
-          calc_most_used_sat(this);
-          if (this->active_parm.uniform_brightness)
-            calc_uniform_average_brightness(this, hsv_img, img_size);
-          else
-            calc_average_brightness(this, hsv_img, weight, img_size);
-          pthread_mutex_lock(&this->lock);
-          calc_rgb_values(this);
-          llprintf(LOG_2, "grab %ld.%03ld: vpts=%ld\n", tvlast.tv_sec, tvlast.tv_usec / 1000, frame->vpts);
-          continue;
+          /*
+           * xine has no way to cancel a grab. Control functions do not wait for the end of a grab that is in
+           * progress, its result is dropped. All other stream accesses are waited for.
+           */
+        pthread_mutex_lock(&this->lock);
+        grab = (thread_state == TS_RUNNING);
+        this->grab_in_progress = grab;
+        grab_generation = this->grab_generation;
+        pthread_mutex_unlock(&this->lock);
+
+        tstage = atmo_hist_now();
+        rc = grab ? frame->grab(frame): 1;
+        atmo_hist_add_since(&stats.hist[GRAB_STAT_GRAB], &tstage);
+
+        pthread_mutex_lock(&this->lock);
+        this->grab_in_progress = 0;
+        pthread_mutex_unlock(&this->lock);
+        if (rc) {
+          if (rc < 0) {
+            ++snap.failures;
+            llprintf(LOG_1, "grab failed!\n");
+          }
+          if (rc > 0) {
+            ++snap.timeouts;
+            llprintf(LOG_2, "grab timed out!\n");
+          }
+        } else if (frame->width != analyze_width || frame->height != analyze_height)
+          rc = 1;
+        else {
+            /* estimate when the frame appeared on screen from the distance of the current clock to its vpts */
+          metronom_clock_t *clock = this->post_plugin.xine->clock;
+          const int64_t age = clock->get_current_time(clock) - frame->vpts;
+          trace_tag.grab = tstage;
+          trace_tag.display = (age >= 0 && age < 90000) ? tstage - age * 100 / 9: 0;
         }
-      } else {
-        if (rc < 0)
-          llprintf(LOG_1, "grab failed!\n");
-        if (rc > 0)
-          llprintf(LOG_2, "grab timed out!\n");
       }
     }
 
     pthread_mutex_lock(&this->lock);
 
-#if 0
-    {
-      gettimeofday(&tvnow, NULL);
-      timersub(&tvnow, &tvlast, &tvdiff);
-      static uint64_t sum_us, peak_us, call_cnt;
-      uint64_t diff_us = tvdiff.tv_sec * 1000000 + tvdiff.tv_usec;
-      if (diff_us > peak_us)
-        peak_us = diff_us;
-      if (call_cnt >= (50*60*3) || peak_us >= 100000) {
-        if (call_cnt)
-          sum_us /= call_cnt;
-        printf("%s: (%s:%d) peak: %.3lf ms  avg: %.3lf ms  calls: %d\n", LOG_MODULE, __XINE_FUNCTION__, __LINE__, ((double)peak_us)/1000.0, ((double)sum_us)/1000.0, (int)call_cnt);
-        call_cnt = sum_us = peak_us = 0;
+    if (grab_generation != this->grab_generation) {
+        /* grab was cancelled, start again with new grab frame */
+      frame->dispose(frame);
+      frame = NULL;
+      llprintf(LOG_1, "grab cancelled\n");
+      continue;
+    }
+
+    if (rc || thread_state != TS_RUNNING)
+      continue;
+
+    if (cached) {
+      ++snap.cycles;
+      analyzed = 0;
+      ch = this->channels;
+      if (ch && ch->sum_channels == cache->hdr.nchannels) {
+        memcpy(ch->analyzed_colors, cache->hit, ch->sum_channels * sizeof(rgb_color_t));
+        ch->analyzed_vpts = frame_vpts;
+        ch->analyzed_tag = trace_tag;
+        ch->analyzed_tag.analyzed = atmo_hist_now();
       }
-      sum_us += diff_us;
-      ++call_cnt;
+      llprintf(LOG_2, "grab %ld.%03ld: vpts=%ld cached\n", tvlast.tv_sec, tvlast.tv_usec / 1000, frame_vpts);
+      continue;
     }
-#endif
+
+    img_size = analyze_width * analyze_height;
+
+      /* skip analysis if displayed frame and analysis parameters have not changed since last analysis */
+    if (analyzed && frame->vpts == last_vpts && analysis_parameters_equal(&analyzed_parm, &this->active_parm)) {
+      ++unchanged_cnt;
+      ++snap.unchanged;
+      llprintf(LOG_2, "grab %ld.%03ld: vpts=%ld unchanged\n", tvlast.tv_sec, tvlast.tv_usec / 1000, frame->vpts);
+      continue;
+    }
+    last_vpts = frame->vpts;
+    analyzed_parm = this->active_parm;
+    analyzed = 1;
+    ++analyzed_cnt;
+    ++snap.cycles;
+
+    ch = this->channels;
+    if (!ch || !ch->sum_channels)
+      continue;
+    ++ch->refs;
+    pthread_mutex_unlock(&this->lock);
+
+    if (capture)
+      queue_capture_frame(capture, frame, analyze_width, analyze_height, grab_width, grab_height);
+
+      /* allocate hsv image */
+    if (img_size > alloc_img_size) {
+      free(hsv_img);
+      alloc_img_size = img_size;
+      hsv_img = (hsv_color_t *) malloc(img_size * sizeof(hsv_color_t));
+      if (!hsv_img) {
+        pthread_mutex_lock(&this->lock);
+        unref_channels(ch);
+        break;
+      }
+    }
+
+      /* calculate weight image */
+    if (analyze_width != ch->weight_width || analyze_height != ch->weight_height || this->active_parm.edge_weighting != ch->weight_edge_weighting) {
+      if (update_weight(ch, analyze_width, analyze_height, this->active_parm.edge_weighting)) {
+        pthread_mutex_lock(&this->lock);
+        unref_channels(ch);
+        break;
+      }
+      llprintf(LOG_1, "analyze size %dx%d, grab %dx%d@%d,%d\n", analyze_width, analyze_height, grab_width, grab_height, frame->crop_left, frame->crop_top);
+    }
+
+      /* analyze grabbed image */
+    tstage = atmo_hist_now();
+    calc_hsv_image(hsv_img, frame->img, img_size);
+    atmo_hist_add_since(&stats.hist[GRAB_STAT_HSV], &tstage);
+    calc_hue_hist(ch, &this->active_parm, hsv_img, img_size);
+    calc_windowed_hue_hist(ch, &this->active_parm);
+    calc_most_used_hue(ch, &this->active_parm);
+    atmo_hist_add_since(&stats.hist[GRAB_STAT_HUE], &tstage);
+    calc_sat_hist(ch, &this->active_parm, hsv_img, img_size);
+    calc_windowed_sat_hist(ch, &this->active_parm);
+    calc_most_used_sat(ch);
+    atmo_hist_add_since(&stats.hist[GRAB_STAT_SAT], &tstage);
+    if (this->active_parm.uniform_brightness)
+      calc_uniform_average_brightness(ch, &this->active_parm, hsv_img, img_size);
+    else
+      calc_average_brightness(ch, &this->active_parm, hsv_img, img_size);
+    atmo_hist_add_since(&stats.hist[GRAB_STAT_BRIGHTNESS], &tstage);
+    pthread_mutex_lock(&this->lock);
+      /* drop result if channel layout has been changed meanwhile */
+    if (ch == this->channels) {
+      calc_rgb_values(ch);
+      if (cache && ch->sum_channels == cache->hdr.nchannels)
+        queue_color_cache(cache, ch->analyzed_colors);
+      ch->analyzed_vpts = frame->vpts;
+      ch->analyzed_tag = trace_tag;
+      ch->analyzed_tag.analyzed = atmo_hist_now();
+    }
+    unref_channels(ch);
+    llprintf(LOG_2, "grab %ld.%03ld: vpts=%ld\n", tvlast.tv_sec, tvlast.tv_usec / 1000, frame->vpts);
+
   }
 
   llprintf(LOG_1, "grab thread terminating\n");
 
+  snap.state = TS_STOP;
+  publish_snapshot(&this->grab_snapshot, &snap, &stats);
+
     /* free grab frame */
   if (frame) {
     frame->dispose(frame);
@@ -985,7 +1813,12 @@ static void *atmo_grab_loop (void *this_gen) {
   pthread_mutex_unlock(&this->lock);
 
   free(hsv_img);
-  free(weight);
+
+  if (capture)
+    stop_capture(capture);
+
+  if (cache)
+    close_color_cache(cache);
 
   if (port)
     _x_post_dec_usage(port);
@@ -998,118 +1831,262 @@ static void *atmo_grab_loop (void *this_gen) {
 }
 
 
-static void reset_filters(atmo_post_plugin_t *this) {
-  this->old_mean_length = 0;
+static void apply_white_calibration(atmo_channels_t *ch, const atmo_parameters_t *parm) {
+  const int wc_red = parm->wc_red;
+  const int wc_green = parm->wc_green;
+  const int wc_blue = parm->wc_blue;
+  if (wc_red == 255 && wc_green == 255 && wc_blue == 255)
+    return;
+
+  rgb16_color_t *out = ch->output_colors16;
+  int n = ch->sum_channels;
+  while (n--) {
+    out->r = (uint16_t)((int)out->r * wc_red / 255);
+    out->g = (uint16_t)((int)out->g * wc_green / 255);
+    out->b = (uint16_t)((int)out->b * wc_blue / 255);
+    ++out;
+  }
 }
 
 
-static void percent_filter(atmo_post_plugin_t *this) {
-  rgb_color_t *act = this->analyzed_colors;
-  rgb_color_t *out = this->filtered_colors;
-  const int old_p = this->active_parm.filter_smoothness;
-  const int new_p = 100 - old_p;
-  int n = this->sum_channels;
+static void apply_gamma_correction(atmo_channels_t *ch, const atmo_parameters_t *parm) {
+  const int igamma = parm->gamma;
+  if (igamma <= 10)
+    return;
 
+  const double gamma = (double)igamma / 10.0;
+  const double max = 0xff00;
+  rgb16_color_t *out = ch->output_colors16;
+  int n = ch->sum_channels;
   while (n--) {
-    out->r = (act->r * new_p + out->r * old_p) / 100;
-    out->g = (act->g * new_p + out->g * old_p) / 100;
-    out->b = (act->b * new_p + out->b * old_p) / 100;
-    ++act;
+    out->r = (uint16_t)(pow((double)out->r / max, gamma) * max);
+    out->g = (uint16_t)(pow((double)out->g / max, gamma) * max);
+    out->b = (uint16_t)(pow((double)out->b / max, gamma) * max);
     ++out;
   }
 }
 
 
-static void mean_filter(atmo_post_plugin_t *this) {
-  rgb_color_t *act = this->analyzed_colors;
-  rgb_color_t *out = this->filtered_colors;
-  rgb_color_t *mean_values = this->mean_filter_values;
-  rgb_color_sum_t *mean_sums = this->mean_filter_sum_values;
-  const int64_t mean_threshold = (int64_t) ((double) this->active_parm.filter_threshold * 3.6);
-  const int old_p = this->active_parm.filter_smoothness;
-  const int new_p = 100 - old_p;
-  int n = this->sum_channels;
-  const int filter_length = this->active_parm.filter_length;
-  const int64_t mean_length = (filter_length < OUTPUT_RATE) ? 1: filter_length / OUTPUT_RATE;
-  const int reinitialize = ((int)mean_length != this->old_mean_length);
-  this->old_mean_length = (int)mean_length;
+static void get_parm_layout(const atmo_parameters_t *parm, int *cnt) {
+  cnt[0] = parm->top;
+  cnt[1] = parm->bottom;
+  cnt[2] = parm->left;
+  cnt[3] = parm->right;
+  cnt[4] = parm->center;
+  cnt[5] = parm->top_left;
+  cnt[6] = parm->top_right;
+  cnt[7] = parm->bottom_left;
+  cnt[8] = parm->bottom_right;
+}
 
-  while (n--) {
-    mean_sums->r += (act->r - mean_values->r);
-    mean_values->r = (uint8_t) (mean_sums->r / mean_length);
 
-    mean_sums->g += (act->g - mean_values->g);
-    mean_values->g = (uint8_t) (mean_sums->g / mean_length);
+static void set_parm_layout(atmo_parameters_t *parm, const int *cnt) {
+  parm->top = cnt[0];
+  parm->bottom = cnt[1];
+  parm->left = cnt[2];
+  parm->right = cnt[3];
+  parm->center = cnt[4];
+  parm->top_left = cnt[5];
+  parm->top_right = cnt[6];
+  parm->bottom_left = cnt[7];
+  parm->bottom_right = cnt[8];
+}
 
-    mean_sums->b += (act->b - mean_values->b);
-    mean_values->b = (uint8_t) (mean_sums->b / mean_length);
 
-      /*
-       * check, if there is a jump -> check if differences between actual values and filter values are too big
-       */
-    int64_t dist = (int64_t)(mean_values->r - act->r) * (int64_t)(mean_values->r - act->r) +
-                    (int64_t)(mean_values->g - act->g) * (int64_t)(mean_values->g - act->g) +
-                    (int64_t)(mean_values->b - act->b) * (int64_t)(mean_values->b - act->b);
-
-    if (dist > 0)
-      dist = (int64_t) sqrt((double) dist);
-
-      /* compare calculated distance with the filter threshold */
-    if (dist > mean_threshold || reinitialize) {
-        /* filter jump detected -> set the long filters to the result of the short filters */
-      *out = *act;
-      *mean_values = *act;
-      mean_sums->r = act->r * mean_length;
-      mean_sums->g = act->g * mean_length;
-      mean_sums->b = act->b * mean_length;
+/*
+ * Map each section of sink layout to the section of main layout at the same position.
+ * Sections of areas that are not analyzed are mapped to -1.
+ */
+static int map_sink_layout(const int *main_cnt, const int *cnt, int *map) {
+  int a, s, c = 0, main_c = 0;
+
+  for (a = 0; a < NUM_AREAS; ++a) {
+    for (s = 0; s < cnt[a] && c < MAX_SINK_CHANNELS; ++s)
+      map[c++] = (main_cnt[a]) ? main_c + ((2 * s + 1) * main_cnt[a]) / (2 * cnt[a]): -1;
+    main_c += main_cnt[a];
+  }
+  return c;
+}
+
+
+static void *atmo_sink_loop(void *this_gen) {
+  atmo_sink_t *sink = (atmo_sink_t *) this_gen;
+  output_driver_t *output_driver = sink->output_driver;
+  rgb_color_t main_colors[MAX_SINK_CHANNELS], colors[MAX_SINK_CHANNELS], last_colors[MAX_SINK_CHANNELS];
+  int main_layout[NUM_AREAS], layout[NUM_AREAS], map[MAX_SINK_CHANNELS];
+  int n = 0, sent = 0, c;
+  int64_t vpts;
+
+  memset(main_layout, 0, sizeof(main_layout));
+  memset(last_colors, 0, sizeof(last_colors));
+
+  pthread_mutex_lock(&sink->lock);
+  for (;;) {
+    if (!sink->queued) {
+      if (!sink->running)
+        break;
+      pthread_cond_wait(&sink->colors_ready, &sink->lock);
+      continue;
     }
-    else
-    {
-        /* apply an additional percent filter */
-      out->r = (mean_values->r * new_p + out->r * old_p) / 100;
-      out->g = (mean_values->g * new_p + out->g * old_p) / 100;
-      out->b = (mean_values->b * new_p + out->b * old_p) / 100;
+
+    const int layout_changed = memcmp(main_layout, sink->queued_layout, sizeof(main_layout));
+    memcpy(main_layout, sink->queued_layout, sizeof(main_layout));
+    memcpy(main_colors, sink->queued_colors, sizeof(main_colors));
+    vpts = sink->queued_vpts;
+    sink->queued = 0;
+    pthread_mutex_unlock(&sink->lock);
+
+    if (layout_changed) {
+      if (!sink->own_layout) {
+        atmo_parameters_t parm = sink->parm;
+        set_parm_layout(&parm, main_layout);
+        if (output_driver->configure(output_driver, &parm))
+          xine_log(sink->xine, XINE_LOG_PLUGIN, "atmo: sink %d: could not change channel layout: %s\n", sink->id, output_driver->errmsg);
+        else
+          sink->parm = parm;
+      }
+      get_parm_layout(&sink->parm, layout);
+      n = map_sink_layout(main_layout, layout, map);
+      sent = 0;
     }
 
-    ++act;
-    ++out;
-    ++mean_sums;
-    ++mean_values;
+    for (c = 0; c < n; ++c) {
+      if (map[c] < 0)
+        memset(&colors[c], 0, sizeof(rgb_color_t));
+      else
+        colors[c] = main_colors[map[c]];
+    }
+
+    if (!sent || memcmp(colors, last_colors, n * sizeof(rgb_color_t))) {
+      output_driver->vpts = vpts;
+      output_driver->output_colors(output_driver, colors, (sent) ? last_colors: NULL);
+      memcpy(last_colors, colors, n * sizeof(rgb_color_t));
+      sent = 1;
+    }
+
+    pthread_mutex_lock(&sink->lock);
   }
+  pthread_mutex_unlock(&sink->lock);
+
+  return NULL;
 }
 
 
-static void apply_white_calibration(atmo_post_plugin_t *this) {
-  const int wc_red = this->active_parm.wc_red;
-  const int wc_green = this->active_parm.wc_green;
-  const int wc_blue = this->active_parm.wc_blue;
-  if (wc_red == 255 && wc_green == 255 && wc_blue == 255)
-    return;
+  /* Queue output colors of main layout for all sinks */
+static void queue_sink_colors(atmo_sink_t *sink, atmo_channels_t *ch, rgb_color_t *colors, int64_t vpts) {
+  const int n = (ch->sum_channels < MAX_SINK_CHANNELS) ? ch->sum_channels: MAX_SINK_CHANNELS;
+
+  while (sink) {
+    pthread_mutex_lock(&sink->lock);
+    if (sink->queued)
+      ++sink->replaced_cnt;
+    get_channels_layout(ch, sink->queued_layout);
+    memcpy(sink->queued_colors, colors, n * sizeof(rgb_color_t));
+    sink->queued_vpts = vpts;
+    sink->queued = 1;
+    pthread_cond_signal(&sink->colors_ready);
+    pthread_mutex_unlock(&sink->lock);
+    sink = sink->next;
+  }
+}
 
-  rgb_color_t *out = this->output_colors;
-  int n = this->sum_channels;
-  while (n--) {
-    out->r = (uint8_t)((int)out->r * wc_red / 255);
-    out->g = (uint8_t)((int)out->g * wc_green / 255);
-    out->b = (uint8_t)((int)out->b * wc_blue / 255);
-    ++out;
+
+static void close_sinks(atmo_post_plugin_t *this) {
+  atmo_sink_t *sink;
+
+  while ((sink = this->sinks)) {
+    this->sinks = sink->next;
+
+    pthread_mutex_lock(&sink->lock);
+    sink->running = 0;
+    pthread_cond_signal(&sink->colors_ready);
+    pthread_mutex_unlock(&sink->lock);
+    pthread_join(sink->thread, NULL);
+    pthread_cond_destroy(&sink->colors_ready);
+    pthread_mutex_destroy(&sink->lock);
+
+    if (sink->output_driver->close(sink->output_driver))
+      xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo: sink %d: output driver: %s!\n", sink->id, sink->output_driver->errmsg);
+    llprintf(LOG_1, "sink %d closed: %d replaced colors\n", sink->id, sink->replaced_cnt);
+    free(sink);
   }
 }
 
 
-static void apply_gamma_correction(atmo_post_plugin_t *this) {
-  const int igamma = this->active_parm.gamma;
-  if (igamma <= 10)
-    return;
+/*
+ * Open sinks of '|' separated list 'driver:driver_param'.
+ * Layout options 'top=' ... 'bottom_right=' within driver parameter define an own sink layout.
+ */
+static void open_sinks(atmo_post_plugin_t *this) {
+  static const char *area_names[NUM_AREAS] = { "top", "bottom", "left", "right", "center", "top_left", "top_right", "bottom_left", "bottom_right" };
+  atmo_sink_t **last = &this->sinks;
+  const char *p = this->parm.sinks;
+  int id = 0, a, d;
+
+  while (p && *p) {
+    const char *e = strchr(p, '|');
+    const size_t len = (e) ? (size_t)(e - p): strlen(p);
+    const char *sep = memchr(p, ':', len);
+    const size_t name_len = (sep) ? (size_t)(sep - p): len;
+    ++id;
+
+    for (d = 1; d <= NUM_DRIVERS; ++d) {
+      if (strlen(driver_enum[d]) == name_len && !strncmp(p, driver_enum[d], name_len))
+        break;
+    }
 
-  const double gamma = (double)igamma / 10.0;
-  rgb_color_t *out = this->output_colors;
-  int n = this->sum_channels;
-  while (n--) {
-    out->r = (uint8_t)(pow((double)out->r / 255.0, gamma) * 255.0);
-    out->g = (uint8_t)(pow((double)out->g / 255.0, gamma) * 255.0);
-    out->b = (uint8_t)(pow((double)out->b / 255.0, gamma) * 255.0);
-    ++out;
+    atmo_sink_t *sink = (d <= NUM_DRIVERS) ? (atmo_sink_t *) calloc(1, sizeof(atmo_sink_t)): NULL;
+    if (!sink) {
+      xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo: sink %d: no valid output driver selected!\n", id);
+      p = (e) ? e + 1: NULL;
+      continue;
+    }
+
+    sink->id = id;
+    sink->xine = this->post_plugin.xine;
+    sink->parm = this->parm;
+    sink->parm.driver = d;
+    snprintf(sink->parm.driver_param, sizeof(sink->parm.driver_param), "%.*s", (sep) ? (int)(len - name_len - 1): 0, (sep) ? sep + 1: "");
+
+    const char *options = get_driver_options(sink->parm.driver_param);
+    int cnt[NUM_AREAS];
+    get_parm_layout(&this->parm, cnt);
+    for (a = 0; a < NUM_AREAS; ++a) {
+      if (get_driver_option(options, area_names[a], NULL, 0))
+        sink->own_layout = 1;
+    }
+    if (sink->own_layout) {
+      for (a = 0; a < NUM_AREAS; ++a) {
+        cnt[a] = get_driver_int_option(options, area_names[a], 0);
+        cnt[a] = (cnt[a] < 0) ? 0: ((cnt[a] > 25) ? 25: cnt[a]);
+      }
+    }
+    set_parm_layout(&sink->parm, cnt);
+
+    sink->output_driver = get_output_driver(&sink->output_drivers, d);
+    if (sink->output_driver->open(sink->output_driver, &sink->parm)) {
+      xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo: sink %d: can't open output driver: %s!\n", id, sink->output_driver->errmsg);
+      free(sink);
+      p = (e) ? e + 1: NULL;
+      continue;
+    }
+
+    pthread_mutex_init(&sink->lock, NULL);
+    pthread_cond_init(&sink->colors_ready, NULL);
+    sink->running = 1;
+    int rc = pthread_create(&sink->thread, NULL, atmo_sink_loop, sink);
+    if (rc) {
+      xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo: sink %d: can't create thread: %s\n", id, strerror(rc));
+      sink->output_driver->close(sink->output_driver);
+      pthread_cond_destroy(&sink->colors_ready);
+      pthread_mutex_destroy(&sink->lock);
+      free(sink);
+    } else {
+      *last = sink;
+      last = &sink->next;
+      llprintf(LOG_1, "sink %d: output driver '%s' opened\n", id, driver_enum[d]);
+    }
+    p = (e) ? e + 1: NULL;
   }
 }
 
@@ -1119,12 +2096,20 @@ static void *atmo_output_loop (void *this_gen) {
   xine_ticket_t *ticket = this->post_plugin.running_ticket;
   post_video_port_t *port = NULL;
   output_driver_t *output_driver = NULL;
-  int colors_size = 0, init = 1;
-  int delay_filter_queue_length = 0, delay_filter_queue_pos = 0, filter_delay = 0;
-  rgb_color_t *delay_filter_queue = NULL;
-  struct timeval tvnow, tvlast, tvdiff, tvtimeout, tvfirst;
-  struct timespec ts;
+  int colors_size = 0, colors16_size = 0, init = 1, send_initial_colors = 0, dither_output = 0, dithered, changed;
+  int delay_filter_queue_length = 0, delay_filter_queue_pos = 0, delay_filter_queue_locked = 0, filter_delay = 0;
+  rgb16_color_t *delay_filter_queue = NULL;
+  atmo_trace_tag_t *delay_tag_queue = NULL;
+  atmo_trace_tag_t trace_tag, output_tag;
+  thread_snapshot_t snap;
+  atmo_channels_t *ch, *new_ch;
+  atmo_parameters_t parm;
+  thread_sched_t sched = { 0, 0, 0 };
+  struct timeval tvnow, tvlast, tvdiff, tvtimeout, tvfirst, tvfilter;
   int thread_state = TS_RUNNING;
+  thread_stats_t stats;
+  int stats_request, stats_interval;
+  int64_t tstage;
 
   pthread_mutex_lock(&this->lock);
   this->output_thread_state = &thread_state;
@@ -1137,34 +2122,43 @@ static void *atmo_output_loop (void *this_gen) {
 
   pthread_mutex_lock(&this->lock);
 
+  init_thread_stats(&stats, "output", output_stat_names, NUM_OUTPUT_STATS, this->stats_request);
+  memset(&trace_tag, 0, sizeof(trace_tag));
+  memset(&snap, 0, sizeof(snap));
   gettimeofday(&tvlast, NULL);
 
   for (;;) {
 
       /* Loop with output rate duration */
     tvdiff.tv_sec = 0;
-    tvdiff.tv_usec = OUTPUT_RATE * 1000;
+    tvdiff.tv_usec = (this->active_parm.output_rate > 1000 / OUTPUT_RATE) ? 1000000 / this->active_parm.output_rate: OUTPUT_RATE * 1000;
     timeradd(&tvlast, &tvdiff, &tvtimeout);
+    wait_for_thread_command(this, this->output_cmd_fd, &tvtimeout);
     gettimeofday(&tvnow, NULL);
-    if (timercmp(&tvtimeout, &tvnow, >)) {
-      ts.tv_sec  = tvtimeout.tv_sec;
-      ts.tv_nsec = tvtimeout.tv_usec;
-      ts.tv_nsec *= 1000;
-      pthread_cond_timedwait(&this->thread_state_change, &this->lock, &ts);
-      gettimeofday(&tvnow, NULL);
-    }
     tvlast = tvnow;
 
+    if (snapshot_due(&snap)) {
+      snap.state = thread_state;
+      fill_output_snapshot(this, &snap);
+      publish_snapshot(&this->output_snapshot, &snap, &stats);
+    }
+
     if (thread_state == TS_STOP)
       break;
 
     if (ticket->ticket_revoked || thread_state == TS_SUSPEND) {
         /* turn lights off */
-      memset(this->output_colors, 0, colors_size);
-      if (memcmp(this->output_colors, this->last_output_colors, colors_size)) {
-        this->output_driver->output_colors(this->output_driver, this->output_colors, this->last_output_colors);
-        memset(this->last_output_colors, 0, colors_size);
+      ch = this->channels;
+      colors_size = ch->sum_channels * sizeof(rgb_color_t);
+      memset(ch->output_colors, 0, colors_size);
+      if (dither_output || memcmp(ch->output_colors, ch->last_output_colors, colors_size)) {
+          /* dithered values may differ from last output colors, so off frame is forced */
+        this->output_driver->output_colors(this->output_driver, ch->output_colors, dither_output ? NULL: ch->last_output_colors);
+        memset(ch->last_output_colors, 0, colors_size);
       }
+      queue_sink_colors(this->sinks, ch, ch->output_colors, 0);
+      dither_output = 0;
+      this->output_dithered = 0;
       init = 1;
 
       if (ticket->ticket_revoked) {
@@ -1198,6 +2192,36 @@ static void *atmo_output_loop (void *this_gen) {
     if (thread_state == TS_SUSPENDED || !this->port)
       continue;
 
+      /* adopt new channel layout between two output cycles */
+    if ((new_ch = this->pending_channels)) {
+      this->pending_channels = NULL;
+      parm = this->active_parm;
+      set_channels_layout(&parm, new_ch);
+      output_driver = this->output_driver;
+      pthread_mutex_unlock(&this->lock);
+
+      int rc = output_driver->configure(output_driver, &parm);
+
+      pthread_mutex_lock(&this->lock);
+      if (rc || !same_channels_layout(new_ch, &parm)) {
+        xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo: could not change channel layout: %s\n", rc ? output_driver->errmsg: "rejected by output driver");
+        unref_channels(new_ch);
+      } else {
+        carry_channels_state(new_ch, this->channels);
+        unref_channels(this->channels);
+        this->channels = new_ch;
+        set_channels_layout(&this->active_parm, new_ch);
+        colors_size = new_ch->sum_channels * sizeof(rgb_color_t);
+        colors16_size = new_ch->sum_channels * sizeof(rgb16_color_t);
+        filter_delay = -1;
+        send_initial_colors = 1;
+        dither_output = 0;
+        llprintf(LOG_1, "output thread changed channel layout to %d channels\n", new_ch->sum_channels);
+      }
+      if (thread_state != TS_RUNNING)
+        continue;
+    }
+
     if (port && port != this->port) {
       _x_post_dec_usage(port);
       port = NULL;
@@ -1211,98 +2235,164 @@ static void *atmo_output_loop (void *this_gen) {
       init = 0;
 
       output_driver = this->output_driver;
-      colors_size = this->sum_channels * sizeof(rgb_color_t);
-      reset_filters(this);
+      colors_size = this->channels->sum_channels * sizeof(rgb_color_t);
+      colors16_size = this->channels->sum_channels * sizeof(rgb16_color_t);
+      reset_filters(this->channels);
       filter_delay = 0;
+      send_initial_colors = this->send_initial_colors;
+      this->send_initial_colors = 0;
+      dither_output = 0;
 
       gettimeofday(&tvfirst, NULL);
+      tvfilter = tvfirst;
 
       llprintf(LOG_1, "output thread resumed\n");
     }
 
+    ch = this->channels;
+    ++ch->refs;
+
+      /*
+       * Filters run with OUTPUT_RATE. The cycles of a higher output rate in between only repeat the last
+       * colors to drivers that dither them.
+       */
+    if (timercmp(&tvnow, &tvfilter, <)) {
+      if (dither_output) {
+        pthread_mutex_unlock(&this->lock);
+        output_driver->output_colors16(output_driver, ch->output_colors16);
+        pthread_mutex_lock(&this->lock);
+      }
+      unref_channels(ch);
+      continue;
+    }
+    tvdiff.tv_sec = 0;
+    tvdiff.tv_usec = OUTPUT_RATE * 1000;
+    timeradd(&tvfilter, &tvdiff, &tvfilter);
+    if (timercmp(&tvfilter, &tvnow, <))
+      tvfilter = tvnow;
+
       /* Transfer analyzed colors into filtered colors */
+    tstage = atmo_hist_now();
     switch (this->active_parm.filter) {
     case 1:
-      percent_filter(this);
+      percent_filter(ch, &this->active_parm);
       break;
     case 2:
-      mean_filter(this);
+      mean_filter(ch, &this->active_parm);
       break;
     default:
-        /* no filtering */
-      memcpy(this->filtered_colors, this->analyzed_colors, colors_size);
+      no_filter(ch);
+    }
+    atmo_hist_add_since(&stats.hist[OUTPUT_STAT_FILTER], &tstage);
+    ++snap.cycles;
+    output_driver->vpts = ch->analyzed_vpts;
+      /* latency of an analysis result is traced from its first pickup */
+    if (ch->analyzed_tag.analyzed != trace_tag.analyzed) {
+      trace_tag = ch->analyzed_tag;
+      trace_tag.filtered = tstage;
     }
+    stats_request = this->stats_request;
+    stats_interval = this->active_parm.stats_interval;
 
     pthread_mutex_unlock(&this->lock);
 
+    report_thread_stats(this, &stats, stats_request, stats_interval, output_driver);
+
+    set_thread_sched(this, "output", &sched, this->active_parm.output_sched, this->active_parm.output_priority, this->active_parm.output_cpus);
+
+      /* send first initial color packet */
+    if (send_initial_colors) {
+      send_initial_colors = 0;
+      output_driver->output_colors(output_driver, ch->output_colors, NULL);
+      queue_sink_colors(this->sinks, ch, ch->output_colors, output_driver->vpts);
+    }
+
     timersub(&tvlast, &tvfirst, &tvdiff);
     if ((tvdiff.tv_sec * 1000 + tvdiff.tv_usec / 1000) >= this->active_parm.start_delay) {
 
         /* Initialize delay filter queue */
       if (filter_delay != this->active_parm.filter_delay) {
-        free(delay_filter_queue);
+        free_page_buffer(delay_filter_queue, delay_filter_queue_length * sizeof(rgb16_color_t), delay_filter_queue_locked);
+        free(delay_tag_queue);
+        delay_tag_queue = NULL;
         filter_delay = this->active_parm.filter_delay;
-        delay_filter_queue_length = ((filter_delay >= OUTPUT_RATE) ? filter_delay / OUTPUT_RATE + 1: 0) * this->sum_channels;
-        if (delay_filter_queue_length)
-          delay_filter_queue = (rgb_color_t *) calloc(delay_filter_queue_length, sizeof(rgb_color_t));
-        else
+        delay_filter_queue_pos = 0;
+        delay_filter_queue_length = ((filter_delay >= OUTPUT_RATE) ? filter_delay / OUTPUT_RATE + 1: 0) * ch->sum_channels;
+        if (delay_filter_queue_length) {
+          delay_filter_queue = (rgb16_color_t *) alloc_page_buffer(delay_filter_queue_length * sizeof(rgb16_color_t),
+                                                                   this->active_parm.lock_memory, &delay_filter_queue_locked);
+          delay_tag_queue = (atmo_trace_tag_t *) calloc(delay_filter_queue_length / ch->sum_channels, sizeof(atmo_trace_tag_t));
+        } else
           delay_filter_queue = NULL;
       }
 
         /* Transfer filtered colors to output colors */
+      tstage = atmo_hist_now();
       if (delay_filter_queue) {
-        int outp = delay_filter_queue_pos + this->sum_channels;
+        int outp = delay_filter_queue_pos + ch->sum_channels;
         if (outp >= delay_filter_queue_length)
           outp = 0;
 
-        memcpy(&delay_filter_queue[delay_filter_queue_pos], this->filtered_colors, colors_size);
-        memcpy(this->output_colors, &delay_filter_queue[outp], colors_size);
+        memcpy(&delay_filter_queue[delay_filter_queue_pos], ch->filtered_colors16, colors16_size);
+        memcpy(ch->output_colors16, &delay_filter_queue[outp], colors16_size);
+        if (delay_tag_queue) {
+          delay_tag_queue[delay_filter_queue_pos / ch->sum_channels] = trace_tag;
+          output_tag = delay_tag_queue[outp / ch->sum_channels];
+        } else
+          memset(&output_tag, 0, sizeof(output_tag));
 
         delay_filter_queue_pos = outp;
       }
-      else
-        memcpy(this->output_colors, this->filtered_colors, colors_size);
-
-      apply_gamma_correction(this);
-      apply_white_calibration(this);
+      else {
+        memcpy(ch->output_colors16, ch->filtered_colors16, colors16_size);
+        output_tag = trace_tag;
+      }
 
-        /* Output colors */
-      if (memcmp(this->output_colors, this->last_output_colors, colors_size)) {
-        output_driver->output_colors(output_driver, this->output_colors, this->last_output_colors);
-        memcpy(this->last_output_colors, this->output_colors, colors_size);
+      apply_gamma_correction(ch, &this->active_parm);
+      apply_white_calibration(ch, &this->active_parm);
+      round_colors(ch->output_colors, ch->output_colors16, ch->sum_channels);
+      atmo_hist_add_since(&stats.hist[OUTPUT_STAT_CORRECTION], &tstage);
+
+        /* Output colors, in high rate output mode the driver gets them every cycle at 16 bit precision */
+      changed = memcmp(ch->output_colors, ch->last_output_colors, colors_size);
+      dithered = dither_output;
+      dither_output = (output_driver->output_colors16 && this->active_parm.output_rate > 1000 / OUTPUT_RATE);
+      if (changed || dither_output || dithered) {
+        output_tag.submit = atmo_hist_now();
+        output_driver->trace_tag = output_tag;
+        if (dither_output)
+          output_driver->output_colors16(output_driver, ch->output_colors16);
+        else
+          output_driver->output_colors(output_driver, ch->output_colors, dithered ? NULL: ch->last_output_colors);
+        if (!output_driver->trace_async)
+          atmo_trace_complete(&output_driver->trace, &output_tag, atmo_hist_now());
+        memset(&output_driver->trace_tag, 0, sizeof(output_driver->trace_tag));
       }
+      if (changed) {
+        queue_sink_colors(this->sinks, ch, ch->output_colors, output_driver->vpts);
+        memcpy(ch->last_output_colors, ch->output_colors, colors_size);
+        atmo_hist_add_since(&stats.hist[OUTPUT_STAT_OUTPUT], &tstage);
+      } else
+        ++snap.unchanged;
     }
 
     pthread_mutex_lock(&this->lock);
-
-#if 0
-    {
-      gettimeofday(&tvnow, NULL);
-      timersub(&tvnow, &tvlast, &tvdiff);
-      static uint64_t sum_us, peak_us, call_cnt;
-      uint64_t diff_us = tvdiff.tv_sec * 1000000 + tvdiff.tv_usec;
-      if (diff_us > peak_us)
-        peak_us = diff_us;
-      if (call_cnt >= (50*60*3) || peak_us >= 100000) {
-        if (call_cnt)
-          sum_us /= call_cnt;
-        printf("%s: (%s:%d) peak: %.3lf ms  avg: %.3lf ms  calls: %d\n", LOG_MODULE, __XINE_FUNCTION__, __LINE__, ((double)peak_us)/1000.0, ((double)sum_us)/1000.0, (int)call_cnt);
-        call_cnt = sum_us = peak_us = 0;
-      }
-      sum_us += diff_us;
-      ++call_cnt;
-    }
-#endif
+    unref_channels(ch);
+    this->output_dithered = dither_output;
   }
 
   llprintf(LOG_1, "output thread terminating\n");
 
+  snap.state = TS_STOP;
+  publish_snapshot(&this->output_snapshot, &snap, &stats);
+
   if (this->output_thread_state == &thread_state)
     this->output_thread_state = NULL;
   pthread_cond_broadcast(&this->thread_state_change);
   pthread_mutex_unlock(&this->lock);
 
-  free(delay_filter_queue);
+  free_page_buffer(delay_filter_queue, delay_filter_queue_length * sizeof(rgb16_color_t), delay_filter_queue_locked);
+  free(delay_tag_queue);
 
   if (port)
     _x_post_dec_usage(port);
@@ -1315,62 +2405,9 @@ static void *atmo_output_loop (void *this_gen) {
 }
 
 
-static void config_channels(atmo_post_plugin_t *this) {
-  int n = this->parm.top + this->parm.bottom + this->parm.left + this->parm.right +
-          this->parm.center +
-          this->parm.top_left + this->parm.top_right + this->parm.bottom_left + this->parm.bottom_right;
-  this->sum_channels = n;
-
-  if (n)
-  {
-    this->hue_hist = (uint64_t *) calloc(n * (h_MAX + 1), sizeof(uint64_t));
-    this->w_hue_hist = (uint64_t *) calloc(n * (h_MAX + 1), sizeof(uint64_t));
-    this->most_used_hue = (int *) calloc(n, sizeof(int));
-    this->last_most_used_hue = (int *) calloc(n, sizeof(int));
-
-    this->sat_hist = (uint64_t *) calloc(n * (s_MAX + 1), sizeof(uint64_t));
-    this->w_sat_hist = (uint64_t *) calloc(n * (s_MAX + 1), sizeof(uint64_t));
-    this->most_used_sat = (int *) calloc(n, sizeof(int));
-
-    this->avg_cnt = (int *) calloc(n, sizeof(int));
-    this->avg_bright = (uint64_t *) calloc(n, sizeof(uint64_t));
-
-    this->analyzed_colors = (rgb_color_t *) calloc(n, sizeof(rgb_color_t));
-    this->filtered_colors = (rgb_color_t *) calloc(n, sizeof(rgb_color_t));
-    this->output_colors = (rgb_color_t *) calloc(n, sizeof(rgb_color_t));
-    this->last_output_colors = (rgb_color_t *) calloc(n, sizeof(rgb_color_t));
-    this->mean_filter_values = (rgb_color_t *) calloc(n, sizeof(rgb_color_t));
-    this->mean_filter_sum_values = (rgb_color_sum_t *) calloc(n, sizeof(rgb_color_sum_t));
-  }
-
-  llprintf(LOG_1, "configure channels top %d, bottom %d, left %d, right %d, center %d, topLeft %d, topRight %d, bottomLeft %d, bottomRight %d\n",
-                  this->parm.top, this->parm.bottom, this->parm.left, this->parm.right, this->parm.center,
-                  this->parm.top_left, this->parm.top_right, this->parm.bottom_left, this->parm.bottom_right);
-}
-
-
-static void free_channels(atmo_post_plugin_t *this) {
-  if (this->sum_channels)
-  {
-    free(this->hue_hist);
-    free(this->w_hue_hist);
-    free(this->most_used_hue);
-    free(this->last_most_used_hue);
-
-    free(this->sat_hist);
-    free(this->w_sat_hist);
-    free(this->most_used_sat);
-
-    free(this->avg_bright);
-    free(this->avg_cnt);
-
-    free(this->analyzed_colors);
-    free(this->filtered_colors);
-    free(this->output_colors);
-    free(this->last_output_colors);
-    free(this->mean_filter_values);
-    free(this->mean_filter_sum_values);
-  }
+static void notify_threads(atmo_post_plugin_t *this) {
+  eventfd_write(this->grab_cmd_fd, 1);
+  eventfd_write(this->output_cmd_fd, 1);
 }
 
 
@@ -1444,7 +2481,7 @@ static void start_threads(atmo_post_plugin_t *this) {
       }
     }
     if (changed)
-      pthread_cond_broadcast(&this->thread_state_change);
+      notify_threads(this);
   } while ((!grab_running || !output_running) && wait_for_thread_state_change(this));
 
   pthread_mutex_unlock(&this->lock);
@@ -1462,9 +2499,16 @@ static void suspend_threads(atmo_post_plugin_t *this) {
       if (this->grab_thread_state) {
         if (*this->grab_thread_state == TS_SUSPENDED || *this->grab_thread_state == TS_TICKET_REVOKED) {
           grab_suspended = 1;
-        } else if (*this->grab_thread_state != TS_SUSPEND) {
-          *this->grab_thread_state = TS_SUSPEND;
-          changed = 1;
+        } else {
+          if (*this->grab_thread_state != TS_SUSPEND) {
+            *this->grab_thread_state = TS_SUSPEND;
+            changed = 1;
+          }
+          if (this->grab_in_progress) {
+              /* do not wait for end of grab, result will be dropped */
+            ++this->grab_generation;
+            grab_suspended = 1;
+          }
         }
       } else {
         grab_suspended = 1;
@@ -1483,7 +2527,7 @@ static void suspend_threads(atmo_post_plugin_t *this) {
       }
     }
     if (changed)
-      pthread_cond_broadcast(&this->thread_state_change);
+      notify_threads(this);
   } while ((!grab_suspended || !output_suspended) && wait_for_thread_state_change(this));
 
   pthread_mutex_unlock(&this->lock);
@@ -1523,7 +2567,7 @@ static void stop_threads(atmo_post_plugin_t *this) {
       }
     }
     if (changed)
-      pthread_cond_broadcast(&this->thread_state_change);
+      notify_threads(this);
   } while ((!grab_stopped || !output_stopped) && wait_for_thread_state_change(this));
 
   this->grab_thread_state = NULL;
@@ -1532,17 +2576,28 @@ static void stop_threads(atmo_post_plugin_t *this) {
 }
 
 
+static void turn_lights_off(atmo_post_plugin_t *this) {
+  atmo_channels_t *ch = this->channels;
+
+  if (this->driver_opened && ch) {
+    int colors_size = ch->sum_channels * sizeof(rgb_color_t);
+    memset(ch->output_colors, 0, colors_size);
+    if (this->output_dithered || memcmp(ch->output_colors, ch->last_output_colors, colors_size)) {
+      this->output_driver->output_colors(this->output_driver, ch->output_colors, this->output_dithered ? NULL: ch->last_output_colors);
+      memset(ch->last_output_colors, 0, colors_size);
+    }
+    this->output_dithered = 0;
+    queue_sink_colors(this->sinks, ch, ch->output_colors, 0);
+  }
+}
+
+
 static void close_output_driver(atmo_post_plugin_t *this) {
 
   if (this->driver_opened) {
-    /* turn lights off */
-    int colors_size = this->sum_channels * sizeof(rgb_color_t);
-    memset(this->output_colors, 0, colors_size);
-    if (memcmp(this->output_colors, this->last_output_colors, colors_size)) {
-      this->output_driver->output_colors(this->output_driver, this->output_colors, this->last_output_colors);
-      memset(this->last_output_colors, 0, colors_size);
-    }
+    turn_lights_off(this);
 
+    close_sinks(this);
     if (this->output_driver->close(this->output_driver))
       xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo: output driver: %s!\n", this->output_driver->errmsg);
     this->driver_opened = 0;
@@ -1551,11 +2606,21 @@ static void close_output_driver(atmo_post_plugin_t *this) {
 }
 
 
+static int driver_selection_changed(atmo_post_plugin_t *this) {
+  return (this->active_parm.driver != this->parm.driver || strcmp(this->active_parm.driver_param, this->parm.driver_param) ||
+      strcmp(this->active_parm.sinks, this->parm.sinks));
+}
+
+
 static void open_output_driver(atmo_post_plugin_t *this) {
 
-  if (!this->parm.enabled || this->active_parm.driver != this->parm.driver || strcmp(this->active_parm.driver_param, this->parm.driver_param)) {
+    /* output driver session is kept open while driver selection is unchanged */
+  if (driver_selection_changed(this)) {
     stop_threads(this);
     close_output_driver(this);
+  } else if (!this->parm.enabled) {
+    stop_threads(this);
+    turn_lights_off(this);
   }
 
   if (this->parm.enabled) {
@@ -1574,6 +2639,7 @@ static void open_output_driver(atmo_post_plugin_t *this) {
         this->driver_opened = 1;
         send = 1;
         llprintf(LOG_1, "output driver opened\n");
+        open_sinks(this);
       }
     } else {
       if (this->output_driver->configure(this->output_driver, &this->parm)) {
@@ -1583,34 +2649,37 @@ static void open_output_driver(atmo_post_plugin_t *this) {
     }
 
     if (join_post_api_parameters(&atmo_param_descr, &parm, &this->parm)) {
-      char buf[512];
+      char buf[1024];
       build_post_api_parameter_string(buf, sizeof(buf), &atmo_param_descr, &this->parm, &this->default_parm);
       this->post_plugin.xine->config->update_string(this->post_plugin.xine->config, "post.atmo.parameters", buf);
     }
 
-    if (this->active_parm.top != this->parm.top ||
-                    this->active_parm.bottom != this->parm.bottom ||
-                    this->active_parm.left != this->parm.left ||
-                    this->active_parm.right != this->parm.right ||
-                    this->active_parm.center != this->parm.center ||
-                    this->active_parm.top_left != this->parm.top_left ||
-                    this->active_parm.top_right != this->parm.top_right ||
-                    this->active_parm.bottom_left != this->parm.bottom_left ||
-                    this->active_parm.bottom_right != this->parm.bottom_right) {
-      free_channels(this);
-      config_channels(this);
-      send = 1;
+    if (!this->channels || !same_channels_layout(this->channels, &this->parm)) {
+      atmo_channels_t *ch = config_channels(&this->parm);
+      if (ch) {
+        pthread_mutex_lock(&this->lock);
+        unref_channels(this->channels);
+        this->channels = ch;
+        pthread_mutex_unlock(&this->lock);
+        send = 1;
+      } else
+        start = 0;
     }
 
+      /* a pending layout change is superseded by the actual parameters */
+    pthread_mutex_lock(&this->lock);
+    unref_channels(this->pending_channels);
+    this->pending_channels = NULL;
+    pthread_mutex_unlock(&this->lock);
+
     this->active_parm = this->parm;
 
-    if (!this->sum_channels)
+    if (!this->channels || !this->channels->sum_channels)
       start = 0;
 
     if (start) {
-        /* send first initial color packet */
       if (send)
-        this->output_driver->output_colors(this->output_driver, this->output_colors, NULL);
+        this->send_initial_colors = 1;
 
       start_threads(this);
     } else
@@ -1623,9 +2692,17 @@ static void open_output_driver(atmo_post_plugin_t *this) {
  * Open/Close video port
  */
 
+static int elapsed_us(struct timespec *tsstart) {
+  struct timespec tsnow;
+  clock_gettime(CLOCK_MONOTONIC, &tsnow);
+  return (int)((tsnow.tv_sec - tsstart->tv_sec) * 1000000 + (tsnow.tv_nsec - tsstart->tv_nsec) / 1000);
+}
+
+
 static void atmo_video_open(xine_video_port_t *port_gen, xine_stream_t *stream) {
   post_video_port_t *port = (post_video_port_t *)port_gen;
   atmo_post_plugin_t *this = (atmo_post_plugin_t *) port->post;
+  struct timespec tsstart;
 
   llprintf(LOG_1, "video open\n");
   _x_post_rewire(port->post);
@@ -1636,9 +2713,16 @@ static void atmo_video_open(xine_video_port_t *port_gen, xine_stream_t *stream)
   port->stream = stream;
   this->port = port;
 
+    /* input plugin may be replaced by xine_open/xine_close at any time, grab thread uses only this copy of the mrl */
+  const char *mrl = (stream && stream->input_plugin) ? stream->input_plugin->get_mrl(stream->input_plugin): NULL;
+  pthread_mutex_lock(&this->lock);
+  snprintf(this->mrl, sizeof(this->mrl), "%s", mrl ? mrl: "");
+  pthread_mutex_unlock(&this->lock);
+
+  clock_gettime(CLOCK_MONOTONIC, &tsstart);
   open_output_driver(this);
   pthread_mutex_unlock(&this->port_lock);
-  llprintf(LOG_1, "video opened\n");
+  llprintf(LOG_1, "video opened (plugin overhead %d us)\n", elapsed_us(&tsstart));
 }
 
 
@@ -1646,11 +2730,22 @@ static void atmo_video_close(xine_video_port_t *port_gen, xine_stream_t *stream)
   post_video_port_t *port = (post_video_port_t *)port_gen;
   atmo_post_plugin_t *this = (atmo_post_plugin_t *) port->post;
 
+  struct timespec tsstart;
+
   llprintf(LOG_1, "video close\n");
   pthread_mutex_lock(&this->port_lock);
+  clock_gettime(CLOCK_MONOTONIC, &tsstart);
   suspend_threads(this);
+  int overhead = elapsed_us(&tsstart);
+  if (overhead > CLOSE_OVERHEAD_LIMIT)
+    xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo: suspending threads on video close took %d us\n", overhead);
+  else
+    llprintf(LOG_1, "threads suspended (plugin overhead %d us)\n", overhead);
 
   this->port = NULL;
+  pthread_mutex_lock(&this->lock);
+  this->mrl[0] = 0;
+  pthread_mutex_unlock(&this->lock);
   port->original_port->close(port->original_port, stream);
   port->stream = NULL;
   pthread_mutex_unlock(&this->port_lock);
@@ -1664,6 +2759,31 @@ static void atmo_video_close(xine_video_port_t *port_gen, xine_stream_t *stream)
  *    Parameter functions
  */
 
+static void change_channels_layout(atmo_post_plugin_t *this) {
+  atmo_channels_t *ch = config_channels(&this->parm);
+  if (!ch) {
+    xine_log(this->post_plugin.xine, XINE_LOG_PLUGIN, "atmo: can't allocate channel layout!\n");
+    return;
+  }
+
+    /* prepare weight image for actual analyze size so the grab thread can use the new layout immediately */
+  pthread_mutex_lock(&this->lock);
+  int width = this->channels->weight_width;
+  int height = this->channels->weight_height;
+  int edge_weighting = this->channels->weight_edge_weighting;
+  pthread_mutex_unlock(&this->lock);
+  if (width && height && ch->sum_channels)
+    update_weight(ch, width, height, edge_weighting);
+
+    /* output thread takes over new layout at begin of next output cycle */
+  pthread_mutex_lock(&this->lock);
+  unref_channels(this->pending_channels);
+  this->pending_channels = ch;
+  pthread_mutex_unlock(&this->lock);
+  eventfd_write(this->output_cmd_fd, 1);
+}
+
+
 static xine_post_api_descr_t *atmo_get_param_descr(void)
 {
   return &atmo_param_descr;
@@ -1675,7 +2795,17 @@ static int atmo_set_parameters(xine_post_t *this_gen, void *parm_gen)
   atmo_post_plugin_t *this = (atmo_post_plugin_t *)this_gen;
 
   if (join_post_api_parameters(&atmo_param_descr, &this->parm, parm_gen)) {
-    char buf[512];
+    char buf[1024];
+
+      /* statistics report is a trigger that is not stored */
+    if (this->parm.stats_report) {
+      this->parm.stats_report = 0;
+      pthread_mutex_lock(&this->lock);
+      ++this->stats_request;
+      pthread_mutex_unlock(&this->lock);
+    }
+    update_stats_server(this);
+
     build_post_api_parameter_string(buf, sizeof(buf), &atmo_param_descr, &this->parm, &this->default_parm);
     this->post_plugin.xine->config->update_string(this->post_plugin.xine->config, "post.atmo.parameters", buf);
     llprintf(LOG_1, "set parameters\n");
@@ -1699,15 +2829,31 @@ static int atmo_set_parameters(xine_post_t *this_gen, void *parm_gen)
           this->active_parm.sat_win_size = this->parm.sat_win_size;
           this->active_parm.hue_threshold = this->parm.hue_threshold;
           this->active_parm.start_delay = this->parm.start_delay;
+          this->active_parm.output_rate = this->parm.output_rate;
+          this->active_parm.output_sched = this->parm.output_sched;
+          this->active_parm.output_priority = this->parm.output_priority;
+          this->active_parm.grab_cpus = this->parm.grab_cpus;
+          this->active_parm.output_cpus = this->parm.output_cpus;
           this->active_parm.wc_blue = this->parm.wc_blue;
           this->active_parm.wc_green = this->parm.wc_green;
           this->active_parm.wc_red = this->parm.wc_red;
+          this->active_parm.stats_interval = this->parm.stats_interval;
+          this->active_parm.color_cache = this->parm.color_cache;
+          pthread_mutex_lock(&this->lock);
+          memcpy(this->active_parm.capture_file, this->parm.capture_file, sizeof(this->active_parm.capture_file));
+          pthread_mutex_unlock(&this->lock);
+
+          if (this->channels && !same_channels_layout(this->channels, &this->parm))
+            change_channels_layout(this);
         }
       } else {
         if (this->active_parm.enabled) {
           stop_threads(this);
-          close_output_driver(this);
+          turn_lights_off(this);
         }
+          /* selecting another driver (e.g. driver=none) while disabled releases the device */
+        if (this->driver_opened && driver_selection_changed(this))
+          close_output_driver(this);
       }
       this->active_parm.enabled = this->parm.enabled;
     }
@@ -1748,11 +2894,16 @@ static void atmo_dispose(post_plugin_t *this_gen)
   stop_threads(this);
 
   if (_x_post_dispose(this_gen)) {
+    if (this->stats_server)
+      stop_stats_server(this->stats_server);
     close_output_driver(this);
-    free_channels(this);
+    unref_channels(this->channels);
+    unref_channels(this->pending_channels);
     pthread_mutex_destroy(&this->lock);
     pthread_mutex_destroy(&this->port_lock);
     pthread_cond_destroy(&this->thread_state_change);
+    close(this->grab_cmd_fd);
+    close(this->output_cmd_fd);
     free(this);
     llprintf(LOG_1, "final dispose\n");
   }
@@ -1783,6 +2934,18 @@ static post_plugin_t *atmo_open_plugin(post_class_t *class_gen,
   if (!this)
     return NULL;
 
+  this->grab_cmd_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  this->output_cmd_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (this->grab_cmd_fd < 0 || this->output_cmd_fd < 0) {
+    xine_log(class->xine, XINE_LOG_PLUGIN, "atmo: can't create thread command channels (%s)\n", strerror(errno));
+    if (this->grab_cmd_fd >= 0)
+      close(this->grab_cmd_fd);
+    if (this->output_cmd_fd >= 0)
+      close(this->output_cmd_fd);
+    free(this);
+    return NULL;
+  }
+
   _x_post_init(&this->post_plugin, 0, 1);
   this->post_plugin.xine = class->xine;
 
@@ -1823,6 +2986,7 @@ static post_plugin_t *atmo_open_plugin(post_class_t *class_gen,
   this->parm.filter_smoothness = 50;
   this->parm.filter_threshold = 40;
   this->parm.filter_delay = 0;
+  this->parm.output_rate = 50;
   this->parm.hue_win_size = 3;
   this->parm.sat_win_size = 3;
   this->parm.hue_threshold = 93;
@@ -1831,6 +2995,11 @@ static post_plugin_t *atmo_open_plugin(post_class_t *class_gen,
   this->parm.wc_blue = 255;
   this->parm.gamma = 0;
   this->parm.start_delay = 250;
+  this->parm.output_sched = 0;
+  this->parm.output_priority = 10;
+  this->parm.grab_cpus = 0;
+  this->parm.output_cpus = 0;
+  this->parm.lock_memory = 0;
   this->default_parm = this->parm;
 
     /* Read parameters from xine configuration file */
@@ -1841,11 +3010,13 @@ static post_plugin_t *atmo_open_plugin(post_class_t *class_gen,
   if (param)
     parse_post_api_parameter_string(&atmo_param_descr, &this->parm, param);
 
-  char buf[512];
+  char buf[1024];
   build_post_api_parameter_string(buf, sizeof(buf), &atmo_param_descr, &this->parm, &this->default_parm);
   if (!param || strcmp(param, buf))
     config->update_string(config, "post.atmo.parameters", buf);
 
+  update_stats_server(this);
+
   llprintf(LOG_1, "plugin opened\n");
   return &this->post_plugin;
 }